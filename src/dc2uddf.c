@@ -44,11 +44,17 @@ typedef struct program_options_t {
   guchar initialPressureFix;
   guchar dumpDives;
   guchar useInvalidElements;
+  guchar memReport;      // print memory usage after parsing and saving
+  dif_xml_writer_t writer; // how the UDDF is written, see xml_options_t
+  guint threads;         // dive rendering workers, 0 for one per processor
+  gchar *compress;       // --compress CODEC[:LEVEL], NULL to go by the file name
+  dif_compression_t compression; // codec the UDDF is written with
+  gint compressionLevel; // level for the codec, 0 for its default
   gchar *fromDump;       // replay dives from this dump file (no device)
   gchar *saveDump;       // save raw dive records to this file during download
   gchar *dumpMemoryFile; // save a full device memory image to this file
   int limit;    // limit number of dives (0 = unlimited)
-  time_t since; // download dives since this timestamp
+  gint64 sinceDay; // download dives from this local day on, G_MININT64 for all
 } program_options_t;
 
 typedef struct dive_data_t {
@@ -56,11 +62,12 @@ typedef struct dive_data_t {
   dc_context_t *context;
   dc_descriptor_t *descriptor;
   FILE *dumpFile; // when set, raw dive records are appended here
+  GBytes *source; // replay buffer the records live in, NULL when live
   unsigned int number;
   dc_buffer_t *fingerprint;
   dif_dive_collection_t *dc;
   int limit;     // dive limit from options
-  time_t since;  // date filter from options
+  gint64 sinceDay; // date filter from options, see dif_days_from_civil
   int collected; // number of dives collected
 } dive_data_t;
 
@@ -228,34 +235,34 @@ void sample_cb(dc_sample_type_t type, const dc_sample_value_t *value,
 
   switch (type) {
   case DC_SAMPLE_TIME:
-    sample = dif_sample_alloc();
+    sample = dif_dive_alloc_sample(dive);
     udata->sample = sample;
-    dive = dif_dive_add_sample(dive, sample);
     /* libdivecomputer >= 0.8 reports sample time in milliseconds; UDDF
      * divetime and dif_sample_t.timestamp are in seconds */
     sample->timestamp = value->time / 1000;
+    dive = dif_dive_add_sample(dive, sample);
     break;
   case DC_SAMPLE_DEPTH:
-    subsample = dif_subsample_alloc();
+    subsample = dif_dive_alloc_subsample(dive);
     subsample->type = DIF_SAMPLE_DEPTH;
     subsample->value.depth = value->depth;
     sample = dif_sample_add_subsample(sample, subsample);
     break;
   case DC_SAMPLE_PRESSURE:
-    subsample = dif_subsample_alloc();
+    subsample = dif_dive_alloc_subsample(dive);
     subsample->type = DIF_SAMPLE_PRESSURE;
     subsample->value.pressure.tank = value->pressure.tank;
     subsample->value.pressure.value = value->pressure.value;
     sample = dif_sample_add_subsample(sample, subsample);
     break;
   case DC_SAMPLE_TEMPERATURE:
-    subsample = dif_subsample_alloc();
+    subsample = dif_dive_alloc_subsample(dive);
     subsample->type = DIF_SAMPLE_TEMPERATURE;
     subsample->value.temperature = value->temperature;
     sample = dif_sample_add_subsample(sample, subsample);
     break;
   case DC_SAMPLE_EVENT:
-    subsample = dif_subsample_alloc();
+    subsample = dif_dive_alloc_subsample(dive);
     subsample->type = DIF_SAMPLE_EVENT;
     subsample->value.event.type = dc_to_dif_event(value->event.type);
     subsample->value.event.time = value->event.time;
@@ -264,28 +271,28 @@ void sample_cb(dc_sample_type_t type, const dc_sample_value_t *value,
     sample = dif_sample_add_subsample(sample, subsample);
     break;
   case DC_SAMPLE_RBT:
-    subsample = dif_subsample_alloc();
+    subsample = dif_dive_alloc_subsample(dive);
     subsample->type = DIF_SAMPLE_RBT;
     // TODO: my computer reports RBT in minutes, so we multiply here
     subsample->value.rbt = value->rbt * 60;
     sample = dif_sample_add_subsample(sample, subsample);
     break;
   case DC_SAMPLE_HEARTBEAT:
-    subsample = dif_subsample_alloc();
+    subsample = dif_dive_alloc_subsample(dive);
     subsample->type = DIF_SAMPLE_HEARTBEAT;
     subsample->value.heartbeat = value->heartbeat;
     sample = dif_sample_add_subsample(sample, subsample);
     break;
   case DC_SAMPLE_BEARING:
-    subsample = dif_subsample_alloc();
+    subsample = dif_dive_alloc_subsample(dive);
     subsample->type = DIF_SAMPLE_BEARING;
     subsample->value.bearing = value->bearing;
     sample = dif_sample_add_subsample(sample, subsample);
     break;
   case DC_SAMPLE_VENDOR:
-    subsample = dif_subsample_alloc();
-    dif_subsample_set_vendor(subsample, value->vendor.type,
-                             value->vendor.size, value->vendor.data);
+    subsample = dif_dive_alloc_subsample(dive);
+    dif_dive_subsample_set_vendor(dive, subsample, value->vendor.type,
+                                  value->vendor.size, value->vendor.data);
     sample = dif_sample_add_subsample(sample, subsample);
     break;
   default:
@@ -322,6 +329,11 @@ static dc_status_t doparse(dive_data_t *divedata, const unsigned char data[],
   }
   dc = dif_dive_collection_add_dive(dc, dive);
 
+  /* in replay the record lives in the dump buffer for as long as the dive
+   * holds on to it, so vendor payloads can point there instead of being
+   * copied. live records are transient and always copied. */
+  dive = dif_dive_set_source(dive, divedata->source);
+
   /* create the parser */
   message("Creating the parser.\n");
   dc_parser_t *parser = NULL;
@@ -479,23 +491,31 @@ static dc_status_t doparse(dive_data_t *divedata, const unsigned char data[],
         &alarmError);
     if (alarms != NULL) {
       guint nwarnings = 0, nalarms = 0;
+      /* the decoder walks the sample stream in order, so the events are
+       * already sorted by timestamp and can be merged in one pass */
+      GArray *difAlarms =
+          g_array_sized_new(FALSE, FALSE, sizeof(dif_alarm_t), alarms->len);
       for (i = 0; i < alarms->len; ++i) {
         uwatec_alarm_event_t *event =
             &g_array_index(alarms, uwatec_alarm_event_t, i);
+        dif_alarm_t alarm = {event->timestamp, DIF_ALARM_ERROR, 0.0, TRUE};
         /* when both bits are set only the alarm is emitted: a red alarm
          * subsumes the yellow warning at the same instant */
         if (event->alarms & UWATEC_ALARM_ALARM) {
-          dive = dif_dive_add_alarm(dive, event->timestamp, DIF_ALARM_ERROR,
-                                    2.0, TRUE);
+          alarm.level = 2.0;
+          g_array_append_val(difAlarms, alarm);
           nalarms++;
         } else if (event->alarms & UWATEC_ALARM_WARNING) {
-          dive = dif_dive_add_alarm(dive, event->timestamp, DIF_ALARM_ERROR,
-                                    1.0, TRUE);
+          alarm.level = 1.0;
+          g_array_append_val(difAlarms, alarm);
           nwarnings++;
         }
         /* UWATEC_ALARM_WORKLOAD_WARNING is intentionally skipped: it is
          * informational (lung symbol) and no UDDF alarm token fits */
       }
+      dive = dif_dive_add_alarms(dive, (dif_alarm_t *)difAlarms->data,
+                                 difAlarms->len);
+      g_array_free(difAlarms, TRUE);
       if (nwarnings > 0 || nalarms > 0) {
         message("Decoded Uwatec alarm bits: %u warning, %u alarm samples.\n",
                 nwarnings, nalarms);
@@ -547,24 +567,18 @@ static int dive_cb(const unsigned char *data, unsigned int size,
   }
 
   // Parse datetime to check --since filter
-  if (divedata->since > 0) {
+  if (divedata->sinceDay != G_MININT64) {
     dc_parser_t *parser = NULL;
     dc_status_t rc = make_parser(&parser, divedata, data, size);
     if (rc == DC_STATUS_SUCCESS) {
       dc_datetime_t dt = {0};
       rc = dc_parser_get_datetime(parser, &dt);
       if (rc == DC_STATUS_SUCCESS) {
-        // Convert to time_t for comparison
-        struct tm dive_tm = {0};
-        dive_tm.tm_year = dt.year - 1900;
-        dive_tm.tm_mon = dt.month - 1;
-        dive_tm.tm_mday = dt.day;
-        dive_tm.tm_hour = dt.hour;
-        dive_tm.tm_min = dt.minute;
-        dive_tm.tm_sec = dt.second;
-        time_t dive_time = mktime(&dive_tm);
-
-        if (dive_time < divedata->since) {
+        // the dive computer clock is local wall time, so its date is
+        // already the local day the filter counts in
+        gint64 day = dif_days_from_civil(dt.year, dt.month, dt.day);
+
+        if (day < divedata->sinceDay) {
           message("Dive from %04d-%02d-%02d is before cutoff, stopping.\n",
                   dt.year, dt.month, dt.day);
           dc_parser_destroy(parser);
@@ -641,6 +655,48 @@ void sighandler(int signum) {
 
 static int cancel_cb(void *userdata) { return g_cancel; }
 
+/* Prints where the memory of the dive collection goes, for --mem-report. */
+static void print_memory_report(const char *stage, dif_dive_collection_t *dc) {
+  dif_memory_stats_t *stats = dif_dive_collection_memory_stats(dc);
+  unsigned int type;
+
+  printf("memory after %s: %" G_GSIZE_FORMAT " bytes\n", stage,
+         stats->totalBytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n", "dives",
+         stats->dives.count, stats->dives.bytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n", "samples",
+         stats->samples.count, stats->samples.bytes);
+  for (type = 0; type < DIF_SAMPLE_TYPE_COUNT; type++) {
+    if (stats->subsamples[type].count > 0) {
+      printf("  subsamples %-9s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+             dif_sample_type_name(type), stats->subsamples[type].count,
+             stats->subsamples[type].bytes);
+    }
+  }
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+         "pointer arrays", stats->pointerArrays.count,
+         stats->pointerArrays.bytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+         "vendor blobs", stats->vendorBlobs.count, stats->vendorBlobs.bytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+         "vendor views", stats->vendorViews.count, stats->vendorViews.bytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+         "source buffers", stats->sources.count, stats->sources.bytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+         "setmarkers", stats->setmarkers.count, stats->setmarkers.bytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+         "gas mixes", stats->gasmixes.count, stats->gasmixes.bytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT
+         " (%" G_GSIZE_FORMAT " used)\n",
+         "arena blocks", stats->arenas.count, stats->arenas.bytes,
+         stats->arenaBytesUsed);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+         "compact rows", stats->compactRows.count, stats->compactRows.bytes);
+  printf("  %-20s %10" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n", "caches",
+         stats->caches.count, stats->caches.bytes);
+  dif_memory_stats_free(stats);
+}
+
 /* Applies the post-processing algorithms and saves the collected dives
  * as UDDF. Shared by the live download and dump replay paths. */
 static void process_and_save(dive_data_t *divedata,
@@ -648,6 +704,15 @@ static void process_and_save(dive_data_t *divedata,
   xml_options_t *xmlOptions = dif_xml_options_alloc();
   xmlOptions->filename = options->xmlfile;
   xmlOptions->useInvalidElements = options->useInvalidElements;
+  xmlOptions->measureDocument = options->memReport;
+  xmlOptions->writer = options->writer;
+  xmlOptions->threads = options->threads;
+  xmlOptions->compression = options->compression;
+  xmlOptions->compressionLevel = options->compressionLevel;
+
+  if (options->memReport) {
+    print_memory_report("parsing", divedata->dc);
+  }
 
   if (options->truncateDives) {
     divedata->dc = dif_alg_dc_truncate_dives(divedata->dc);
@@ -656,8 +721,26 @@ static void process_and_save(dive_data_t *divedata,
   if (options->initialPressureFix) {
     divedata->dc = dif_alg_dc_initial_pressure_fix(divedata->dc);
   }
+
+  /* nothing changes the dives from here on, so any further output stage
+   * can take a reference and read them alongside the serializer */
+  divedata->dc = dif_dive_collection_freeze(divedata->dc);
   dif_save_dive_collection_uddf_options(divedata->dc, xmlOptions);
 
+  if (options->memReport) {
+    print_memory_report("saving", divedata->dc);
+    if (options->writer == DIF_XML_WRITER_DIRECT) {
+      printf("output buffer: %" G_GSIZE_FORMAT " bytes\n",
+             xmlOptions->documentBytes);
+    } else {
+      printf("xml %s: %" G_GSIZE_FORMAT " nodes, %" G_GSIZE_FORMAT
+             " bytes\n",
+             options->writer == DIF_XML_WRITER_STREAM ? "largest subtree"
+                                                      : "document",
+             xmlOptions->documentNodes, xmlOptions->documentBytes);
+    }
+  }
+
   dif_dive_collection_free(divedata->dc);
   divedata->dc = NULL;
   dif_xml_options_free(xmlOptions);
@@ -785,11 +868,12 @@ static dc_status_t dowork(dc_context_t *context, dc_descriptor_t *descriptor,
     divedata.context = context;
     divedata.descriptor = descriptor;
     divedata.dumpFile = NULL;
+    divedata.source = NULL;
     divedata.fingerprint = NULL;
     divedata.number = 0;
     divedata.dc = dc;
     divedata.limit = options->limit;
-    divedata.since = options->since;
+    divedata.sinceDay = options->sinceDay;
     divedata.collected = 0;
 
     if (options->saveDump != NULL) {
@@ -866,32 +950,37 @@ static dc_status_t doreplay(dc_context_t *context, dc_descriptor_t *descriptor,
     return DC_STATUS_IO;
   }
 
+  /* the dives keep their own references, so the buffer lives until the
+   * last of them is freed */
+  GBytes *source = g_bytes_new_take(contents, length);
+
   dive_data_t divedata = {0};
   divedata.device = NULL;
   divedata.context = context;
   divedata.descriptor = descriptor;
   divedata.dumpFile = NULL;
+  divedata.source = source;
   divedata.fingerprint = NULL;
   divedata.number = 0;
   divedata.dc = dif_dive_collection_alloc();
   divedata.limit = options->limit;
-  divedata.since = options->since;
+  divedata.sinceDay = options->sinceDay;
   divedata.collected = 0;
 
   gint records = dumpfile_foreach_uwatec_smart(
-      (const guint8 *)contents, length, replay_record_cb, &divedata, &error);
+      g_bytes_get_data(source, NULL), length, replay_record_cb, &divedata, &error);
   if (records < 0) {
     WARNING("Error splitting the dump file into dives.");
     fprintf(stderr, "error: %s\n", error->message);
     g_error_free(error);
     dif_dive_collection_free(divedata.dc);
-    g_free(contents);
+    g_bytes_unref(source);
     return DC_STATUS_DATAFORMAT;
   }
   message("Replayed %d records from %s.\n", records, options->fromDump);
 
   process_and_save(&divedata, options);
-  g_free(contents);
+  g_bytes_unref(source);
 
   return DC_STATUS_SUCCESS;
 }
@@ -1033,7 +1122,8 @@ void usage() {
   fprintf(stderr, "  -b,--backend BACKEND: use backend called BACKEND\n");
   fprintf(stderr, "  -d,--device DEVICE: use device called DEVICE\n");
   fprintf(stderr,
-          "  -o,--output UDDFFILE: save UDDF to file called UDDFFILE\n");
+          "  -o,--output UDDFFILE: save UDDF to file called UDDFFILE, "
+          "compressed if it ends in .gz or .zst\n");
   fprintf(stderr, "  -i,--ipf: calculate initial pressure fix\n");
   fprintf(stderr, "  -t,--truncate: truncate dives after surfacing\n");
   fprintf(stderr, "  -l,--limit NUMBER: limit download to NUMBER dives\n");
@@ -1048,6 +1138,15 @@ void usage() {
                   "device memory image to FILE (NOT replayable)\n");
   fprintf(stderr, "  --invalid: add invalid <event> and <vendor> tags to "
                   "assist debugging\n");
+  fprintf(stderr, "  --mem-report: print memory used by the dives after "
+                  "parsing and after saving\n");
+  fprintf(stderr, "  --writer MODE: how to write the UDDF: tree builds the "
+                  "whole document in memory first (default), stream writes "
+                  "it while walking the dives, direct also skips libxml2\n");
+  fprintf(stderr, "  --compress CODEC[:LEVEL]: compress the UDDF with gzip or "
+                  "zstd as it is written, or not at all with none\n");
+  fprintf(stderr, "  --threads NUMBER: render dives on NUMBER workers with "
+                  "--writer direct (default: one per processor)\n");
   fprintf(stderr, "  --listbackends: print all the backends\n");
   fprintf(stderr, "  --listdevices: print all the devices\n");
   fprintf(stderr, "  -h,--help: print this help screen\n");
@@ -1078,6 +1177,55 @@ void print_devices() {
   exit(EXIT_FAILURE);
 }
 
+/* Works out the codec of the output from --compress, or from the name of
+ * the output file without it. Exits if the codec or level is not valid. */
+static void parse_compression(program_options_t *options) {
+  gint maxLevel;
+
+  options->compression = DIF_COMPRESSION_NONE;
+  options->compressionLevel = 0;
+  if (options->compress == NULL) {
+    if (g_str_has_suffix(options->xmlfile, ".gz")) {
+      options->compression = DIF_COMPRESSION_GZIP;
+    } else if (g_str_has_suffix(options->xmlfile, ".zst")) {
+      options->compression = DIF_COMPRESSION_ZSTD;
+    }
+  } else {
+    gchar **parts = g_strsplit(options->compress, ":", 2);
+    if (g_strcmp0("gzip", parts[0]) == 0) {
+      options->compression = DIF_COMPRESSION_GZIP;
+    } else if (g_strcmp0("zstd", parts[0]) == 0) {
+      options->compression = DIF_COMPRESSION_ZSTD;
+    } else if (g_strcmp0("none", parts[0]) != 0) {
+      fprintf(stderr, "Invalid compression: %s\n", options->compress);
+      exit(EXIT_FAILURE);
+    }
+    if (parts[1] != NULL) {
+      options->compressionLevel = atoi(parts[1]);
+      if (options->compressionLevel < 1 ||
+          options->compression == DIF_COMPRESSION_NONE) {
+        fprintf(stderr, "Invalid compression level: %s\n", options->compress);
+        exit(EXIT_FAILURE);
+      }
+    }
+    g_strfreev(parts);
+  }
+
+  if (options->compression == DIF_COMPRESSION_NONE) {
+    return;
+  }
+  maxLevel = dif_compression_max_level(options->compression);
+  if (maxLevel == 0) {
+    fprintf(stderr, "dc2uddf was built without zstd support\n");
+    exit(EXIT_FAILURE);
+  }
+  if (options->compressionLevel > maxLevel) {
+    fprintf(stderr, "Invalid compression level: %d (the highest is %d)\n",
+            options->compressionLevel, maxLevel);
+    exit(EXIT_FAILURE);
+  }
+}
+
 int main(int argc, char **argv) {
   int opt;
 
@@ -1090,11 +1238,15 @@ int main(int argc, char **argv) {
   options.logfile = "output.log";
   options.dumpDives = 1;
   options.useInvalidElements = 0;
+  options.memReport = 0;
+  options.writer = DIF_XML_WRITER_TREE;
+  options.threads = 0;
+  options.compress = NULL;
   options.fromDump = NULL;
   options.saveDump = NULL;
   options.dumpMemoryFile = NULL;
   options.limit = 0; // 0 = unlimited
-  options.since = 0; // 0 = no date filter
+  options.sinceDay = G_MININT64; // no date filter
 
   static struct option long_options[] = {
       {"backend", required_argument, NULL, 'b'},
@@ -1106,6 +1258,10 @@ int main(int argc, char **argv) {
       {"limit", required_argument, NULL, 'l'},
       {"since", required_argument, NULL, 's'},
       {"invalid", no_argument, NULL, 0},
+      {"mem-report", no_argument, NULL, 0},
+      {"writer", required_argument, NULL, 0},
+      {"threads", required_argument, NULL, 0},
+      {"compress", required_argument, NULL, 0},
       {"listdevices", no_argument, NULL, 0},
       {"listbackends", no_argument, NULL, 0},
       {"from-dump", required_argument, NULL, 0},
@@ -1132,6 +1288,32 @@ int main(int argc, char **argv) {
       if (g_strcmp0("invalid", long_options[option_index].name) == 0) {
         options.useInvalidElements = 1;
       }
+      if (g_strcmp0("mem-report", long_options[option_index].name) == 0) {
+        options.memReport = 1;
+      }
+      if (g_strcmp0("writer", long_options[option_index].name) == 0) {
+        if (g_strcmp0("tree", optarg) == 0) {
+          options.writer = DIF_XML_WRITER_TREE;
+        } else if (g_strcmp0("stream", optarg) == 0) {
+          options.writer = DIF_XML_WRITER_STREAM;
+        } else if (g_strcmp0("direct", optarg) == 0) {
+          options.writer = DIF_XML_WRITER_DIRECT;
+        } else {
+          fprintf(stderr, "Invalid writer: %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+      }
+      if (g_strcmp0("threads", long_options[option_index].name) == 0) {
+        int threads = atoi(optarg);
+        if (threads < 1) {
+          fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        options.threads = threads;
+      }
+      if (g_strcmp0("compress", long_options[option_index].name) == 0) {
+        options.compress = optarg;
+      }
       if (g_strcmp0("from-dump", long_options[option_index].name) == 0) {
         options.fromDump = optarg;
       }
@@ -1173,19 +1355,17 @@ int main(int argc, char **argv) {
 
     case 's': {
       // Parse date in format YYYY-MM-DD
-      struct tm tm = {0};
-      if (sscanf(optarg, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) !=
-          3) {
+      int year, month, day;
+      if (sscanf(optarg, "%d-%d-%d", &year, &month, &day) != 3) {
         fprintf(stderr, "Invalid date format. Use YYYY-MM-DD\n");
         exit(EXIT_FAILURE);
       }
-      tm.tm_year -= 1900; // tm_year is years since 1900
-      tm.tm_mon -= 1;     // tm_mon is 0-11
-      options.since = mktime(&tm);
-      if (options.since == -1) {
+      if (year < 1 || year > 9999 || day < 1 || day > 31 ||
+          !g_date_valid_dmy(day, month, year)) {
         fprintf(stderr, "Invalid date: %s\n", optarg);
         exit(EXIT_FAILURE);
       }
+      options.sinceDay = dif_days_from_civil(year, month, day);
     } break;
 
     case '?':
@@ -1199,6 +1379,7 @@ int main(int argc, char **argv) {
     }
     opt = getopt_long(argc, argv, getopt_short, long_options, &option_index);
   }
+  parse_compression(&options);
 
   if (options.fromDump != NULL &&
       (options.saveDump != NULL || options.dumpMemoryFile != NULL)) {
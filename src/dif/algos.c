@@ -14,11 +14,9 @@
  * point
  */
 dif_dive_collection_t *dif_alg_dc_initial_pressure_fix(dif_dive_collection_t *dc) {
-    GList *diveList = g_list_first(dc->dives);
-    while (diveList != NULL) {
-        dif_dive_t *dive = diveList->data;
-        dif_alg_dive_initial_pressure_fix(dive);
-        diveList = g_list_next(diveList);
+    guint i;
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_alg_dive_initial_pressure_fix(g_ptr_array_index(dc->dives, i));
     }
     return dc;
 }
@@ -26,11 +24,14 @@ dif_dive_collection_t *dif_alg_dc_initial_pressure_fix(dif_dive_collection_t *dc
 dif_dive_t *dif_alg_dive_initial_pressure_fix(dif_dive_t *dive) {
     gdouble initialPressure = 0.0;
     guint initialTank = 1;
+    guint i;
+    guint nNeedPressure = 0;
+    g_return_val_if_fail(!dive->frozen, dive);
 
-    GList *tmp = g_list_first(dive->samples);
-    GList *needPressure = NULL;
-    while (tmp != NULL && initialPressure < PRESSURE_MIN) {
-        dif_sample_t *sample = tmp->data;
+    /* the samples before the first valid pressure are a prefix of the
+     * sample array, so counting them is enough to find them again */
+    for (i = 0; i < dive->samples->len && initialPressure < PRESSURE_MIN; i++) {
+        dif_sample_t *sample = g_ptr_array_index(dive->samples, i);
         dif_subsample_t *ss = dif_sample_get_subsample(sample, DIF_SAMPLE_PRESSURE);
         if (ss != NULL) {
             gdouble pressure = ss->value.pressure.value;
@@ -42,37 +43,33 @@ dif_dive_t *dif_alg_dive_initial_pressure_fix(dif_dive_t *dive) {
 
         /* account for double comparison problems */
         if (initialPressure < PRESSURE_MIN) {
-            needPressure = g_list_append(needPressure, tmp->data);
+            nNeedPressure++;
         }
-        tmp = g_list_next(tmp);
     }
     if (initialPressure > PRESSURE_MIN) {
-        while (needPressure != NULL) {
-            dif_sample_t *sample = needPressure->data;
+        for (i = 0; i < nNeedPressure; i++) {
+            dif_sample_t *sample = g_ptr_array_index(dive->samples, i);
             dif_subsample_t *ss = dif_sample_get_subsample(sample, DIF_SAMPLE_PRESSURE);
             if (ss != NULL) {
                 ss->value.pressure.value = initialPressure;
             } else {
-                ss = dif_subsample_alloc();
+                ss = dif_dive_alloc_subsample(dive);
                 ss->type = DIF_SAMPLE_PRESSURE;
                 ss->value.pressure.tank = initialTank;
                 ss->value.pressure.value = initialPressure;
                 dif_sample_add_subsample(sample, ss);
             }
-            needPressure = g_list_next(needPressure);
         }
+        /* pressures were rewritten in place */
+        dif_dive_invalidate_caches(dive);
     }
-    /* just free the list, not the elements */
-    g_list_free(needPressure);
     return dive;
 }
 
 dif_dive_collection_t *dif_alg_dc_truncate_dives(dif_dive_collection_t *dc) {
-    GList *diveList = g_list_first(dc->dives);
-    while (diveList != NULL) {
-        dif_dive_t *dive = diveList->data;
-        dif_alg_dive_truncate_dive(dive);
-        diveList = g_list_next(diveList);
+    guint i;
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_alg_dive_truncate_dive(g_ptr_array_index(dc->dives, i));
     }
     return dc;
 }
@@ -83,32 +80,32 @@ dif_dive_collection_t *dif_alg_dc_truncate_dives(dif_dive_collection_t *dc) {
  * depth goes below 0.0
  */
 dif_dive_t *dif_alg_dive_truncate_dive(dif_dive_t *dive) {
-    GList *samples = g_list_first(dive->samples);
-    GList *currentLast = NULL;
-    while (samples != NULL) {
-        dif_sample_t *sample = samples->data;
+    guint i;
+    gint currentLast = -1;
+    g_return_val_if_fail(!dive->frozen, dive);
+    for (i = 0; i < dive->samples->len; i++) {
+        dif_sample_t *sample = g_ptr_array_index(dive->samples, i);
         dif_subsample_t *ss = dif_sample_get_subsample(sample, DIF_SAMPLE_DEPTH);
 
         if (ss != NULL) {
             if (ss->value.depth >= DEPTH_MIN) {
-                currentLast = NULL;
-            } else if (currentLast == NULL && ss->value.depth - EPSILON < 0) {
-                currentLast = samples;
+                currentLast = -1;
+            } else if (currentLast < 0 && ss->value.depth - EPSILON < 0) {
+                currentLast = i;
             }
         }
-        samples = g_list_next(samples);
     }
 
-    if (currentLast != NULL) {
-        currentLast = g_list_next(currentLast);
-        while (currentLast != NULL) {
-            /* keep that last sample */
-            GList *thisLink = currentLast;
-            currentLast = g_list_next(currentLast);
-            dif_sample_free(thisLink->data);
-            thisLink->data = NULL;
-            g_list_delete_link(currentLast, thisLink);
+    /* keep that last sample and release everything after it */
+    if (currentLast >= 0 && (guint) currentLast + 1 < dive->samples->len) {
+        if (dive->nHeapOwned > 0) {
+            for (i = currentLast + 1; i < dive->samples->len; i++) {
+                dif_sample_free(g_ptr_array_index(dive->samples, i));
+            }
         }
+        g_ptr_array_remove_range(dive->samples, currentLast + 1,
+                                 dive->samples->len - currentLast - 1);
+        dif_dive_invalidate_caches(dive);
     }
     return dive;
 }
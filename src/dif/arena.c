@@ -0,0 +1,104 @@
+#include <string.h>
+#include <glib.h>
+#include "dif.h"
+
+/* blocks start small so short dives stay small, and double up to the
+ * maximum; a dive with a few thousand waypoints fits in a handful */
+#define ARENA_BLOCK_MIN (1024)
+#define ARENA_BLOCK_MAX (64 * 1024)
+/* every allocation is aligned for doubles and pointers */
+#define ARENA_ALIGN (2 * sizeof(gpointer))
+
+typedef struct dif_arena_block_t {
+    struct dif_arena_block_t *next;
+    gsize size;
+    gsize used;
+    /* pads the header to four words, so data starts at a multiple of
+     * ARENA_ALIGN and g_malloc's alignment carries over to it */
+    gsize reserved;
+    gdouble data[];
+} dif_arena_block_t;
+
+G_STATIC_ASSERT(G_STRUCT_OFFSET(dif_arena_block_t, data) % ARENA_ALIGN == 0);
+
+dif_arena_t *dif_arena_alloc() {
+    dif_arena_t *arena;
+    arena = g_malloc0(sizeof(dif_arena_t));
+    return arena;
+}
+
+/**
+ * release every block of the arena, and with it every allocation that was
+ * served from it
+ */
+void dif_arena_free(dif_arena_t *arena) {
+    dif_arena_block_t *block;
+    if (arena == NULL) {
+        return;
+    }
+    block = arena->blocks;
+    while (block != NULL) {
+        dif_arena_block_t *next = block->next;
+        g_free(block);
+        block = next;
+    }
+    g_free(arena);
+}
+
+/**
+ * carve zeroed memory out of the arena
+ *
+ * requests larger than half a block get a dedicated block of their exact
+ * size, which is linked behind the current one so the current block keeps
+ * serving small requests
+ */
+gpointer dif_arena_malloc0(dif_arena_t *arena, gsize size) {
+    dif_arena_block_t *block = arena->blocks;
+    gsize aligned = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    gpointer ptr;
+
+    if (aligned == 0) {
+        aligned = ARENA_ALIGN;
+    }
+    if (block == NULL || block->size - block->used < aligned) {
+        gsize nextSize = MIN((gsize) ARENA_BLOCK_MIN << MIN(arena->nblocks, 6), ARENA_BLOCK_MAX);
+        gboolean dedicated = aligned > nextSize / 2;
+        gsize blockSize = dedicated ? aligned : nextSize;
+        dif_arena_block_t *newBlock = g_malloc(sizeof(dif_arena_block_t) + blockSize);
+        newBlock->size = blockSize;
+        newBlock->used = 0;
+        if (dedicated && block != NULL) {
+            newBlock->next = block->next;
+            block->next = newBlock;
+        } else {
+            newBlock->next = block;
+            arena->blocks = newBlock;
+        }
+        arena->nblocks++;
+        arena->bytesAllocated += blockSize;
+        block = newBlock;
+    }
+    ptr = (guint8 *) block->data + block->used;
+    block->used += aligned;
+    arena->nallocations++;
+    arena->bytesUsed += aligned;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+gpointer dif_arena_memdup(dif_arena_t *arena, gconstpointer data, gsize size) {
+    gpointer copy;
+    if (data == NULL) {
+        return NULL;
+    }
+    copy = dif_arena_malloc0(arena, size);
+    memcpy(copy, data, size);
+    return copy;
+}
+
+gchar *dif_arena_strdup(dif_arena_t *arena, const gchar *str) {
+    if (str == NULL) {
+        return NULL;
+    }
+    return dif_arena_memdup(arena, str, strlen(str) + 1);
+}
@@ -0,0 +1,305 @@
+#include <math.h>
+#include <stdlib.h>
+#include <glib.h>
+#include "dif.h"
+
+/* the serializer prints waypoint values with %0.2f */
+#define COMPACT_SCALE 100
+/* largest magnitude where every integer is still exact in a double */
+#define FIXED_MAX 4503599627370496.0
+
+/**
+ * round value * scale to an integer exactly the way printf("%.Nf") rounds
+ * value when scale is 10^N
+ *
+ * printf rounds the exact binary value of the double, with ties going to
+ * the even digit. value * scale in floating point can land on the wrong
+ * side of a half, so the residual is taken with fma, which computes
+ * value * scale - rounded without intermediate rounding. the rare exact
+ * or near tie is settled by printf itself.
+ *
+ * @return TRUE and sets *fixed, or FALSE if the value is not finite or too
+ *         large to be represented
+ */
+gboolean dif_fixed_from_double(gdouble value, guint scale, gint64 *fixed) {
+    gdouble scaled = value * scale;
+    gdouble rounded, residual;
+
+    if (!isfinite(scaled) || fabs(scaled) >= FIXED_MAX) {
+        return FALSE;
+    }
+    rounded = round(scaled);
+    residual = fma(value, (gdouble) scale, -rounded);
+    if (residual > 0.5) {
+        rounded += 1.0;
+    } else if (residual < -0.5) {
+        rounded -= 1.0;
+    } else if (residual == 0.5 || residual == -0.5) {
+        gchar buffer[64];
+        gchar digits[64];
+        guint ndecimals = 0;
+        guint divisor;
+        gchar *c;
+        guint len = 0;
+        for (divisor = scale; divisor > 1; divisor /= 10) {
+            ndecimals++;
+        }
+        g_snprintf(buffer, sizeof(buffer), "%.*f", ndecimals, value);
+        for (c = buffer; *c != '\0' && len < sizeof(digits) - 1; c++) {
+            if (*c == '-' || g_ascii_isdigit(*c)) {
+                digits[len++] = *c;
+            }
+        }
+        digits[len] = '\0';
+        *fixed = g_ascii_strtoll(digits, NULL, 10);
+        return TRUE;
+    }
+    *fixed = (gint64) rounded;
+    return TRUE;
+}
+
+/*
+ * each channel is encoded from the quantity the serializer prints, and the
+ * decoded double is checked to print the same digits again; a value that
+ * fails the check or does not fit the column stays an extra
+ */
+static gboolean _dif_compact_depth(gdouble depth, guint16 *encoded) {
+    gint64 fixed, check;
+    if (!dif_fixed_from_double(depth, COMPACT_SCALE, &fixed) || fixed < 0 || fixed >= DIF_COMPACT_NONE16) {
+        return FALSE;
+    }
+    if (!dif_fixed_from_double(fixed / (gdouble) COMPACT_SCALE, COMPACT_SCALE, &check) || check != fixed) {
+        return FALSE;
+    }
+    *encoded = fixed;
+    return TRUE;
+}
+
+static gdouble _dif_expand_temperature(guint16 encoded) {
+    return encoded / (gdouble) COMPACT_SCALE - 273.15;
+}
+
+static gboolean _dif_compact_temperature(gdouble temperature, guint16 *encoded) {
+    gint64 fixed, check;
+    if (!dif_fixed_from_double(CELSIUS_TO_KELVIN(temperature), COMPACT_SCALE, &fixed) ||
+        fixed < 0 || fixed >= DIF_COMPACT_NONE16) {
+        return FALSE;
+    }
+    if (!dif_fixed_from_double(CELSIUS_TO_KELVIN(_dif_expand_temperature(fixed)), COMPACT_SCALE, &check) ||
+        check != fixed) {
+        return FALSE;
+    }
+    *encoded = fixed;
+    return TRUE;
+}
+
+static gdouble _dif_expand_pressure(guint32 encoded) {
+    return encoded / (gdouble) BAR_TO_PASCAL(COMPACT_SCALE);
+}
+
+static gboolean _dif_compact_pressure(gdouble pressure, guint32 *encoded) {
+    gint64 fixed, check;
+    if (!dif_fixed_from_double(BAR_TO_PASCAL(pressure), COMPACT_SCALE, &fixed) ||
+        fixed < 0 || fixed >= DIF_COMPACT_NONE32) {
+        return FALSE;
+    }
+    if (!dif_fixed_from_double(BAR_TO_PASCAL(_dif_expand_pressure(fixed)), COMPACT_SCALE, &check) ||
+        check != fixed) {
+        return FALSE;
+    }
+    *encoded = fixed;
+    return TRUE;
+}
+
+/**
+ * given a dive, encode its samples into fixed-point columns
+ *
+ * the dive is sorted as a side effect and otherwise left untouched. only
+ * the first depth, temperature and pressure of a sample go into the
+ * columns, so dif_sample_get_subsample answers the same after unpacking.
+ * subsamples keep their order within a type but not across types, which
+ * the serializer does not depend on: the waypoint writer places children
+ * in the fixed schema order of their element type and only keeps the
+ * order of subsamples within one type (see _waypointChildren in uddf.c).
+ * vendor payloads that are views into the dive's source stay views, so the
+ * encoding must not outlive that source.
+ *
+ * @return a newly allocated encoding, free with dif_compact_samples_free
+ */
+dif_compact_samples_t *dif_dive_pack_samples(dif_dive_t *dive) {
+    dif_compact_samples_t *compact = g_new0(dif_compact_samples_t, 1);
+    GArray *extras = g_array_new(FALSE, FALSE, sizeof(dif_compact_extra_t));
+    guint row, n, i;
+
+    dive = dif_dive_sort_samples(dive);
+    n = dive->samples->len;
+    compact->nrows = n;
+    compact->arena = dif_arena_alloc();
+    compact->timestamp = dif_arena_malloc0(compact->arena, MAX(n, 1) * sizeof(guint32));
+    compact->depth = dif_arena_malloc0(compact->arena, MAX(n, 1) * sizeof(guint16));
+    compact->temperature = dif_arena_malloc0(compact->arena, MAX(n, 1) * sizeof(guint16));
+    compact->pressure = dif_arena_malloc0(compact->arena, MAX(n, 1) * sizeof(guint32));
+    compact->pressureTank = dif_arena_malloc0(compact->arena, MAX(n, 1) * sizeof(guint8));
+
+    for (row = 0; row < n; row++) {
+        dif_sample_t *sample = g_ptr_array_index(dive->samples, row);
+        compact->timestamp[row] = sample->timestamp;
+        compact->depth[row] = DIF_COMPACT_NONE16;
+        compact->temperature[row] = DIF_COMPACT_NONE16;
+        compact->pressure[row] = DIF_COMPACT_NONE32;
+        for (i = 0; i < sample->nsubsamples; i++) {
+            dif_subsample_t *ss = sample->subsamples[i];
+            gboolean first = sample->slot[ss->type] == i;
+            dif_compact_extra_t extra;
+
+            if (first && ss->type == DIF_SAMPLE_DEPTH &&
+                _dif_compact_depth(ss->value.depth, &compact->depth[row])) {
+                continue;
+            }
+            if (first && ss->type == DIF_SAMPLE_TEMPERATURE &&
+                _dif_compact_temperature(ss->value.temperature, &compact->temperature[row])) {
+                continue;
+            }
+            if (first && ss->type == DIF_SAMPLE_PRESSURE && ss->value.pressure.tank <= G_MAXUINT8 &&
+                _dif_compact_pressure(ss->value.pressure.value, &compact->pressure[row])) {
+                compact->pressureTank[row] = ss->value.pressure.tank;
+                continue;
+            }
+
+            extra.row = row;
+            extra.subsample = *ss;
+            extra.subsample.owner = DIF_OWNER_ARENA;
+            if (ss->type == DIF_SAMPLE_VENDOR &&
+                !dif_dive_source_contains(dive, ss->value.vendor.data, ss->value.vendor.size)) {
+                extra.subsample.value.vendor.data = dif_arena_memdup(compact->arena, ss->value.vendor.data,
+                                                                     ss->value.vendor.size);
+            } else if (ss->type == DIF_SAMPLE_SETMARKER) {
+                extra.subsample.value.setmarker = dif_arena_strdup(compact->arena, ss->value.setmarker);
+            }
+            g_array_append_val(extras, extra);
+        }
+    }
+    compact->nextras = extras->len;
+    compact->extras = dif_arena_memdup(compact->arena, extras->data,
+                                       MAX(extras->len, 1) * sizeof(dif_compact_extra_t));
+    g_array_free(extras, TRUE);
+    return compact;
+}
+
+/**
+ * append the samples of a compact encoding to a dive, allocated from the
+ * dive's arena
+ */
+dif_dive_t *dif_dive_unpack_samples(dif_dive_t *dive, const dif_compact_samples_t *compact) {
+    guint row;
+    guint e = 0;
+    for (row = 0; row < compact->nrows; row++) {
+        dif_sample_t *sample = dif_dive_alloc_sample(dive);
+        dif_subsample_t *ss;
+        sample->timestamp = compact->timestamp[row];
+        dive = dif_dive_add_sample(dive, sample);
+        if (compact->depth[row] != DIF_COMPACT_NONE16) {
+            ss = dif_dive_alloc_subsample(dive);
+            ss->type = DIF_SAMPLE_DEPTH;
+            ss->value.depth = compact->depth[row] / (gdouble) COMPACT_SCALE;
+            dif_sample_add_subsample(sample, ss);
+        }
+        if (compact->temperature[row] != DIF_COMPACT_NONE16) {
+            ss = dif_dive_alloc_subsample(dive);
+            ss->type = DIF_SAMPLE_TEMPERATURE;
+            ss->value.temperature = _dif_expand_temperature(compact->temperature[row]);
+            dif_sample_add_subsample(sample, ss);
+        }
+        if (compact->pressure[row] != DIF_COMPACT_NONE32) {
+            ss = dif_dive_alloc_subsample(dive);
+            ss->type = DIF_SAMPLE_PRESSURE;
+            ss->value.pressure.tank = compact->pressureTank[row];
+            ss->value.pressure.value = _dif_expand_pressure(compact->pressure[row]);
+            dif_sample_add_subsample(sample, ss);
+        }
+        for (; e < compact->nextras && compact->extras[e].row == row; e++) {
+            const dif_subsample_t *extra = &compact->extras[e].subsample;
+            ss = dif_dive_alloc_subsample(dive);
+            if (extra->type == DIF_SAMPLE_VENDOR) {
+                dif_dive_subsample_set_vendor(dive, ss, extra->value.vendor.type,
+                                              extra->value.vendor.size, extra->value.vendor.data);
+            } else if (extra->type == DIF_SAMPLE_SETMARKER) {
+                dif_dive_subsample_set_setmarker(dive, ss, extra->value.setmarker);
+            } else {
+                ss->type = extra->type;
+                ss->value = extra->value;
+            }
+            dif_sample_add_subsample(sample, ss);
+        }
+    }
+    return dive;
+}
+
+void dif_compact_samples_free(dif_compact_samples_t *compact) {
+    if (compact == NULL) {
+        return;
+    }
+    dif_arena_free(compact->arena);
+    g_free(compact);
+}
+
+/**
+ * switch a dive to the compact encoding, releasing its samples
+ *
+ * meant for large logbooks held in memory. while a dive is compact its
+ * samples array is empty, so call dif_dive_expand before working with the
+ * samples; the serializer does this on its own. the running statistics are
+ * taken from the samples before they are packed and kept, as the packed
+ * values are rounded and a summary of them would round a second time.
+ */
+dif_dive_t *dif_dive_compact(dif_dive_t *dive) {
+    dif_dive_stats_t *stats;
+    guint i;
+    g_return_val_if_fail(!dive->frozen, dive);
+    if (dive->compact != NULL) {
+        return dive;
+    }
+    stats = dif_dive_get_stats(dive);
+    dive->compact = dif_dive_pack_samples(dive);
+    dive->stats = NULL;
+    dif_dive_invalidate_caches(dive);
+    /* the sample it points at is about to go */
+    stats->lastSample = NULL;
+    dive->stats = stats;
+    if (dive->nHeapOwned > 0) {
+        for (i = 0; i < dive->samples->len; i++) {
+            dif_sample_free(g_ptr_array_index(dive->samples, i));
+        }
+    }
+    g_ptr_array_set_size(dive->samples, 0);
+    dif_arena_free(dive->arena);
+    dive->arena = dif_arena_alloc();
+    dive->nHeapOwned = 0;
+    dive->samplesSorted = TRUE;
+    return dive;
+}
+
+/**
+ * bring the samples of a compact dive back, see dif_dive_compact
+ */
+dif_dive_t *dif_dive_expand(dif_dive_t *dive) {
+    dif_compact_samples_t *compact = dive->compact;
+    dif_dive_stats_t *stats = dive->stats;
+    gboolean wasEmpty = dive->samples->len == 0;
+    if (compact == NULL) {
+        return dive;
+    }
+    dive->compact = NULL;
+    /* the statistics kept by dif_dive_compact stay as they are rather than
+     * folding in the rounded values */
+    dive->stats = NULL;
+    dive = dif_dive_unpack_samples(dive, compact);
+    dif_compact_samples_free(compact);
+    dif_dive_invalidate_stats(dive);
+    dive->stats = stats;
+    if (stats != NULL && wasEmpty && dive->samples->len > 0) {
+        /* the samples came back in order, so the last one can take more subsamples */
+        stats->lastSample = g_ptr_array_index(dive->samples, dive->samples->len - 1);
+    }
+    return dive;
+}
@@ -0,0 +1,116 @@
+#include <glib.h>
+#include "dif.h"
+
+/**
+ * given a collection, get its dives grouped by the day they started on
+ *
+ * the dives are sorted and cut into one bucket per local day, in ascending
+ * order; dives without a date are in no bucket and sort after the last
+ * one. the index is a cache owned by the collection, see
+ * dif_dive_collection_invalidate_days for when it goes stale.
+ *
+ * @return an array of dif_day_bucket_t, not to be freed by the caller
+ */
+const GArray *dif_dive_collection_get_days(dif_dive_collection_t *dc) {
+    guint i;
+    dc = dif_dive_collection_sort_dives(dc);
+    if (dc->days != NULL) {
+        return dc->days;
+    }
+    dc->days = g_array_new(FALSE, FALSE, sizeof(dif_day_bucket_t));
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_dive_t *dive = g_ptr_array_index(dc->dives, i);
+        dif_day_bucket_t bucket;
+        if (!dive->hasStartTime) {
+            break;
+        }
+        bucket.day = dif_dive_get_local_day(dive);
+        if (dc->days->len > 0 && g_array_index(dc->days, dif_day_bucket_t, dc->days->len - 1).day == bucket.day) {
+            g_array_index(dc->days, dif_day_bucket_t, dc->days->len - 1).n++;
+        } else {
+            bucket.first = i;
+            bucket.n = 1;
+            g_array_append_val(dc->days, bucket);
+        }
+    }
+    return dc->days;
+}
+
+/**
+ * drop the day index of a collection
+ *
+ * adding dives and sorting them into a new order does this on its own;
+ * code that changes the date of a dive already in the collection has to
+ * call it
+ */
+void dif_dive_collection_invalidate_days(dif_dive_collection_t *dc) {
+    if (dc->days != NULL) {
+        g_array_free(dc->days, TRUE);
+        dc->days = NULL;
+    }
+}
+
+/**
+ * first bucket whose day is at least day, or the number of buckets
+ */
+static guint _dif_days_lower_bound(const GArray *days, gint64 day) {
+    guint lo = 0, hi = days->len;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(days, dif_day_bucket_t, mid).day < day) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * index in the dives of the first dive of bucket i, or one past the last
+ * dated dive when i is past the last bucket
+ */
+static guint _dif_days_row(const GArray *days, guint i) {
+    const dif_day_bucket_t *last;
+    if (i < days->len) {
+        return g_array_index(days, dif_day_bucket_t, i).first;
+    }
+    if (days->len == 0) {
+        return 0;
+    }
+    last = &g_array_index(days, dif_day_bucket_t, days->len - 1);
+    return last->first + last->n;
+}
+
+/**
+ * given a collection, find the dives of a single day
+ *
+ * @param day: the local day, as dif_dive_get_local_day counts them
+ * @return the bucket of that day, or NULL if no dive started on it
+ */
+const dif_day_bucket_t *dif_dive_collection_find_day(dif_dive_collection_t *dc, gint64 day) {
+    const GArray *days = dif_dive_collection_get_days(dc);
+    guint i = _dif_days_lower_bound(days, day);
+    if (i < days->len && g_array_index(days, dif_day_bucket_t, i).day == day) {
+        return &g_array_index(days, dif_day_bucket_t, i);
+    }
+    return NULL;
+}
+
+/**
+ * given a collection, find the dives that started on a local day with
+ * fromDay <= day < toDay
+ *
+ * the dives are a run of the sorted collection, so only the two ends are
+ * looked up. pass G_MAXINT64 as toDay for every dive since fromDay.
+ *
+ * @param first: set to the index in dc->dives of the first such dive
+ * @return the number of such dives
+ */
+guint dif_dive_collection_dives_between(dif_dive_collection_t *dc, gint64 fromDay, gint64 toDay, guint *first) {
+    const GArray *days = dif_dive_collection_get_days(dc);
+    guint lo = _dif_days_lower_bound(days, fromDay);
+    guint hi = toDay > fromDay ? _dif_days_lower_bound(days, toDay) : lo;
+    *first = _dif_days_row(days, lo);
+    return _dif_days_row(days, hi) - *first;
+}
@@ -1,6 +1,9 @@
+#include <string.h>
 #include <glib.h>
 #include "dif.h"
 
+#define SECONDS_PER_DAY 86400
+
 /**
  * @brief Allocates memory for a new dive collection
  * 
@@ -11,34 +14,58 @@
 dif_dive_collection_t *dif_dive_collection_alloc() {
     dif_dive_collection_t *dc;
     dc = g_malloc(sizeof(dif_dive_collection_t));
-    dc->dives = NULL;
+    dc->dives = g_ptr_array_new_with_free_func((GDestroyNotify) dif_dive_unref);
+    dc->days = NULL;
     return dc;
 }
 
 /**
  * @brief Frees memory allocated for a dive collection
  * 
- * Releases all memory associated with a dive collection, including all dives
- * and their associated data structures.
+ * Releases all memory associated with a dive collection and drops its
+ * reference on every dive. Dives that were given a reference of their own
+ * with dif_dive_ref outlive the collection.
  * 
  * @param dc Pointer to the dive collection to free
  */
 void dif_dive_collection_free(dif_dive_collection_t *dc) {
-    g_list_free_full(dc->dives, (GDestroyNotify) dif_dive_free);
+    dif_dive_collection_invalidate_days(dc);
+    g_ptr_array_free(dc->dives, TRUE);
     g_free(dc);
 }
 
+/**
+ * add a dive to the collection, which takes over the caller's reference
+ */
 dif_dive_collection_t *dif_dive_collection_add_dive(dif_dive_collection_t *dc, dif_dive_t *dive) {
-    dc->dives = g_list_append(dc->dives, dive);
+    g_ptr_array_add(dc->dives, dive);
+    dif_dive_collection_invalidate_days(dc);
+    return dc;
+}
+
+/**
+ * sort the dives, fill in their surface intervals and freeze every one of
+ * them, see dif_dive_freeze
+ */
+dif_dive_collection_t *dif_dive_collection_freeze(dif_dive_collection_t *dc) {
+    guint i;
+    dc = dif_dive_collection_calculate_surface_interval(dc);
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_dive_freeze(g_ptr_array_index(dc->dives, i));
+    }
     return dc;
 }
 
 dif_dive_t *dif_dive_alloc() {
     dif_dive_t *dive;
     dive = g_malloc(sizeof(dif_dive_t));
-    dive->samples = NULL;
-    dive->gasmixes = NULL;
-    dive->datetime = NULL;
+    /* no free func: samples carved from the arena need no per-sample
+     * release, so dif_dive_free only walks them when nHeapOwned says so */
+    dive->samples = g_ptr_array_new();
+    dive->gasmixes = g_array_new(FALSE, FALSE, sizeof(guint));
+    dive->startTime = 0;
+    dive->utcOffset = 0;
+    dive->hasStartTime = FALSE;
     dive->duration = 0;
     dive->maxdepth = 0.0;
     dive->surfaceInterval = -1;
@@ -49,56 +76,397 @@ dif_dive_t *dif_dive_alloc() {
     dive->hasTankPressures = FALSE;
     dive->minTemperature = 0.0;
     dive->hasMinTemperature = FALSE;
+    dive->profile = NULL;
+    dive->arena = dif_arena_alloc();
+    dive->nHeapOwned = 0;
+    dive->sampleIndex = NULL;
+    dive->samplesSorted = TRUE;
+    dive->stats = dif_dive_stats_alloc();
+    dive->compact = NULL;
+    dive->source = NULL;
+    dive->refcount = 1;
+    dive->frozen = FALSE;
     dive = dif_dive_set_datetime(dive, 2000,01,01,12,00,00);
     return dive;
 }
 
-void dif_dive_free(dif_dive_t *dive) {
-    g_list_free_full(dive->samples, (GDestroyNotify) dif_sample_free);
-    g_list_free_full(dive->gasmixes, (GDestroyNotify) dif_gasmix_free);
-    if (dive->datetime != NULL) {
-        g_date_time_unref(dive->datetime);
+/**
+ * release a dive and everything it owns
+ *
+ * when every sample came from dif_dive_alloc_sample this does not touch the
+ * samples at all: releasing the arena blocks releases them
+ */
+static void _dif_dive_destroy(dif_dive_t *dive) {
+    guint i;
+    dive->frozen = FALSE;
+    dif_dive_invalidate_caches(dive);
+    if (dive->nHeapOwned > 0) {
+        for (i = 0; i < dive->samples->len; i++) {
+            dif_sample_free(g_ptr_array_index(dive->samples, i));
+        }
+    }
+    g_ptr_array_free(dive->samples, TRUE);
+    dif_arena_free(dive->arena);
+    dif_compact_samples_free(dive->compact);
+    g_array_free(dive->gasmixes, TRUE);
+    if (dive->source != NULL) {
+        g_bytes_unref(dive->source);
     }
     g_free(dive);
 }
 
+/**
+ * take a reference on a dive
+ *
+ * a dive starts out with one reference, held by whoever allocated it or
+ * handed to the collection it was added to. references may be taken and
+ * dropped from any thread.
+ */
+dif_dive_t *dif_dive_ref(dif_dive_t *dive) {
+    g_return_val_if_fail(dive != NULL, NULL);
+    g_atomic_int_inc(&dive->refcount);
+    return dive;
+}
+
+/**
+ * drop a reference on a dive, freeing it with the last one
+ */
+void dif_dive_unref(dif_dive_t *dive) {
+    g_return_if_fail(dive != NULL);
+    if (g_atomic_int_dec_and_test(&dive->refcount)) {
+        _dif_dive_destroy(dive);
+    }
+}
+
+/**
+ * free a dive; the same as dif_dive_unref, so a dive that was given to
+ * other owners with dif_dive_ref lives on until they are done with it
+ */
+void dif_dive_free(dif_dive_t *dive) {
+    dif_dive_unref(dive);
+}
+
+/**
+ * make a dive read-only so it can be shared
+ *
+ * the dive is expanded if it was compacted and its samples are sorted,
+ * then the profile, the timestamp index and the statistics are all built,
+ * so none of the getters, dif_dive_find_sample or the serializer write to
+ * it any more. a frozen dive can then be read by several threads at once.
+ * everything that would change it refuses with a critical warning,
+ * and freezing cannot be undone.
+ */
+dif_dive_t *dif_dive_freeze(dif_dive_t *dive) {
+    if (dive->frozen) {
+        return dive;
+    }
+    dive = dif_dive_expand(dive);
+    dive = dif_dive_sort_samples(dive);
+    dif_dive_summary_free(dif_dive_compute_summary(dive));
+    dif_dive_get_profile(dive);
+    dif_dive_find_sample(dive, 0);
+    dive->frozen = TRUE;
+    return dive;
+}
+
+gboolean dif_dive_is_frozen(const dif_dive_t *dive) {
+    return dive->frozen;
+}
+
+/**
+ * append a sample to the dive, which takes ownership of it
+ *
+ * samples live in a growable pointer array so appending is amortized O(1)
+ * and the getters can index samples directly. the sample is either a heap
+ * sample from dif_sample_alloc or one allocated from this dive's arena.
+ *
+ * the timestamp must be set before the sample is added. appending in
+ * timestamp order keeps the dive sorted, so later sorts are free.
+ */
 dif_dive_t *dif_dive_add_sample(dif_dive_t *dive, dif_sample_t *sample) {
-    dive->samples = g_list_append(dive->samples, sample);
+    guint i;
+    g_return_val_if_fail(!dive->frozen, dive);
+    g_return_val_if_fail(sample->dive == NULL, dive);
+    g_return_val_if_fail(sample->owner == DIF_OWNER_HEAP || sample->arena == dive->arena, dive);
+    if (sample->owner == DIF_OWNER_HEAP) {
+        dive->nHeapOwned++;
+    } else {
+        for (i = 0; i < sample->nsubsamples; i++) {
+            if (sample->subsamples[i]->owner == DIF_OWNER_HEAP) {
+                dive->nHeapOwned++;
+            }
+        }
+    }
+    if (dive->samplesSorted && dive->samples->len > 0) {
+        dif_sample_t *last = g_ptr_array_index(dive->samples, dive->samples->len - 1);
+        if (last->timestamp > sample->timestamp) {
+            dive->samplesSorted = FALSE;
+        }
+    }
+    g_ptr_array_add(dive->samples, sample);
+    sample->dive = dive;
+    dif_dive_stats_sample_added(dive, sample);
+    if (dive->sampleIndex != NULL &&
+        !g_hash_table_contains(dive->sampleIndex, GUINT_TO_POINTER(sample->timestamp))) {
+        g_hash_table_insert(dive->sampleIndex, GUINT_TO_POINTER(sample->timestamp), sample);
+    }
+    dif_dive_invalidate_profile(dive);
+    return dive;
+}
+
+/* the channels of a sample record in the order they are attached */
+static const dif_sample_type_t _recordChannels[] = {
+    DIF_SAMPLE_DEPTH, DIF_SAMPLE_PRESSURE, DIF_SAMPLE_TEMPERATURE,
+    DIF_SAMPLE_RBT, DIF_SAMPLE_HEARTBEAT, DIF_SAMPLE_BEARING
+};
+
+static void _dif_record_set_value(dif_subsample_t *ss, const dif_sample_record_t *record) {
+    switch (ss->type) {
+    case DIF_SAMPLE_DEPTH:
+        ss->value.depth = record->depth;
+        break;
+    case DIF_SAMPLE_PRESSURE:
+        ss->value.pressure.tank = record->pressureTank;
+        ss->value.pressure.value = record->pressure;
+        break;
+    case DIF_SAMPLE_TEMPERATURE:
+        ss->value.temperature = record->temperature;
+        break;
+    case DIF_SAMPLE_RBT:
+        ss->value.rbt = record->rbt;
+        break;
+    case DIF_SAMPLE_HEARTBEAT:
+        ss->value.heartbeat = record->heartbeat;
+        break;
+    case DIF_SAMPLE_BEARING:
+        ss->value.bearing = record->bearing;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * append a packed array of sample records to the dive in one call
+ *
+ * the samples, their subsamples and the subsample arrays each come from a
+ * single allocation in the dive's arena, and the samples array grows once.
+ * the result is the same as adding the records one by one with
+ * dif_dive_alloc_sample and dif_dive_add_sample: statistics, the timestamp
+ * index and the sort state are kept up to date. bits in present outside
+ * DIF_SAMPLE_RECORD_CHANNELS are ignored.
+ */
+dif_dive_t *dif_dive_append_samples(dif_dive_t *dive, const dif_sample_record_t *records, gsize n) {
+    dif_sample_t *samples;
+    dif_subsample_t *subsamples;
+    dif_subsample_t **slots;
+    gsize i, nsubsamples = 0;
+    guint c, first;
+
+    g_return_val_if_fail(!dive->frozen, dive);
+    g_return_val_if_fail(n <= G_MAXUINT - dive->samples->len, dive);
+    if (n == 0) {
+        return dive;
+    }
+    for (i = 0; i < n; i++) {
+        for (c = 0; c < G_N_ELEMENTS(_recordChannels); c++) {
+            nsubsamples += (records[i].present >> _recordChannels[c]) & 1;
+        }
+    }
+
+    samples = dif_arena_malloc0(dive->arena, n * sizeof(dif_sample_t));
+    subsamples = dif_arena_malloc0(dive->arena, nsubsamples * sizeof(dif_subsample_t));
+    slots = dif_arena_malloc0(dive->arena, nsubsamples * sizeof(dif_subsample_t *));
+    first = dive->samples->len;
+    g_ptr_array_set_size(dive->samples, first + n);
+
+    for (i = 0; i < n; i++) {
+        const dif_sample_record_t *record = &records[i];
+        dif_sample_t *sample = &samples[i];
+        sample->timestamp = record->timestamp;
+        sample->owner = DIF_OWNER_ARENA;
+        sample->arena = dive->arena;
+        sample->subsamples = slots;
+        for (c = 0; c < G_N_ELEMENTS(_recordChannels); c++) {
+            dif_sample_type_t type = _recordChannels[c];
+            if ((record->present >> type) & 1) {
+                subsamples->type = type;
+                subsamples->owner = DIF_OWNER_ARENA;
+                _dif_record_set_value(subsamples, record);
+                sample->present |= 1u << type;
+                sample->slot[type] = sample->nsubsamples;
+                sample->subsamples[sample->nsubsamples++] = subsamples++;
+            }
+        }
+        sample->subsampleCapacity = sample->nsubsamples;
+        slots += sample->nsubsamples;
+
+        if (dive->samplesSorted && first + i > 0) {
+            dif_sample_t *last = g_ptr_array_index(dive->samples, first + i - 1);
+            if (last->timestamp > sample->timestamp) {
+                dive->samplesSorted = FALSE;
+            }
+        }
+        g_ptr_array_index(dive->samples, first + i) = sample;
+        sample->dive = dive;
+        dif_dive_stats_sample_added(dive, sample);
+        if (dive->sampleIndex != NULL &&
+            !g_hash_table_contains(dive->sampleIndex, GUINT_TO_POINTER(sample->timestamp))) {
+            g_hash_table_insert(dive->sampleIndex, GUINT_TO_POINTER(sample->timestamp), sample);
+        }
+    }
+    dif_dive_invalidate_profile(dive);
     return dive;
 }
 
+/**
+ * add a gas mix to the dive, which takes ownership of gasmix
+ *
+ * the mix is interned in the gas table and the dive keeps only its id, so
+ * gasmix is freed here
+ */
 dif_dive_t *dif_dive_add_gasmix(dif_dive_t *dive, dif_gasmix_t *gasmix) {
-    dive->gasmixes = g_list_append(dive->gasmixes, gasmix);
+    guint id;
+    g_return_val_if_fail(!dive->frozen, dive);
+    id = dif_gas_intern(gasmix);
+    g_array_append_val(dive->gasmixes, id);
+    dif_gasmix_free(gasmix);
     return dive;
 }
 
+/**
+ * days between 1970-01-01 and a date in the proleptic Gregorian calendar
+ */
+gint64 dif_days_from_civil(gint64 year, guint month, guint day) {
+    gint64 era, yoe, doy, doe;
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/**
+ * the local timezone is looked up once; dives only keep its offset
+ */
+static GTimeZone *_dif_local_timezone() {
+    static gsize localZone = 0;
+    if (g_once_init_enter(&localZone)) {
+        g_once_init_leave(&localZone, (gsize) g_time_zone_new_local());
+    }
+    return (GTimeZone *) localZone;
+}
+
+/**
+ * whether a wall clock time is one GDateTime can hold, the dive computer
+ * reports all zeroes when it has no date
+ */
+static gboolean _dif_valid_datetime(guint year, guint month, guint day, guint hour, guint minute, guint second) {
+    return year >= 1 && year <= 9999 && day >= 1 && day <= 31 &&
+           g_date_valid_dmy(day, month, year) && hour < 24 && minute < 60 && second < 60;
+}
+
+/**
+ * set the start of a dive from its local wall clock time and the offset of
+ * that time from UTC in seconds. an invalid time leaves the dive undated
+ */
+dif_dive_t *dif_dive_set_datetime_offset(dif_dive_t *dive, guint year, guint month, guint day, guint hour, guint minute, guint second, gint32 utcOffset) {
+    gint64 local = dif_days_from_civil(year, month, day) * SECONDS_PER_DAY + hour * 3600 + minute * 60 + second;
+    g_return_val_if_fail(!dive->frozen, dive);
+    if (!_dif_valid_datetime(year, month, day, hour, minute, second)) {
+        dive->hasStartTime = FALSE;
+        return dive;
+    }
+    dive->startTime = local - utcOffset;
+    dive->utcOffset = utcOffset;
+    dive->hasStartTime = TRUE;
+    return dive;
+}
+
+/**
+ * set the start of a dive from a wall clock time in the local timezone of
+ * the machine, like g_date_time_new_local would. an invalid time leaves the
+ * dive undated
+ */
 dif_dive_t *dif_dive_set_datetime(dif_dive_t *dive, guint year, guint month, guint day, guint hour, guint minute, guint second) {
-    dive->datetime = g_date_time_new_local(year, month, day, hour, minute, second);
+    GTimeZone *tz = _dif_local_timezone();
+    gint64 local = dif_days_from_civil(year, month, day) * SECONDS_PER_DAY + hour * 3600 + minute * 60 + second;
+    g_return_val_if_fail(!dive->frozen, dive);
+    if (!_dif_valid_datetime(year, month, day, hour, minute, second)) {
+        dive->hasStartTime = FALSE;
+        return dive;
+    }
+    /* a wall clock time inside a daylight saving gap is moved forward */
+    gint interval = g_time_zone_adjust_time(tz, G_TIME_TYPE_STANDARD, &local);
+    gint32 utcOffset = g_time_zone_get_offset(tz, interval);
+    dive->startTime = local - utcOffset;
+    dive->utcOffset = utcOffset;
+    dive->hasStartTime = TRUE;
     return dive;
 }
 
 dif_dive_t *dif_dive_set_datetime_utc(dif_dive_t *dive, guint year, guint month, guint day, guint hour, guint minute, guint second) {
-    dive->datetime = g_date_time_new_utc(year, month, day, hour, minute, second);
-    return dive;
+    return dif_dive_set_datetime_offset(dive, year, month, day, hour, minute, second, 0);
+}
+
+/**
+ * given a dive, get its start as a GDateTime in the dive's own offset
+ *
+ * meant for formatting; sorting and grouping should use startTime and
+ * dif_dive_get_local_day, which do not allocate
+ *
+ * @return a new GDateTime to be released with g_date_time_unref, or NULL
+ *         if the dive has no date or it is outside what GDateTime holds
+ */
+GDateTime *dif_dive_get_datetime(const dif_dive_t *dive) {
+    GDateTime *utc, *dt;
+    GTimeZone *tz;
+    if (!dive->hasStartTime) {
+        return NULL;
+    }
+    utc = g_date_time_new_from_unix_utc(dive->startTime);
+    if (utc == NULL) {
+        return NULL;
+    }
+    tz = g_time_zone_new_offset(dive->utcOffset);
+    dt = g_date_time_to_timezone(utc, tz);
+    g_time_zone_unref(tz);
+    g_date_time_unref(utc);
+    return dt;
+}
+
+/**
+ * given a dive, get the day it started on in its local time, counted in
+ * days since 1970-01-01. dives on the same day share a repetition group
+ */
+gint64 dif_dive_get_local_day(const dif_dive_t *dive) {
+    gint64 local = dive->startTime + dive->utcOffset;
+    /* round towards negative infinity for dates before 1970 */
+    return local >= 0 ? local / SECONDS_PER_DAY : -((-local + SECONDS_PER_DAY - 1) / SECONDS_PER_DAY);
 }
 
 dif_dive_t *dif_dive_set_duration(dif_dive_t *dive, guint duration) {
+    g_return_val_if_fail(!dive->frozen, dive);
     dive->duration = duration;
     return dive;
 }
 
 dif_dive_t *dif_dive_set_maxdepth(dif_dive_t *dive, gdouble maxdepth) {
+    g_return_val_if_fail(!dive->frozen, dive);
     dive->maxdepth = maxdepth;
     return dive;
 }
 
 dif_dive_t *dif_dive_set_avgdepth(dif_dive_t *dive, gdouble avgdepth) {
+    g_return_val_if_fail(!dive->frozen, dive);
     dive->avgdepth = avgdepth;
     dive->hasAvgdepth = TRUE;
     return dive;
 }
 
 dif_dive_t *dif_dive_set_tank_pressures(dif_dive_t *dive, gdouble beginPressure, gdouble endPressure) {
+    g_return_val_if_fail(!dive->frozen, dive);
     dive->beginPressure = beginPressure;
     dive->endPressure = endPressure;
     dive->hasTankPressures = TRUE;
@@ -106,6 +474,7 @@ dif_dive_t *dif_dive_set_tank_pressures(dif_dive_t *dive, gdouble beginPressure,
 }
 
 dif_dive_t *dif_dive_set_min_temperature(dif_dive_t *dive, gdouble minTemperature) {
+    g_return_val_if_fail(!dive->frozen, dive);
     dive->minTemperature = minTemperature;
     dive->hasMinTemperature = TRUE;
     return dive;
@@ -113,18 +482,68 @@ dif_dive_t *dif_dive_set_min_temperature(dif_dive_t *dive, gdouble minTemperatur
 
 dif_sample_t *dif_sample_alloc() {
     dif_sample_t *sample;
-    sample = g_malloc(sizeof(dif_sample_t));
-    sample->subsamples = NULL;
+    sample = g_malloc0(sizeof(dif_sample_t));
+    sample->owner = DIF_OWNER_HEAP;
     return sample;
 }
 
+/**
+ * free a sample and the heap subsamples attached to it
+ *
+ * for an arena sample only the heap subsamples are released; the sample
+ * itself goes away with its dive
+ */
 void dif_sample_free(dif_sample_t *sample) {
-    g_list_free_full(sample->subsamples, (GDestroyNotify) dif_subsample_free);
-    g_free(sample);
+    guint i;
+    for (i = 0; i < sample->nsubsamples; i++) {
+        dif_subsample_free(sample->subsamples[i]);
+    }
+    if (sample->owner == DIF_OWNER_HEAP) {
+        g_free(sample->subsamples);
+        g_free(sample);
+    }
 }
 
+/**
+ * attach a subsample to a sample, which takes ownership of it
+ *
+ * the first subsample of each type gets a direct slot so lookups by type
+ * are constant time. later subsamples of the same type (alarms, extra tank
+ * pressures) are only reachable through the subsamples array. the type must
+ * be set before the subsample is attached.
+ */
 dif_sample_t *dif_sample_add_subsample(dif_sample_t *sample, dif_subsample_t *subsample) {
-    sample->subsamples = g_list_append(sample->subsamples, subsample);
+    g_return_val_if_fail(subsample->type < DIF_SAMPLE_TYPE_COUNT, sample);
+    g_return_val_if_fail(sample->nsubsamples < G_MAXUINT16, sample);
+    g_return_val_if_fail(sample->dive == NULL || !sample->dive->frozen, sample);
+    if (sample->nsubsamples == sample->subsampleCapacity) {
+        guint capacity = MAX(sample->subsampleCapacity * 2, 4);
+        if (sample->owner == DIF_OWNER_ARENA) {
+            /* the old array stays in the arena; samples rarely outgrow
+             * the first four slots */
+            dif_subsample_t **subsamples = dif_arena_malloc0(sample->arena,
+                                                             capacity * sizeof(dif_subsample_t *));
+            if (sample->nsubsamples > 0) {
+                memcpy(subsamples, sample->subsamples, sample->nsubsamples * sizeof(dif_subsample_t *));
+            }
+            sample->subsamples = subsamples;
+        } else {
+            sample->subsamples = g_renew(dif_subsample_t *, sample->subsamples, capacity);
+        }
+        sample->subsampleCapacity = capacity;
+    }
+    if (!DIF_SAMPLE_HAS(sample, subsample->type)) {
+        sample->present |= 1u << subsample->type;
+        sample->slot[subsample->type] = sample->nsubsamples;
+    }
+    sample->subsamples[sample->nsubsamples++] = subsample;
+    if (sample->dive != NULL) {
+        if (sample->owner == DIF_OWNER_ARENA && subsample->owner == DIF_OWNER_HEAP) {
+            sample->dive->nHeapOwned++;
+        }
+        dif_dive_invalidate_profile(sample->dive);
+        dif_dive_stats_subsample_added(sample->dive, sample, subsample);
+    }
     return sample;
 }
 
@@ -132,10 +551,116 @@ dif_subsample_t *dif_subsample_alloc() {
     dif_subsample_t *subsample;
     subsample = g_malloc0(sizeof(dif_subsample_t));
     subsample->type = DIF_SAMPLE_UNDEFINED;
+    subsample->owner = DIF_OWNER_HEAP;
+    return subsample;
+}
+
+/**
+ * allocate a sample from the dive's arena
+ *
+ * the sample still has to be added with dif_dive_add_sample, and only to
+ * this dive. it must not be passed to dif_sample_free on its own.
+ */
+dif_sample_t *dif_dive_alloc_sample(dif_dive_t *dive) {
+    dif_sample_t *sample;
+    g_return_val_if_fail(!dive->frozen, NULL);
+    sample = dif_arena_malloc0(dive->arena, sizeof(dif_sample_t));
+    sample->owner = DIF_OWNER_ARENA;
+    sample->arena = dive->arena;
+    return sample;
+}
+
+/**
+ * allocate a subsample from the dive's arena
+ *
+ * payloads for arena subsamples have to come from the same arena, so use
+ * dif_dive_subsample_set_vendor and dif_dive_subsample_set_setmarker
+ */
+dif_subsample_t *dif_dive_alloc_subsample(dif_dive_t *dive) {
+    dif_subsample_t *subsample;
+    g_return_val_if_fail(!dive->frozen, NULL);
+    subsample = dif_arena_malloc0(dive->arena, sizeof(dif_subsample_t));
+    subsample->type = DIF_SAMPLE_UNDEFINED;
+    subsample->owner = DIF_OWNER_ARENA;
+    return subsample;
+}
+
+/**
+ * keep a reference on the buffer the dive was parsed from
+ *
+ * when the whole dump is already in memory, as it is in replay, vendor
+ * payloads that lie inside source are stored as views into it instead of
+ * copies. the dive holds its own reference, so the caller may drop theirs.
+ */
+dif_dive_t *dif_dive_set_source(dif_dive_t *dive, GBytes *source) {
+    g_return_val_if_fail(!dive->frozen, dive);
+    if (source != NULL) {
+        g_bytes_ref(source);
+    }
+    if (dive->source != NULL) {
+        g_bytes_unref(dive->source);
+    }
+    dive->source = source;
+    return dive;
+}
+
+/**
+ * @return TRUE when the size bytes at data lie inside the dive's source
+ */
+gboolean dif_dive_source_contains(const dif_dive_t *dive, gconstpointer data, gsize size) {
+    const guint8 *start, *p = data;
+    gsize length;
+    if (dive->source == NULL || data == NULL) {
+        return FALSE;
+    }
+    start = g_bytes_get_data(dive->source, &length);
+    return p >= start && p <= start + length && size <= (gsize) (start + length - p);
+}
+
+/**
+ * store a vendor payload on a subsample
+ *
+ * arena subsamples point straight into the dive's source when the payload
+ * lies there and otherwise copy it into the dive's arena
+ */
+dif_subsample_t *dif_dive_subsample_set_vendor(dif_dive_t *dive, dif_subsample_t *subsample, guint type, guint size, gconstpointer data) {
+    if (subsample->owner == DIF_OWNER_HEAP) {
+        return dif_subsample_set_vendor(subsample, type, size, data);
+    }
+    subsample->type = DIF_SAMPLE_VENDOR;
+    subsample->value.vendor.type = type;
+    if (size > 0 && data != NULL) {
+        subsample->value.vendor.size = size;
+        if (dif_dive_source_contains(dive, data, size)) {
+            subsample->value.vendor.data = (gpointer) data;
+        } else {
+            subsample->value.vendor.data = dif_arena_memdup(dive->arena, data, size);
+        }
+    } else {
+        subsample->value.vendor.size = 0;
+        subsample->value.vendor.data = NULL;
+    }
     return subsample;
 }
 
+dif_subsample_t *dif_dive_subsample_set_setmarker(dif_dive_t *dive, dif_subsample_t *subsample, const gchar *setmarker) {
+    subsample->type = DIF_SAMPLE_SETMARKER;
+    if (subsample->owner == DIF_OWNER_HEAP) {
+        subsample->value.setmarker = g_strdup(setmarker);
+    } else {
+        subsample->value.setmarker = dif_arena_strdup(dive->arena, setmarker);
+    }
+    return subsample;
+}
+
+/**
+ * free a heap subsample and its payload; arena subsamples are left alone
+ * since they go away with their dive
+ */
 void dif_subsample_free(dif_subsample_t *subsample) {
+    if (subsample->owner == DIF_OWNER_ARENA) {
+        return;
+    }
     switch (subsample->type) {
     case DIF_SAMPLE_VENDOR:
         g_free(subsample->value.vendor.data);
@@ -155,8 +680,10 @@ void dif_subsample_free(dif_subsample_t *subsample) {
  * libdivecomputer's sample callback passes a pointer into the transient
  * dive-record buffer, which is gone by serialization time, so the bytes
  * must be copied here. The copy is released by dif_subsample_free.
+ * Arena subsamples take their copy from dif_dive_subsample_set_vendor.
  */
 dif_subsample_t *dif_subsample_set_vendor(dif_subsample_t *subsample, guint type, guint size, gconstpointer data) {
+    g_return_val_if_fail(subsample->owner == DIF_OWNER_HEAP, subsample);
     subsample->type = DIF_SAMPLE_VENDOR;
     subsample->value.vendor.type = type;
     if (size > 0 && data != NULL) {
@@ -230,17 +757,55 @@ gboolean dif_sample_event_to_alarm(dif_sample_event_t event, dif_alarm_type_t *a
 /**
  * find the sample at an exact timestamp
  *
+ * the first lookup indexes the samples by timestamp; the index is kept up
+ * to date by dif_dive_add_sample, so later lookups are a hash probe. when
+ * several samples share a timestamp the first one added is returned.
+ *
  * @return the sample, or NULL if the dive has no sample at that timestamp
  */
 dif_sample_t *dif_dive_find_sample(dif_dive_t *dive, guint timestamp) {
-    GList *it;
-    for (it = g_list_first(dive->samples); it != NULL; it = g_list_next(it)) {
-        dif_sample_t *sample = it->data;
-        if (sample->timestamp == timestamp) {
-            return sample;
+    if (dive->sampleIndex == NULL) {
+        guint i;
+        dive->sampleIndex = g_hash_table_new(g_direct_hash, g_direct_equal);
+        for (i = 0; i < dive->samples->len; i++) {
+            dif_sample_t *sample = g_ptr_array_index(dive->samples, i);
+            if (!g_hash_table_contains(dive->sampleIndex, GUINT_TO_POINTER(sample->timestamp))) {
+                g_hash_table_insert(dive->sampleIndex, GUINT_TO_POINTER(sample->timestamp), sample);
+            }
         }
     }
-    return NULL;
+    return g_hash_table_lookup(dive->sampleIndex, GUINT_TO_POINTER(timestamp));
+}
+
+/**
+ * drop everything a dive derives from its samples: the profile, the
+ * timestamp index and the running statistics. call this after removing
+ * samples or editing subsample values in place
+ */
+void dif_dive_invalidate_caches(dif_dive_t *dive) {
+    g_return_if_fail(!dive->frozen);
+    dif_dive_invalidate_profile(dive);
+    dif_dive_invalidate_index(dive);
+    dif_dive_invalidate_stats(dive);
+}
+
+/**
+ * drop the timestamp index of a dive; needed after samples are removed
+ */
+void dif_dive_invalidate_index(dif_dive_t *dive) {
+    if (dive->sampleIndex != NULL) {
+        g_hash_table_destroy(dive->sampleIndex);
+        dive->sampleIndex = NULL;
+    }
+}
+
+static void _dif_sample_add_alarm(dif_dive_t *dive, dif_sample_t *sample, dif_alarm_type_t type, gdouble level, gboolean hasLevel) {
+    dif_subsample_t *subsample = dif_dive_alloc_subsample(dive);
+    subsample->type = DIF_SAMPLE_ALARM;
+    subsample->value.alarm.type = type;
+    subsample->value.alarm.level = level;
+    subsample->value.alarm.hasLevel = hasLevel;
+    dif_sample_add_subsample(sample, subsample);
 }
 
 /**
@@ -251,19 +816,66 @@ dif_sample_t *dif_dive_find_sample(dif_dive_t *dive, guint timestamp) {
  * order should re-run dif_dive_sort_samples, as the serializer does).
  */
 dif_dive_t *dif_dive_add_alarm(dif_dive_t *dive, guint timestamp, dif_alarm_type_t type, gdouble level, gboolean hasLevel) {
-    dif_sample_t *sample = dif_dive_find_sample(dive, timestamp);
-    dif_subsample_t *subsample;
+    dif_sample_t *sample;
+    g_return_val_if_fail(!dive->frozen, dive);
+    sample = dif_dive_find_sample(dive, timestamp);
     if (sample == NULL) {
-        sample = dif_sample_alloc();
+        sample = dif_dive_alloc_sample(dive);
         sample->timestamp = timestamp;
         dive = dif_dive_add_sample(dive, sample);
     }
-    subsample = dif_subsample_alloc();
-    subsample->type = DIF_SAMPLE_ALARM;
-    subsample->value.alarm.type = type;
-    subsample->value.alarm.level = level;
-    subsample->value.alarm.hasLevel = hasLevel;
-    dif_sample_add_subsample(sample, subsample);
+    _dif_sample_add_alarm(dive, sample, type, level, hasLevel);
+    return dive;
+}
+
+/**
+ * attach a batch of alarms, ordered by timestamp, to a dive
+ *
+ * the samples are sorted once and the alarms are merge-joined into them in
+ * a single pass, so the cost is linear in samples plus alarms. alarms at a
+ * timestamp without a sample get a new one, and the dive is left sorted.
+ * an alarm before the latest timestamp joined so far falls back to
+ * dif_dive_add_alarm.
+ */
+dif_dive_t *dif_dive_add_alarms(dif_dive_t *dive, const dif_alarm_t *alarms, guint nalarms) {
+    guint i;
+    guint row = 0;
+    guint nsamples;
+    guint joined = 0;
+    dif_sample_t *created = NULL;
+
+    g_return_val_if_fail(!dive->frozen, dive);
+    dive = dif_dive_sort_samples(dive);
+    nsamples = dive->samples->len;
+    for (i = 0; i < nalarms; i++) {
+        const dif_alarm_t *alarm = &alarms[i];
+        dif_sample_t *sample = NULL;
+        if (alarm->timestamp < joined) {
+            dive = dif_dive_add_alarm(dive, alarm->timestamp, alarm->type, alarm->level, alarm->hasLevel);
+            continue;
+        }
+        joined = alarm->timestamp;
+        while (row < nsamples &&
+               ((dif_sample_t *) g_ptr_array_index(dive->samples, row))->timestamp < alarm->timestamp) {
+            row++;
+        }
+        if (row < nsamples &&
+            ((dif_sample_t *) g_ptr_array_index(dive->samples, row))->timestamp == alarm->timestamp) {
+            sample = g_ptr_array_index(dive->samples, row);
+        } else if (created != NULL && created->timestamp == alarm->timestamp) {
+            sample = created;
+        } else {
+            /* appended past nsamples, so the join never visits it */
+            sample = dif_dive_alloc_sample(dive);
+            sample->timestamp = alarm->timestamp;
+            dive = dif_dive_add_sample(dive, sample);
+            created = sample;
+        }
+        _dif_sample_add_alarm(dive, sample, alarm->type, alarm->level, alarm->hasLevel);
+    }
+    if (dive->samples->len > nsamples) {
+        dive = dif_dive_sort_samples(dive);
+    }
     return dive;
 }
 
@@ -281,6 +893,8 @@ dif_gasmix_t *dif_gasmix_alloc() {
     gasmix->argon = 0.0;
     gasmix->hydrogen = 0.0;
     gasmix->type = DIF_GASMIX_UNDEFINED;
+    gasmix->id = 0;
+    gasmix->name = NULL;
     return gasmix;
 }
 
@@ -288,113 +902,6 @@ void dif_gasmix_free(dif_gasmix_t *gasmix) {
     g_free(gasmix);
 }
 
-/**
- * checks to see if a given gasmix is the composition specified
- *
- * this is generally used as a helper function for dif_gasmix_type, which is
- * why it is not a public method
- */
-gboolean _dif_is_gasmix(dif_gasmix_t *gasmix, gdouble o2, gdouble n2, gdouble he, gdouble ar, gdouble h2) {
-    if (ABS(gasmix->oxygen - o2) < GAS_EPSILON &&
-        ABS(gasmix->nitrogen - n2) < GAS_EPSILON &&
-        ABS(gasmix->helium - he) < GAS_EPSILON &&
-        ABS(gasmix->argon - ar) < GAS_EPSILON &&
-        ABS(gasmix->hydrogen - h2) < GAS_EPSILON) {
-        return TRUE;
-    }
-    return FALSE;
-}
-
-/**
- * given a gasmix, return the type of the gasmix
- */
-dif_gasmix_type_t dif_gasmix_type(dif_gasmix_t *gasmix) {
-    if (_dif_is_gasmix(gasmix, 21.0, 79.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_AIR;
-    } else if (_dif_is_gasmix(gasmix, 30.0, 70.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX30;
-    } else if (_dif_is_gasmix(gasmix, 31.0, 69.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX31;
-    } else if (_dif_is_gasmix(gasmix, 32.0, 68.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX32;
-    } else if (_dif_is_gasmix(gasmix, 33.0, 67.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX33;
-    } else if (_dif_is_gasmix(gasmix, 34.0, 66.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX34;
-    } else if (_dif_is_gasmix(gasmix, 35.0, 65.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX35;
-    } else if (_dif_is_gasmix(gasmix, 36.0, 64.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX36;
-    } else if (_dif_is_gasmix(gasmix, 37.0, 63.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX37;
-    } else if (_dif_is_gasmix(gasmix, 38.0, 62.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX38;
-    } else if (_dif_is_gasmix(gasmix, 39.0, 61.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX39;
-    } else if (_dif_is_gasmix(gasmix, 40.0, 60.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_EANX40;
-    } else if (_dif_is_gasmix(gasmix, 100.0, 0.0, 0.0, 0.0, 0.0)) {
-        return DIF_GASMIX_OXYGEN100;
-    }
-    return DIF_GASMIX_UNKNOWN;
-}
-
-gchar *dif_gasmix_name(dif_gasmix_t *gasmix) {
-    switch(dif_gasmix_type(gasmix)) {
-    case DIF_GASMIX_AIR:
-        return "air";
-        break;
-    case DIF_GASMIX_EANX30:
-        return "eanx30";
-        break;
-    case DIF_GASMIX_EANX31:
-        return "eanx31";
-        break;
-    case DIF_GASMIX_EANX32:
-        return "eanx32";
-        break;
-    case DIF_GASMIX_EANX33:
-        return "eanx33";
-        break;
-    case DIF_GASMIX_EANX34:
-        return "eanx34";
-        break;
-    case DIF_GASMIX_EANX35:
-        return "eanx35";
-        break;
-    case DIF_GASMIX_EANX36:
-        return "eanx36";
-        break;
-    case DIF_GASMIX_EANX37:
-        return "eanx37";
-        break;
-    case DIF_GASMIX_EANX38:
-        return "eanx38";
-        break;
-    case DIF_GASMIX_EANX39:
-        return "eanx39";
-        break;
-    case DIF_GASMIX_EANX40:
-        return "eanx40";
-        break;
-    case DIF_GASMIX_OXYGEN100:
-        return "pureoxygen";
-        break;
-    case DIF_GASMIX_UNKNOWN:
-    default:
-    {
-        gchar *gasmixName = g_malloc(26);
-        g_snprintf(gasmixName, 26, "mix_%02do2_%02dn2%02dhe%02dar%02dh2",
-                (gint)gasmix->oxygen, (gint)gasmix->nitrogen,
-                (gint)gasmix->helium, (gint)gasmix->argon,
-                (gint)gasmix->hydrogen);
-        return gasmixName;
-        break;
-    }
-    }
-    return NULL;
-}
-
 /**
  * the Uwatec Galileo Luna usually reports extra tanks as 100% nitrogen
  * this isn't a valid tank and no one would ever dive with a 100% n2 tank,
@@ -412,33 +919,26 @@ gboolean dif_gasmix_is_valid(dif_gasmix_t *gasmix) {
 }
 
 /**
- * given a sample, get the subsample that matches the particular type
+ * given a sample, get the first subsample that matches the particular type
+ *
+ * this is the per-sample view of the data; whole-dive scans should go
+ * through the columns of dif_dive_get_profile instead
  */
 dif_subsample_t *dif_sample_get_subsample(dif_sample_t *sample, dif_sample_type_t sampleType) {
-    if (sample == NULL) {
+    if (sample == NULL || sampleType >= DIF_SAMPLE_TYPE_COUNT || !DIF_SAMPLE_HAS(sample, sampleType)) {
         return NULL;
     }
-    GList *subsamples = g_list_first(sample->subsamples);
-    while (subsamples != NULL) {
-        dif_subsample_t *subsample = subsamples->data;
-        if (subsample->type == sampleType) {
-            return subsample;
-        }
-        subsamples = g_list_next(subsamples);
-    }
-    return NULL;
+    return sample->subsamples[sample->slot[sampleType]];
 }
 
 gint _dif_dive_compare(gconstpointer a, gconstpointer b) {
     dif_dive_t *dive1 = (dif_dive_t *)a;
     dif_dive_t *dive2 = (dif_dive_t *)b;
-    GDateTime *time1 = dive1->datetime;
-    GDateTime *time2 = dive2->datetime;
-    if (time1 != NULL && time2 != NULL) {
-        return g_date_time_compare(time1, time2);
-    } else if (time1 != NULL && time2 == NULL) {
+    if (dive1->hasStartTime && dive2->hasStartTime) {
+        return (dive1->startTime > dive2->startTime) - (dive1->startTime < dive2->startTime);
+    } else if (dive1->hasStartTime && !dive2->hasStartTime) {
         return -1;
-    } else if (time1 == NULL && time2 != NULL) {
+    } else if (!dive1->hasStartTime && dive2->hasStartTime) {
         return 1;
     } else {
         return 0;
@@ -446,20 +946,106 @@ gint _dif_dive_compare(gconstpointer a, gconstpointer b) {
     return 0;
 }
 
+/**
+ * merge the sorted runs [lo, mid) and [mid, hi) of src into dst, taking
+ * from the left run on ties so the merge is stable
+ */
+static void _dif_dive_merge(gpointer *src, gpointer *dst, guint lo, guint mid, guint hi) {
+    guint left = lo, right = mid, out = lo;
+    while (left < mid && right < hi) {
+        if (_dif_dive_compare(src[right], src[left]) < 0) {
+            dst[out++] = src[right++];
+        } else {
+            dst[out++] = src[left++];
+        }
+    }
+    while (left < mid) {
+        dst[out++] = src[left++];
+    }
+    while (right < hi) {
+        dst[out++] = src[right++];
+    }
+}
+
 /**
  * sorts dives in ascending order by their timestamp
  *
- * dives with no timestamp are put to the end of the list
+ * dives with no timestamp are put to the end of the array. this is a
+ * natural merge sort: the array is first cut into runs that are already in
+ * order, and strictly descending runs are reversed in place, which keeps
+ * the sort stable. dive computers hand out dives newest first, so the
+ * usual collection is a single run and is sorted in linear time, as is a
+ * collection that is already sorted. the dates of a dive can change after
+ * it was added, so the runs are found again on every call rather than
+ * trusting an earlier sort.
  */
 dif_dive_collection_t *dif_dive_collection_sort_dives(dif_dive_collection_t *dc) {
-    GList *dives = dc->dives;
-    dc->dives = g_list_sort(dives, _dif_dive_compare);
+    gpointer *data = dc->dives->pdata;
+    guint n = dc->dives->len;
+    GArray *runs;
+    gpointer *buffer, *src, *dst;
+    guint i, r;
+
+    runs = g_array_new(FALSE, FALSE, sizeof(guint));
+    for (i = 0; i < n;) {
+        guint start = i++;
+        if (i < n && _dif_dive_compare(data[i - 1], data[i]) > 0) {
+            guint lo, hi;
+            while (i < n && _dif_dive_compare(data[i - 1], data[i]) > 0) {
+                i++;
+            }
+            dif_dive_collection_invalidate_days(dc);
+            for (lo = start, hi = i - 1; lo < hi; lo++, hi--) {
+                gpointer swap = data[lo];
+                data[lo] = data[hi];
+                data[hi] = swap;
+            }
+        }
+        while (i < n && _dif_dive_compare(data[i - 1], data[i]) <= 0) {
+            i++;
+        }
+        g_array_append_val(runs, start);
+    }
+    if (runs->len <= 1) {
+        g_array_free(runs, TRUE);
+        return dc;
+    }
+
+    /* merge neighbouring runs until one is left */
+    dif_dive_collection_invalidate_days(dc);
+    g_array_append_val(runs, n);
+    buffer = g_new(gpointer, n);
+    src = data;
+    dst = buffer;
+    while (runs->len > 2) {
+        guint nruns = runs->len - 1;
+        guint kept = 0;
+        for (r = 0; r < nruns; r += 2) {
+            guint lo = g_array_index(runs, guint, r);
+            guint mid = g_array_index(runs, guint, r + 1);
+            guint hi = r + 2 <= nruns ? g_array_index(runs, guint, r + 2) : mid;
+            _dif_dive_merge(src, dst, lo, mid, hi);
+            g_array_index(runs, guint, kept++) = lo;
+        }
+        g_array_index(runs, guint, kept++) = n;
+        g_array_set_size(runs, kept);
+        src = dst;
+        dst = dst == buffer ? data : buffer;
+    }
+    if (src != data) {
+        memcpy(data, src, n * sizeof(gpointer));
+    }
+    g_free(buffer);
+    g_array_free(runs, TRUE);
     return dc;
 }
 
+/**
+ * comparator for g_ptr_array_sort, which passes pointers to the elements
+ */
 gint _dif_dive_sample_compare(gconstpointer a, gconstpointer b) {
-    dif_sample_t *s1 = (dif_sample_t *)a;
-    dif_sample_t *s2 = (dif_sample_t *)b;
+    dif_sample_t *s1 = *(dif_sample_t **)a;
+    dif_sample_t *s2 = *(dif_sample_t **)b;
 
     if (s1->timestamp < s2->timestamp) {
         return -1;
@@ -472,10 +1058,15 @@ gint _dif_dive_sample_compare(gconstpointer a, gconstpointer b) {
 
 /**
  * sorts samples in ascending order by their timestamp
+ *
+ * the dive tracks whether any sample was added out of order, so this only
+ * sorts when something is actually out of place. the sort is stable.
  */
 dif_dive_t *dif_dive_sort_samples(dif_dive_t *dive) {
-    GList *samples = dive->samples;
-    dive->samples = g_list_sort(samples, _dif_dive_sample_compare);
+    if (!dive->samplesSorted) {
+        g_ptr_array_sort(dive->samples, _dif_dive_sample_compare);
+        dive->samplesSorted = TRUE;
+    }
     return dive;
 }
 
@@ -484,33 +1075,56 @@ dif_dive_t *dif_dive_sort_samples(dif_dive_t *dive) {
  */
 dif_dive_collection_t *dif_dive_collection_calculate_surface_interval(dif_dive_collection_t *dc) {
     dc = dif_dive_collection_sort_dives(dc);
-    GList *dives = dc->dives;
     dif_dive_t *previousDive = NULL;
-    while (dives != NULL) {
-        dif_dive_t *thisDive = dives->data;
-        if (thisDive->duration == 0 && thisDive->samples) {
+    guint i;
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_dive_t *thisDive = g_ptr_array_index(dc->dives, i);
+        if (thisDive->frozen) {
+            /* worked out before the dive was frozen */
+            previousDive = thisDive;
+            continue;
+        }
+        if (thisDive->duration == 0 && thisDive->samples->len > 0) {
             thisDive = dif_dive_sort_samples(thisDive);
-            dif_sample_t *firstSample = g_list_first(thisDive->samples)->data;
-            dif_sample_t *lastSample = g_list_last(thisDive->samples)->data;
+            dif_sample_t *firstSample = g_ptr_array_index(thisDive->samples, 0);
+            dif_sample_t *lastSample = g_ptr_array_index(thisDive->samples, thisDive->samples->len - 1);
             thisDive->duration = lastSample->timestamp - firstSample->timestamp;
+        } else if (thisDive->duration == 0 && thisDive->compact != NULL && thisDive->compact->nrows > 0) {
+            /* compact samples are stored in timestamp order */
+            thisDive->duration = thisDive->compact->timestamp[thisDive->compact->nrows - 1] -
+                                 thisDive->compact->timestamp[0];
         }
-        if (previousDive == NULL) {
+        if (previousDive == NULL || !previousDive->hasStartTime || !thisDive->hasStartTime) {
             thisDive->surfaceInterval = -1;
         } else {
-            GDateTime *previousTime = previousDive->datetime;
-            previousTime = g_date_time_add_seconds(previousTime, previousDive->duration);
-            GTimeSpan diff = g_date_time_difference(thisDive->datetime, previousTime);
-            thisDive->surfaceInterval = diff/G_TIME_SPAN_SECOND;
+            gint64 diff = thisDive->startTime - (previousDive->startTime + previousDive->duration);
+            thisDive->surfaceInterval = CLAMP(diff, G_MININT, G_MAXINT);
             if (thisDive->surfaceInterval > SURFACE_INTERVAL_MAX) {
                 thisDive->surfaceInterval = -1;
             }
         }
         previousDive = thisDive;
-        dives = g_list_next(dives);
     }
     return dc;
 }
 
+/**
+ * find the running statistics of a tank
+ *
+ * the getters below answer from the dive's running statistics while they
+ * are current, and fall back to a slice over the whole dive otherwise
+ */
+static const dif_tank_stats_t *_dif_dive_stats_tank(const dif_dive_stats_t *stats, gint tank) {
+    guint i;
+    for (i = 0; i < stats->tanks->len; i++) {
+        const dif_tank_stats_t *tankStats = &g_array_index(stats->tanks, dif_tank_stats_t, i);
+        if (tank >= 0 && tankStats->tank == (guint) tank) {
+            return tankStats;
+        }
+    }
+    return NULL;
+}
+
 /**
  * given a dive, get the first valid pressure
  *
@@ -519,19 +1133,16 @@ dif_dive_collection_t *dif_dive_collection_calculate_surface_interval(dif_dive_c
  * @return: the first valid pressure, or 0.0 if not found
  */
 gdouble dif_dive_get_initial_pressure(dif_dive_t *dive, gint tank) {
-    GList *samples = g_list_first(dive->samples);
-    gdouble initialPressure = 0.0;
-    while (samples != NULL && initialPressure < GAS_EPSILON) {
-        dif_sample_t *sample = samples->data;
-        dif_subsample_t *subsample = dif_sample_get_subsample(sample, DIF_SAMPLE_PRESSURE);
-        if (subsample != NULL) {
-            if ((tank < 0 || subsample->value.pressure.tank == tank) && subsample->value.pressure.value > GAS_EPSILON) {
-                initialPressure = subsample->value.pressure.value;
-            }
+    dif_sample_slice_t slice;
+    if (dive->stats != NULL) {
+        const dif_tank_stats_t *tankStats = _dif_dive_stats_tank(dive->stats, tank);
+        if (tank < 0) {
+            return dive->stats->initialPressure;
         }
-        samples = g_list_next(samples);
+        return tankStats != NULL ? tankStats->beginPressure : 0.0;
     }
-    return initialPressure;
+    slice = dif_dive_samples_in_range(dive, 0, G_MAXUINT);
+    return dif_sample_slice_get_initial_pressure(&slice, tank);
 }
 
 /**
@@ -542,17 +1153,12 @@ gdouble dif_dive_get_initial_pressure(dif_dive_t *dive, gint tank) {
  * @return: the tank id, or -1 if the dive has no valid pressure samples
  */
 gint dif_dive_get_initial_pressure_tank(dif_dive_t *dive) {
-    dive = dif_dive_sort_samples(dive);
-    GList *samples = g_list_first(dive->samples);
-    while (samples != NULL) {
-        dif_sample_t *sample = samples->data;
-        dif_subsample_t *subsample = dif_sample_get_subsample(sample, DIF_SAMPLE_PRESSURE);
-        if (subsample != NULL && subsample->value.pressure.value > GAS_EPSILON) {
-            return subsample->value.pressure.tank;
-        }
-        samples = g_list_next(samples);
+    dif_sample_slice_t slice;
+    if (dive->stats != NULL) {
+        return dive->stats->initialPressureTank;
     }
-    return -1;
+    slice = dif_dive_samples_in_range(dive, 0, G_MAXUINT);
+    return dif_sample_slice_get_initial_pressure_tank(&slice);
 }
 
 /**
@@ -563,20 +1169,16 @@ gint dif_dive_get_initial_pressure_tank(dif_dive_t *dive) {
  * @return: the last valid pressure, or 0.0 if not found
  */
 gdouble dif_dive_get_final_pressure(dif_dive_t *dive, gint tank) {
-    dive = dif_dive_sort_samples(dive);
-    GList *samples = g_list_last(dive->samples);
-    gdouble finalPressure = 0.0;
-    while (samples != NULL && finalPressure < GAS_EPSILON) {
-        dif_sample_t *sample = samples->data;
-        dif_subsample_t *subsample = dif_sample_get_subsample(sample, DIF_SAMPLE_PRESSURE);
-        if (subsample != NULL) {
-            if ((tank < 0 || subsample->value.pressure.tank == tank) && subsample->value.pressure.value > GAS_EPSILON) {
-                finalPressure = subsample->value.pressure.value;
-            }
+    dif_sample_slice_t slice;
+    if (dive->stats != NULL) {
+        const dif_tank_stats_t *tankStats = _dif_dive_stats_tank(dive->stats, tank);
+        if (tank < 0) {
+            return dive->stats->finalPressure;
         }
-        samples = g_list_previous(samples);
+        return tankStats != NULL ? tankStats->endPressure : 0.0;
     }
-    return finalPressure;
+    slice = dif_dive_samples_in_range(dive, 0, G_MAXUINT);
+    return dif_sample_slice_get_final_pressure(&slice, tank);
 }
 
 /**
@@ -587,41 +1189,12 @@ gdouble dif_dive_get_final_pressure(dif_dive_t *dive, gint tank) {
  * @return: the average depth in meters, or 0.0 if there are no depth samples
  */
 gdouble dif_dive_get_average_depth(dif_dive_t *dive) {
-    dive = dif_dive_sort_samples(dive);
-    GList *samples = g_list_first(dive->samples);
-    gdouble area = 0.0;
-    gdouble depthSum = 0.0;
-    guint nDepths = 0;
-    gdouble prevDepth = 0.0;
-    guint prevTimestamp = 0;
-    guint firstTimestamp = 0;
-    guint lastTimestamp = 0;
-    while (samples != NULL) {
-        dif_sample_t *sample = samples->data;
-        dif_subsample_t *subsample = dif_sample_get_subsample(sample, DIF_SAMPLE_DEPTH);
-        if (subsample != NULL) {
-            gdouble depth = subsample->value.depth;
-            if (nDepths == 0) {
-                firstTimestamp = sample->timestamp;
-            } else {
-                area += (prevDepth + depth) / 2.0 * (sample->timestamp - prevTimestamp);
-            }
-            lastTimestamp = sample->timestamp;
-            prevDepth = depth;
-            prevTimestamp = sample->timestamp;
-            depthSum += depth;
-            nDepths++;
-        }
-        samples = g_list_next(samples);
-    }
-    if (nDepths == 0) {
-        return 0.0;
-    }
-    if (lastTimestamp == firstTimestamp) {
-        /* single depth sample or zero elapsed time, fall back to a simple mean */
-        return depthSum / nDepths;
+    dif_sample_slice_t slice;
+    if (dive->stats != NULL) {
+        return dive->stats->averageDepth;
     }
-    return area / (lastTimestamp - firstTimestamp);
+    slice = dif_dive_samples_in_range(dive, 0, G_MAXUINT);
+    return dif_sample_slice_get_average_depth(&slice);
 }
 
 /**
@@ -631,43 +1204,30 @@ gdouble dif_dive_get_average_depth(dif_dive_t *dive) {
  * @return: the greatest depth in meters, or 0.0 if there are no depth samples
  */
 gdouble dif_dive_get_greatest_depth(dif_dive_t *dive) {
-    GList *samples = g_list_first(dive->samples);
-    gdouble greatestDepth = 0.0;
-    while (samples != NULL) {
-        dif_sample_t *sample = samples->data;
-        dif_subsample_t *subsample = dif_sample_get_subsample(sample, DIF_SAMPLE_DEPTH);
-        if (subsample != NULL && subsample->value.depth > greatestDepth) {
-            greatestDepth = subsample->value.depth;
-        }
-        samples = g_list_next(samples);
+    dif_sample_slice_t slice;
+    if (dive->stats != NULL) {
+        return dive->stats->greatestDepth;
     }
-    return greatestDepth;
+    slice = dif_dive_samples_in_range(dive, 0, G_MAXUINT);
+    return dif_sample_slice_get_greatest_depth(&slice);
 }
 
 /**
  * given a dive, get the lowest temperature recorded in the samples.
  * temperatures at or below 0.1C are treated as missing readings, matching
- * the historical serialization behavior
+ * the historical serialization behavior.
  *
  * @param dive: the dif_dive_t object
  * @return: the lowest temperature in Celsius, or 0.0 if there are no
  *          usable temperature samples
  */
 gdouble dif_dive_get_lowest_temperature(dif_dive_t *dive) {
-    GList *samples = g_list_first(dive->samples);
-    gdouble lowestTemperature = 9999;
-    while (samples != NULL) {
-        dif_sample_t *sample = samples->data;
-        dif_subsample_t *subsample = dif_sample_get_subsample(sample, DIF_SAMPLE_TEMPERATURE);
-        if (subsample != NULL && subsample->value.temperature > 0.1 && subsample->value.temperature < lowestTemperature) {
-            lowestTemperature = subsample->value.temperature;
-        }
-        samples = g_list_next(samples);
+    dif_sample_slice_t slice;
+    if (dive->stats != NULL) {
+        return dive->stats->lowestTemperature;
     }
-    if (lowestTemperature > 9998) {
-        return 0.0;
-    }
-    return lowestTemperature;
+    slice = dif_dive_samples_in_range(dive, 0, G_MAXUINT);
+    return dif_sample_slice_get_lowest_temperature(&slice);
 }
 
 /**
@@ -677,14 +1237,13 @@ gdouble dif_dive_get_lowest_temperature(dif_dive_t *dive) {
  * @return: the duration in seconds, or 0 if there are no samples
  */
 guint dif_dive_get_dive_duration(dif_dive_t *dive) {
-    GList *samples = g_list_first(dive->samples);
-    guint maxTimestamp = 0;
-    while (samples != NULL) {
-        dif_sample_t *sample = samples->data;
-        if (sample->timestamp > maxTimestamp) {
-            maxTimestamp = sample->timestamp;
-        }
-        samples = g_list_next(samples);
+    const dif_profile_t *profile;
+    if (dive->stats != NULL) {
+        return dive->stats->duration;
+    }
+    profile = dif_dive_get_profile(dive);
+    if (profile->nrows == 0) {
+        return 0;
     }
-    return maxTimestamp;
+    return profile->timestamp[profile->nrows - 1];
 }
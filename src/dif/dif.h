@@ -10,16 +10,168 @@ extern "C" {
 #define GAS_EPSILON 0.1
 #define SURFACE_INTERVAL_MAX 86400
 
+/* UDDF stores SI units: pressures in pascal, temperatures in kelvin */
+#define BAR_TO_PASCAL(a) ((a)*100000)
+#define CELSIUS_TO_KELVIN(a) ((a)+273.15)
+
 /**
  * @brief A dive collection is used for a set of dives downloaded from a dive computer
  * 
  * This structure represents a collection of dives that can be exported to UDDF format.
- * It contains a list of individual dive records.
+ * It contains an array of individual dive records, owned by the collection.
  */
 typedef struct dif_dive_collection_t {
-    GList *dives; /**< A list of dif_dive_t structures representing individual dives */
+    GPtrArray *dives; /**< The dif_dive_t structures representing individual dives */
+    GArray *days;     /**< Day buckets over the sorted dives, built on demand; NULL when stale */
 } dif_dive_collection_t;
 
+/**
+ * @brief The dives of a collection that started on the same local day
+ *
+ * The dives are dc->dives[first] up to dc->dives[first + n - 1], see
+ * dif_dive_collection_get_days.
+ */
+typedef struct dif_day_bucket_t {
+    gint64 day;               /**< Local day in days since 1970-01-01, see dif_dive_get_local_day */
+    guint first;              /**< Index in the sorted dives of the first dive of the day */
+    guint n;                  /**< Number of dives that day */
+} dif_day_bucket_t;
+
+/**
+ * @brief Who owns the memory of a sample or subsample
+ *
+ * Heap objects are released one by one with dif_sample_free and
+ * dif_subsample_free. Arena objects, including their subsample arrays,
+ * vendor payloads and setmarker strings, are carved from the arena of the
+ * dive they were allocated for and released all at once with the dive.
+ */
+typedef enum dif_owner_t {
+    DIF_OWNER_HEAP = 0,
+    DIF_OWNER_ARENA
+} dif_owner_t;
+
+/**
+ * @brief Bump allocator that hands out memory from a chain of large blocks
+ *
+ * Individual allocations are never freed; dif_arena_free releases every
+ * block in one go.
+ */
+typedef struct dif_arena_t {
+    struct dif_arena_block_t *blocks; /**< Block chain, most recent block first */
+    guint nblocks;            /**< Number of blocks obtained from the heap */
+    guint nallocations;       /**< Number of allocations served from the blocks */
+    gsize bytesAllocated;     /**< Total size of all blocks */
+    gsize bytesUsed;          /**< Bytes handed out, including alignment padding */
+} dif_arena_t;
+
+/**
+ * @brief Test whether row @row is set in a profile presence bitmap
+ */
+#define DIF_PROFILE_HAS(bitmap, row) (((bitmap)[(row) >> 5] >> ((row) & 31)) & 1)
+
+/**
+ * @brief Pressure column for one tank of a dive profile
+ */
+typedef struct dif_profile_tank_t {
+    guint tank;               /**< Tank identifier as reported by the dive computer */
+    gdouble *pressure;        /**< Pressure in bar, one slot per profile row */
+    guint32 *present;         /**< Presence bitmap over rows, see DIF_PROFILE_HAS */
+} dif_profile_tank_t;
+
+/**
+ * @brief Columnar (struct-of-arrays) layout of a dive's sampled channels
+ *
+ * Row i holds the channel values of the i-th sample in timestamp order.
+ * Every channel is a dense array with one slot per row plus a presence
+ * bitmap, so statistics scan contiguous doubles instead of chasing
+ * subsample pointers. Events, alarms, setmarkers and vendor payloads have
+ * no column; they are only reachable through the samples themselves.
+ */
+typedef struct dif_profile_t {
+    guint nrows;              /**< Number of rows (samples) */
+    guint *timestamp;         /**< Sample timestamps in seconds, ascending */
+    gdouble *depth;           /**< Depth in meters */
+    guint32 *depthPresent;    /**< Presence bitmap for depth */
+    gdouble *temperature;     /**< Temperature in Celsius */
+    guint32 *temperaturePresent; /**< Presence bitmap for temperature */
+    guint *rbt;               /**< Remaining bottom time in seconds */
+    guint32 *rbtPresent;      /**< Presence bitmap for rbt */
+    guint *heartbeat;         /**< Heart rate in beats per minute */
+    guint32 *heartbeatPresent;/**< Presence bitmap for heartbeat */
+    guint *bearing;           /**< Compass bearing in degrees */
+    guint32 *bearingPresent;  /**< Presence bitmap for bearing */
+    guint *pressureTank;      /**< Column in tanks of the row's first pressure reading */
+    guint32 *pressurePresent; /**< Presence bitmap for any pressure reading */
+    guint ntanks;             /**< Number of tank pressure columns */
+    dif_profile_tank_t *tanks;/**< Tank pressure columns in order of first appearance */
+} dif_profile_t;
+
+/**
+ * @brief Pressure summary for one tank of a dive
+ */
+typedef struct dif_tank_summary_t {
+    guint tank;               /**< Tank identifier as reported by the dive computer */
+    gdouble beginPressure;    /**< First valid pressure in bar */
+    gdouble endPressure;      /**< Last valid pressure in bar */
+} dif_tank_summary_t;
+
+/**
+ * @brief Sample statistics of a dive, computed in one pass by dif_dive_compute_summary
+ *
+ * Every field matches the dif_dive_get_* getter of the same name. Values
+ * the samples do not provide are 0.0, or -1 for initialPressureTank.
+ */
+typedef struct dif_dive_summary_t {
+    guint duration;           /**< Timestamp of the last sample in seconds */
+    gdouble greatestDepth;    /**< Greatest depth in meters */
+    gdouble averageDepth;     /**< Time-weighted average depth in meters */
+    gdouble lowestTemperature;/**< Lowest temperature above 0.1C, in Celsius */
+    gdouble initialPressure;  /**< First valid pressure of any tank in bar */
+    gdouble finalPressure;    /**< Last valid pressure of any tank in bar */
+    gint initialPressureTank; /**< Tank of the first valid pressure, or -1 */
+    gdouble beginPressure;    /**< First valid pressure of initialPressureTank */
+    gdouble endPressure;      /**< Last valid pressure of initialPressureTank */
+    guint ntanks;             /**< Number of entries in tanks */
+    dif_tank_summary_t *tanks;/**< Tanks with a valid pressure listed first in a sample, in order of first reading */
+} dif_dive_summary_t;
+
+/**
+ * @brief Running pressure statistics for one tank, see dif_dive_stats_t
+ */
+typedef struct dif_tank_stats_t {
+    guint tank;               /**< Tank identifier as reported by the dive computer */
+    gdouble beginPressure;    /**< First valid pressure in bar listed first in its sample, 0.0 for none */
+    gdouble endPressure;      /**< Last valid pressure in bar listed first in its sample, 0.0 for none */
+} dif_tank_stats_t;
+
+/**
+ * @brief Statistics accumulated while samples are added to a dive
+ *
+ * Samples arriving in timestamp order are folded in as they are added, so
+ * the statistics of a freshly downloaded dive are known without a scan.
+ * The dive drops its accumulator when a sample with depth, temperature or
+ * pressure arrives out of order or one of those values is edited, and
+ * dif_dive_compute_summary builds a new one from the samples.
+ */
+typedef struct dif_dive_stats_t {
+    guint nrows;              /**< Number of samples folded in */
+    struct dif_sample_t *lastSample; /**< Latest sample folded in; later subsamples on it are folded in too */
+    guint duration;           /**< Timestamp of the latest sample */
+    gdouble greatestDepth;    /**< Greatest depth in meters */
+    gdouble averageDepth;     /**< Time-weighted average depth in meters */
+    gdouble lowestTemperature;/**< Lowest temperature above 0.1C, 0.0 for none */
+    gint initialPressureTank; /**< Tank of the first valid pressure, or -1 */
+    gdouble initialPressure;  /**< First valid pressure of any tank in bar */
+    gdouble finalPressure;    /**< Last valid pressure of any tank in bar */
+    GArray *tanks;            /**< dif_tank_stats_t in order of first reading */
+    gdouble depthArea;        /**< Trapezoidal depth integral in meter-seconds */
+    gdouble depthSum;         /**< Sum of depths, for the single-timestamp mean */
+    guint nDepths;            /**< Number of depth readings */
+    gdouble prevDepth;        /**< Latest depth reading */
+    guint prevTimestamp;      /**< Timestamp of the latest depth reading */
+    guint firstTimestamp;     /**< Timestamp of the first depth reading */
+} dif_dive_stats_t;
+
 /**
  * @brief A single dive consists of a sequence of samples
  * 
@@ -27,11 +179,13 @@ typedef struct dif_dive_collection_t {
  * timestamp, duration, maximum depth, gas mixes used, and samples recorded.
  */
 typedef struct dif_dive_t {
-    GDateTime *datetime;      /**< Date and time of the dive */
+    gint64 startTime;         /**< Start of the dive in seconds since the epoch, valid iff hasStartTime */
+    gint32 utcOffset;         /**< Offset of the local time of the dive from UTC in seconds */
+    gboolean hasStartTime;    /**< TRUE when the date and time of the dive are known */
     guint duration;           /**< Duration of the dive in seconds */
     gdouble maxdepth;         /**< Maximum depth reached during the dive in meters */
-    GList *gasmixes;          /**< A list of dif_gasmix_t structures representing gas mixes used */
-    GList *samples;           /**< A list of dif_sample_t structures representing dive samples */
+    GArray *gasmixes;         /**< Gas table ids (guint) of the gas mixes used, see dif_gas_get */
+    GPtrArray *samples;       /**< An array of dif_sample_t pointers representing dive samples, owned by the dive */
     gint surfaceInterval;     /**< Number of seconds since the last dive, -1 if first dive */
     gdouble avgdepth;         /**< Parser-reported average depth in meters, valid iff hasAvgdepth */
     gboolean hasAvgdepth;     /**< TRUE when avgdepth was reported by the dive computer */
@@ -40,6 +194,16 @@ typedef struct dif_dive_t {
     gboolean hasTankPressures;/**< TRUE when begin/end pressures were reported by the dive computer */
     gdouble minTemperature;   /**< Parser-reported minimum temperature in Celsius, valid iff hasMinTemperature */
     gboolean hasMinTemperature;/**< TRUE when minTemperature was reported by the dive computer */
+    dif_profile_t *profile;   /**< Columnar view of the samples, built on demand; NULL when stale */
+    dif_arena_t *arena;       /**< Memory for the samples allocated with dif_dive_alloc_sample */
+    guint nHeapOwned;         /**< Heap samples or subsamples handed to the dive; when zero, freeing skips the per-sample walk */
+    GHashTable *sampleIndex;  /**< Timestamp to first sample at that timestamp, built on demand; NULL when stale */
+    gboolean samplesSorted;   /**< TRUE while samples are in ascending timestamp order */
+    dif_dive_stats_t *stats;  /**< Running sample statistics; NULL when stale */
+    struct dif_compact_samples_t *compact; /**< Samples while the dive is compacted, otherwise NULL */
+    GBytes *source;           /**< Retained record buffer that vendor payloads may point into, or NULL */
+    gint refcount;            /**< References held on the dive, see dif_dive_ref */
+    gboolean frozen;          /**< TRUE once dif_dive_freeze made the dive read-only */
 } dif_dive_t;
 
 /**
@@ -80,6 +244,7 @@ typedef struct dif_gasmix_t {
     gdouble argon;         /**< Percentage of argon in the mix */
     gdouble hydrogen;      /**< Percentage of hydrogen in the mix */
     dif_gasmix_type_t type;/**< Type classification of the gas mix */
+    const gchar *name;     /**< Name of the mix once interned in the gas table, otherwise NULL */
 } dif_gasmix_t;
 
 /**
@@ -103,6 +268,14 @@ typedef enum dif_sample_type_t {
     DIF_SAMPLE_SETMARKER     /**< UDDF setmarker (free-text waypoint marker, e.g. bookmark) */
 } dif_sample_type_t;
 
+/** Number of dif_sample_type_t values, for per-type tables */
+#define DIF_SAMPLE_TYPE_COUNT (DIF_SAMPLE_SETMARKER + 1)
+
+/**
+ * @brief Test whether a sample carries at least one subsample of a type
+ */
+#define DIF_SAMPLE_HAS(sample, sampleType) (((sample)->present >> (sampleType)) & 1)
+
 /**
  * @brief UDDF alarm kinds
  *
@@ -122,6 +295,16 @@ typedef enum dif_alarm_type_t {
     DIF_ALARM_SURFACE        /**< Surfaced / surface warning */
 } dif_alarm_type_t;
 
+/**
+ * @brief An alarm to attach to a dive at a given time, see dif_dive_add_alarms
+ */
+typedef struct dif_alarm_t {
+    guint timestamp;           /**< Seconds since the start of the dive */
+    dif_alarm_type_t type;     /**< UDDF alarm kind */
+    gdouble level;             /**< Alarm level, only meaningful when hasLevel */
+    gboolean hasLevel;         /**< TRUE when level should be emitted */
+} dif_alarm_t;
+
 /**
  * @brief Types of events that can occur during a dive
  * 
@@ -183,7 +366,7 @@ typedef union dif_sample_value_t {
     struct {
         guint type;             /**< Vendor-specific type */
         guint size;             /**< Size of vendor data */
-        gpointer data;          /**< Owned copy of vendor-specific data (freed by dif_subsample_free) */
+        gpointer data;          /**< Owned copy of vendor-specific data (freed by dif_subsample_free), or a view into the dive's source */
     } vendor;
     struct {
         dif_alarm_type_t type;  /**< UDDF alarm kind */
@@ -201,7 +384,14 @@ typedef union dif_sample_value_t {
  */
 typedef struct dif_sample_t {
     guint timestamp;           /**< Timestamp in seconds since start of dive */
-    GList *subsamples;        /**< A list of dif_subsample_t structures */
+    struct dif_subsample_t **subsamples; /**< Subsamples in insertion order */
+    guint nsubsamples;        /**< Number of entries in subsamples */
+    guint subsampleCapacity;  /**< Allocated length of subsamples */
+    guint32 present;          /**< Bit n set when a subsample of type n is attached */
+    guint16 slot[DIF_SAMPLE_TYPE_COUNT]; /**< Index in subsamples of the first subsample of each present type */
+    struct dif_dive_t *dive;  /**< The dive this sample was added to, or NULL */
+    dif_owner_t owner;        /**< Where the sample and its subsample array live */
+    dif_arena_t *arena;       /**< Arena of the dive it was allocated for, NULL for heap samples */
 } dif_sample_t;
 
 /**
@@ -211,9 +401,174 @@ typedef struct dif_sample_t {
  */
 typedef struct dif_subsample_t {
     dif_sample_type_t type;    /**< Type of sample data */
+    dif_owner_t owner;         /**< Where the subsample and its payload live */
     dif_sample_value_t value;  /**< Value of the sample data */
 } dif_subsample_t;
 
+/** The channels a dif_sample_record_t can carry */
+#define DIF_SAMPLE_RECORD_CHANNELS ((1u << DIF_SAMPLE_DEPTH) | (1u << DIF_SAMPLE_PRESSURE) | \
+                                    (1u << DIF_SAMPLE_TEMPERATURE) | (1u << DIF_SAMPLE_RBT) | \
+                                    (1u << DIF_SAMPLE_HEARTBEAT) | (1u << DIF_SAMPLE_BEARING))
+
+/**
+ * @brief Fixed-layout waypoint for dif_dive_append_samples
+ *
+ * One record becomes one sample with a subsample for every channel whose
+ * bit is set in present. Events, alarms, vendor data and setmarkers have
+ * no field here and are attached to the samples afterwards.
+ */
+typedef struct dif_sample_record_t {
+    guint timestamp;          /**< Timestamp in seconds since start of dive */
+    guint32 present;          /**< Bit n set when the channel of type n is filled in, see DIF_SAMPLE_RECORD_CHANNELS */
+    gdouble depth;            /**< Depth in meters */
+    gdouble temperature;      /**< Temperature in Celsius */
+    gdouble pressure;         /**< Pressure in bar */
+    guint pressureTank;       /**< Tank the pressure was read from */
+    guint rbt;                /**< Remaining bottom time in seconds */
+    guint heartbeat;          /**< Heart rate in beats per minute */
+    guint bearing;            /**< Compass bearing in degrees */
+} dif_sample_record_t;
+
+/**
+ * @brief Samples of a dive in a time range, see dif_dive_samples_in_range
+ *
+ * The slice points into the dive's samples array and profile columns, so
+ * samples[i] is row first + i of the profile. It is only valid until the
+ * samples of the dive change.
+ */
+typedef struct dif_sample_slice_t {
+    struct dif_dive_t *dive;  /**< The dive the slice belongs to */
+    const dif_profile_t *profile; /**< Profile of the dive, for column access */
+    dif_sample_t **samples;   /**< First sample of the slice */
+    guint first;              /**< Row of the first sample in the dive and its profile */
+    guint n;                  /**< Number of samples in the slice */
+    guint from;               /**< Start of the range, inclusive, in seconds */
+    guint to;                 /**< End of the range, exclusive, in seconds */
+} dif_sample_slice_t;
+
+/**
+ * @brief Walks a time range of a dive in fixed windows, see dif_sample_cursor_init
+ */
+typedef struct dif_sample_cursor_t {
+    struct dif_dive_t *dive;  /**< The dive being walked */
+    guint start;              /**< Start of the next window in seconds */
+    guint to;                 /**< End of the range, exclusive, in seconds */
+    guint window;             /**< Length of a window in seconds, 0 for a single window */
+    guint row;                /**< Row of the first sample of the next window */
+    guint end;                /**< Row one past the last sample of the range */
+    gboolean done;            /**< TRUE once the last window was handed out */
+} dif_sample_cursor_t;
+
+/** Marks an empty slot in a 16-bit compact sample column */
+#define DIF_COMPACT_NONE16 G_MAXUINT16
+/** Marks an empty slot in a 32-bit compact sample column */
+#define DIF_COMPACT_NONE32 G_MAXUINT32
+
+/**
+ * @brief A subsample that did not fit the fixed-point columns of a compact dive
+ */
+typedef struct dif_compact_extra_t {
+    guint row;                /**< Row of the sample the subsample belongs to */
+    dif_subsample_t subsample; /**< Copy of the subsample; payloads live in the compact arena */
+} dif_compact_extra_t;
+
+/**
+ * @brief Fixed-point encoding of a dive's samples, see dif_dive_compact
+ *
+ * Each row stores the first depth, temperature and pressure of a sample
+ * as integers at the resolution the serializer prints waypoints with
+ * (%0.2f of meters, kelvin and pascal), so decoding gives back exactly
+ * the same text. Everything else, and any value that does not fit a
+ * column, is kept as an extra. A row costs 13 bytes instead of a sample
+ * with three subsamples.
+ */
+typedef struct dif_compact_samples_t {
+    guint nrows;              /**< Number of samples */
+    guint32 *timestamp;       /**< Sample timestamps in seconds, ascending */
+    guint16 *depth;           /**< Depth in centimeters, or DIF_COMPACT_NONE16 */
+    guint16 *temperature;     /**< Temperature in hundredths of a kelvin, or DIF_COMPACT_NONE16 */
+    guint32 *pressure;        /**< Pressure in hundredths of a pascal, or DIF_COMPACT_NONE32 */
+    guint8 *pressureTank;     /**< Tank of the pressure column */
+    guint nextras;            /**< Number of entries in extras */
+    dif_compact_extra_t *extras; /**< Remaining subsamples, by row in their original order */
+    dif_arena_t *arena;       /**< Holds the columns, extras and their payloads */
+} dif_compact_samples_t;
+
+/**
+ * @brief Number of objects and bytes of one kind, see dif_memory_stats_t
+ */
+typedef struct dif_memory_category_t {
+    gsize count;              /**< Number of objects */
+    gsize bytes;              /**< Bytes they take up */
+} dif_memory_category_t;
+
+/**
+ * @brief Where the memory of a dive collection goes
+ *
+ * Samples, subsamples and their payloads are counted in their categories
+ * whether they live in an arena or on the heap; totalBytes counts each
+ * byte once.
+ */
+typedef struct dif_memory_stats_t {
+    dif_memory_category_t dives;         /**< dif_dive_t structures */
+    dif_memory_category_t samples;       /**< dif_sample_t structures */
+    dif_memory_category_t subsamples[DIF_SAMPLE_TYPE_COUNT]; /**< dif_subsample_t structures by type */
+    dif_memory_category_t pointerArrays; /**< Storage of the dive, sample and subsample arrays */
+    dif_memory_category_t vendorBlobs;   /**< Copied payloads of vendor subsamples */
+    dif_memory_category_t vendorViews;   /**< Vendor payloads pointing into a source buffer */
+    dif_memory_category_t sources;       /**< Distinct record buffers retained by dives */
+    dif_memory_category_t setmarkers;    /**< Strings of setmarker subsamples */
+    dif_memory_category_t gasmixes;      /**< Entries of the shared gas table */
+    dif_memory_category_t arenas;        /**< Arena blocks (count) and their size */
+    dif_memory_category_t compactRows;   /**< Rows of compacted dives and the memory holding them */
+    dif_memory_category_t caches;        /**< Profiles, sample indexes and running statistics */
+    gsize arenaBytesUsed;     /**< Part of the arena blocks handed out */
+    gsize heapBytes;          /**< Bytes allocated one by one outside the arenas */
+    gsize totalBytes;         /**< Everything above, counted once */
+} dif_memory_stats_t;
+
+/**
+ * @brief How the serializer produces the UDDF document
+ */
+typedef enum dif_xml_writer_t {
+    DIF_XML_WRITER_TREE = 0,  /**< Build the whole document with libxml2, then save it */
+    DIF_XML_WRITER_STREAM,    /**< Write every part with an xmlTextWriter as soon as it is created */
+    DIF_XML_WRITER_DIRECT     /**< Write the markup straight into a dif_emitter_t */
+} dif_xml_writer_t;
+
+/**
+ * @brief Codecs the UDDF output can be compressed with as it is written
+ */
+typedef enum dif_compression_t {
+    DIF_COMPRESSION_NONE = 0, /**< Plain XML */
+    DIF_COMPRESSION_GZIP,     /**< gzip, through zlib */
+    DIF_COMPRESSION_ZSTD      /**< zstd, when built with libzstd */
+} dif_compression_t;
+
+/**
+ * @brief Buffered output for the direct UDDF writer
+ *
+ * Writes go into one large buffer. A file emitter hands it to write()
+ * whenever it fills up, through a compressor if it has one; a memory
+ * emitter grows it instead and keeps everything.
+ */
+typedef struct dif_emitter_t {
+    gchar *buffer;            /**< Bytes not yet flushed */
+    gsize len;                /**< Bytes used in the buffer */
+    gsize size;               /**< Size of the buffer */
+    int fd;                   /**< File descriptor written to, -1 for a memory emitter */
+    gsize flushed;            /**< Bytes written to the file so far, after compression */
+    gboolean failed;          /**< Whether a write has failed; later writes are dropped */
+    dif_compression_t compression; /**< Codec the flushed bytes go through */
+    gpointer encoder;         /**< State of the codec, NULL for plain output */
+    gchar *packed;            /**< Compressed bytes on their way to the file */
+} dif_emitter_t;
+
+/**
+ * @brief Write a string literal to an emitter without measuring it at run time
+ */
+#define DIF_EMIT_LITERAL(emitter, literal) dif_emitter_write((emitter), (literal), sizeof(literal) - 1)
+
 /**
  * @brief Configuration settings for XML serializer
  * 
@@ -223,6 +578,13 @@ typedef struct dif_subsample_t {
 typedef struct xml_options_t {
     gchar *filename;           /**< Output filename for UDDF XML */
     gboolean useInvalidElements; /**< Whether to include non-standard XML elements for debugging */
+    dif_xml_writer_t writer;   /**< How the document is produced */
+    guint threads;             /**< Workers rendering dives for the direct writer, 0 for one per processor */
+    dif_compression_t compression; /**< Codec the file is compressed with while it is written */
+    gint compressionLevel;     /**< Level for the codec, 0 for its default */
+    gboolean measureDocument;  /**< Whether to record the size of the XML document before it is freed */
+    gsize documentNodes;       /**< Nodes, attributes and namespaces in the last document (largest subtree when streaming, 0 when direct), if measured */
+    gsize documentBytes;       /**< Approximate memory of the last document (largest subtree when streaming, output buffer when direct), if measured */
 } xml_options_t;
 
 /* dif.c */
@@ -231,12 +593,22 @@ void dif_dive_collection_free(dif_dive_collection_t *dc);
 dif_dive_collection_t *dif_dive_collection_add_dive(dif_dive_collection_t *dc, dif_dive_t *dive);
 dif_dive_collection_t *dif_dive_collection_sort_dives(dif_dive_collection_t *dc);
 dif_dive_collection_t *dif_dive_collection_calculate_surface_interval(dif_dive_collection_t *dc);
+dif_dive_collection_t *dif_dive_collection_freeze(dif_dive_collection_t *dc);
 dif_dive_t *dif_dive_alloc();
 void dif_dive_free(dif_dive_t *dive);
+dif_dive_t *dif_dive_ref(dif_dive_t *dive);
+void dif_dive_unref(dif_dive_t *dive);
+dif_dive_t *dif_dive_freeze(dif_dive_t *dive);
+gboolean dif_dive_is_frozen(const dif_dive_t *dive);
 dif_dive_t *dif_dive_add_sample(dif_dive_t *dive, dif_sample_t *sample);
+dif_dive_t *dif_dive_append_samples(dif_dive_t *dive, const dif_sample_record_t *records, gsize n);
 dif_dive_t *dif_dive_add_gasmix(dif_dive_t *dive, dif_gasmix_t *gasmix);
 dif_dive_t *dif_dive_set_datetime(dif_dive_t *dive, guint year, guint month, guint day, guint hour, guint minute, guint second);
 dif_dive_t *dif_dive_set_datetime_utc(dif_dive_t *dive, guint year, guint month, guint day, guint hour, guint minute, guint second);
+dif_dive_t *dif_dive_set_datetime_offset(dif_dive_t *dive, guint year, guint month, guint day, guint hour, guint minute, guint second, gint32 utcOffset);
+GDateTime *dif_dive_get_datetime(const dif_dive_t *dive);
+gint64 dif_dive_get_local_day(const dif_dive_t *dive);
+gint64 dif_days_from_civil(gint64 year, guint month, guint day);
 dif_dive_t *dif_dive_set_duration(dif_dive_t *dive, guint duration);
 dif_dive_t *dif_dive_set_maxdepth(dif_dive_t *dive, gdouble maxdepth);
 dif_dive_t *dif_dive_set_avgdepth(dif_dive_t *dive, gdouble avgdepth);
@@ -252,8 +624,6 @@ gdouble dif_dive_get_lowest_temperature(dif_dive_t *dive);
 guint dif_dive_get_dive_duration(dif_dive_t *dive);
 dif_gasmix_t *dif_gasmix_alloc();
 void dif_gasmix_free(dif_gasmix_t *gasmix);
-dif_gasmix_type_t dif_gasmix_type(dif_gasmix_t *gasmix);
-gchar *dif_gasmix_name(dif_gasmix_t *gasmix);
 gboolean dif_gasmix_is_valid(dif_gasmix_t *gasmix);
 dif_sample_t *dif_sample_alloc();
 void dif_sample_free(dif_sample_t *sample);
@@ -264,8 +634,73 @@ void dif_subsample_free(dif_subsample_t *subsample);
 dif_subsample_t *dif_subsample_set_vendor(dif_subsample_t *subsample, guint type, guint size, gconstpointer data);
 const gchar *dif_alarm_type_name(dif_alarm_type_t type);
 gboolean dif_sample_event_to_alarm(dif_sample_event_t event, dif_alarm_type_t *alarm);
+dif_sample_t *dif_dive_alloc_sample(dif_dive_t *dive);
+dif_subsample_t *dif_dive_alloc_subsample(dif_dive_t *dive);
+dif_dive_t *dif_dive_set_source(dif_dive_t *dive, GBytes *source);
+gboolean dif_dive_source_contains(const dif_dive_t *dive, gconstpointer data, gsize size);
+dif_subsample_t *dif_dive_subsample_set_vendor(dif_dive_t *dive, dif_subsample_t *subsample, guint type, guint size, gconstpointer data);
+dif_subsample_t *dif_dive_subsample_set_setmarker(dif_dive_t *dive, dif_subsample_t *subsample, const gchar *setmarker);
 dif_sample_t *dif_dive_find_sample(dif_dive_t *dive, guint timestamp);
 dif_dive_t *dif_dive_add_alarm(dif_dive_t *dive, guint timestamp, dif_alarm_type_t type, gdouble level, gboolean hasLevel);
+dif_dive_t *dif_dive_add_alarms(dif_dive_t *dive, const dif_alarm_t *alarms, guint nalarms);
+void dif_dive_invalidate_index(dif_dive_t *dive);
+void dif_dive_invalidate_caches(dif_dive_t *dive);
+
+/* gas.c */
+dif_gasmix_type_t dif_gasmix_type(dif_gasmix_t *gasmix);
+const gchar *dif_gasmix_name(dif_gasmix_t *gasmix);
+guint dif_gas_intern(dif_gasmix_t *gasmix);
+const dif_gasmix_t *dif_gas_get(guint id);
+const gchar *dif_gas_name(guint id);
+guint dif_gas_count();
+
+/* arena.c */
+dif_arena_t *dif_arena_alloc();
+void dif_arena_free(dif_arena_t *arena);
+gpointer dif_arena_malloc0(dif_arena_t *arena, gsize size);
+gpointer dif_arena_memdup(dif_arena_t *arena, gconstpointer data, gsize size);
+gchar *dif_arena_strdup(dif_arena_t *arena, const gchar *str);
+
+/* compact.c */
+gboolean dif_fixed_from_double(gdouble value, guint scale, gint64 *fixed);
+dif_compact_samples_t *dif_dive_pack_samples(dif_dive_t *dive);
+dif_dive_t *dif_dive_unpack_samples(dif_dive_t *dive, const dif_compact_samples_t *compact);
+void dif_compact_samples_free(dif_compact_samples_t *compact);
+dif_dive_t *dif_dive_compact(dif_dive_t *dive);
+dif_dive_t *dif_dive_expand(dif_dive_t *dive);
+
+/* profile.c */
+const dif_profile_t *dif_dive_get_profile(dif_dive_t *dive);
+void dif_dive_invalidate_profile(dif_dive_t *dive);
+void dif_profile_free(dif_profile_t *profile);
+gint dif_profile_find_tank(const dif_profile_t *profile, guint tank);
+
+/* range.c */
+dif_sample_slice_t dif_dive_samples_in_range(dif_dive_t *dive, guint from, guint to);
+void dif_sample_cursor_init(dif_sample_cursor_t *cursor, dif_dive_t *dive, guint from, guint to, guint window);
+gboolean dif_sample_cursor_next(dif_sample_cursor_t *cursor, dif_sample_slice_t *slice);
+gdouble dif_sample_slice_get_initial_pressure(const dif_sample_slice_t *slice, gint tank);
+gint dif_sample_slice_get_initial_pressure_tank(const dif_sample_slice_t *slice);
+gdouble dif_sample_slice_get_final_pressure(const dif_sample_slice_t *slice, gint tank);
+gdouble dif_sample_slice_get_average_depth(const dif_sample_slice_t *slice);
+gdouble dif_sample_slice_get_greatest_depth(const dif_sample_slice_t *slice);
+gdouble dif_sample_slice_get_lowest_temperature(const dif_sample_slice_t *slice);
+
+/* days.c */
+const GArray *dif_dive_collection_get_days(dif_dive_collection_t *dc);
+void dif_dive_collection_invalidate_days(dif_dive_collection_t *dc);
+const dif_day_bucket_t *dif_dive_collection_find_day(dif_dive_collection_t *dc, gint64 day);
+guint dif_dive_collection_dives_between(dif_dive_collection_t *dc, gint64 fromDay, gint64 toDay, guint *first);
+
+/* summary.c */
+dif_dive_summary_t *dif_dive_compute_summary(dif_dive_t *dive);
+void dif_dive_summary_free(dif_dive_summary_t *summary);
+dif_dive_stats_t *dif_dive_stats_alloc();
+void dif_dive_stats_free(dif_dive_stats_t *stats);
+dif_dive_stats_t *dif_dive_get_stats(dif_dive_t *dive);
+void dif_dive_stats_sample_added(dif_dive_t *dive, dif_sample_t *sample);
+void dif_dive_stats_subsample_added(dif_dive_t *dive, dif_sample_t *sample, dif_subsample_t *subsample);
+void dif_dive_invalidate_stats(dif_dive_t *dive);
 
 /* uddf.c */
 xml_options_t *dif_xml_options_alloc();
@@ -273,6 +708,30 @@ void dif_xml_options_free(xml_options_t *options);
 void dif_save_dive_collection_uddf(dif_dive_collection_t *dc, gchar* filename);
 void dif_save_dive_collection_uddf_options(dif_dive_collection_t *dc, xml_options_t *options);
 
+/* emitter.c */
+dif_emitter_t *dif_emitter_open(const gchar *filename);
+dif_emitter_t *dif_emitter_open_compressed(const gchar *filename, dif_compression_t compression, gint level);
+dif_emitter_t *dif_emitter_new();
+gint dif_compression_max_level(dif_compression_t compression);
+void dif_emitter_reserve(dif_emitter_t *emitter, gsize n);
+void dif_emitter_write(dif_emitter_t *emitter, const gchar *data, gsize n);
+void dif_emitter_write_string(dif_emitter_t *emitter, const gchar *str);
+void dif_emitter_write_text(dif_emitter_t *emitter, const gchar *text);
+void dif_emitter_write_attribute(dif_emitter_t *emitter, const gchar *value);
+void dif_emitter_write_int(dif_emitter_t *emitter, gint64 value);
+void dif_emitter_write_double(dif_emitter_t *emitter, gdouble value, guint decimals);
+gboolean dif_emitter_flush(dif_emitter_t *emitter);
+gboolean dif_emitter_close(dif_emitter_t *emitter);
+
+/* format.c */
+gsize dif_format_fixed(gchar *buffer, gsize size, gdouble value, guint decimals);
+gsize dif_format_int(gchar *buffer, gsize size, gint64 value);
+
+/* memory.c */
+const gchar *dif_sample_type_name(dif_sample_type_t type);
+dif_memory_stats_t *dif_dive_collection_memory_stats(dif_dive_collection_t *dc);
+void dif_memory_stats_free(dif_memory_stats_t *stats);
+
 /* algos.c */
 dif_dive_collection_t *dif_alg_dc_initial_pressure_fix(dif_dive_collection_t *dc);
 dif_dive_t *dif_alg_dive_initial_pressure_fix(dif_dive_t *dive);
@@ -0,0 +1,338 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "dif.h"
+
+/* large enough that a file is written in a few big write() calls */
+#define EMITTER_BUFFER_SIZE (1024 * 1024)
+/* a memory emitter starts small, a single dive often fits */
+#define EMITTER_MEMORY_SIZE (16 * 1024)
+/* compressed output is collected in pieces this large before write() */
+#define EMITTER_PACKED_SIZE (256 * 1024)
+
+static dif_emitter_t *_dif_emitter_alloc(int fd, gsize size) {
+    dif_emitter_t *emitter = g_malloc0(sizeof(dif_emitter_t));
+    emitter->fd = fd;
+    emitter->size = size;
+    emitter->buffer = g_malloc(size);
+    return emitter;
+}
+
+/**
+ * create an emitter that writes to a file, replacing what was there
+ *
+ * @return the emitter, or NULL if the file could not be opened
+ */
+dif_emitter_t *dif_emitter_open(const gchar *filename) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return NULL;
+    }
+    return _dif_emitter_alloc(fd, EMITTER_BUFFER_SIZE);
+}
+
+/**
+ * the highest level a codec takes; levels start at 1
+ *
+ * @return 0 for DIF_COMPRESSION_NONE and for codecs that are not built in
+ */
+gint dif_compression_max_level(dif_compression_t compression) {
+    switch (compression) {
+    case DIF_COMPRESSION_GZIP:
+        return Z_BEST_COMPRESSION;
+#ifdef HAVE_ZSTD
+    case DIF_COMPRESSION_ZSTD:
+        return ZSTD_maxCLevel();
+#endif
+    default:
+        return 0;
+    }
+}
+
+static gpointer _dif_emitter_new_encoder(dif_compression_t compression, gint level) {
+    if (compression == DIF_COMPRESSION_GZIP) {
+        z_stream *stream = g_malloc0(sizeof(z_stream));
+        /* 16 more window bits ask for a gzip header rather than a zlib one */
+        if (deflateInit2(stream, level > 0 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            g_free(stream);
+            return NULL;
+        }
+        return stream;
+    }
+#ifdef HAVE_ZSTD
+    if (compression == DIF_COMPRESSION_ZSTD) {
+        ZSTD_CCtx *context = ZSTD_createCCtx();
+        if (context != NULL && level > 0 &&
+            ZSTD_isError(ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level))) {
+            ZSTD_freeCCtx(context);
+            return NULL;
+        }
+        return context;
+    }
+#endif
+    return NULL;
+}
+
+/**
+ * create an emitter that compresses everything it writes to a file
+ *
+ * only the compressed stream ever reaches the file. DIF_COMPRESSION_NONE
+ * is the same as dif_emitter_open.
+ *
+ * @param level: from 1 to dif_compression_max_level, or 0 for the default
+ * @return the emitter, or NULL if the file could not be opened or the
+ *         codec is not built in or does not take the level
+ */
+dif_emitter_t *dif_emitter_open_compressed(const gchar *filename, dif_compression_t compression, gint level) {
+    dif_emitter_t *emitter;
+
+    if (compression != DIF_COMPRESSION_NONE &&
+        (level < 0 || level > dif_compression_max_level(compression))) {
+        return NULL;
+    }
+    emitter = dif_emitter_open(filename);
+    if (emitter == NULL || compression == DIF_COMPRESSION_NONE) {
+        return emitter;
+    }
+    emitter->encoder = _dif_emitter_new_encoder(compression, level);
+    if (emitter->encoder == NULL) {
+        dif_emitter_close(emitter);
+        return NULL;
+    }
+    emitter->compression = compression;
+    emitter->packed = g_malloc(EMITTER_PACKED_SIZE);
+    return emitter;
+}
+
+/**
+ * create an emitter that collects everything in its buffer, which grows
+ * as needed and is never flushed
+ */
+dif_emitter_t *dif_emitter_new() {
+    return _dif_emitter_alloc(-1, EMITTER_MEMORY_SIZE);
+}
+
+static void _dif_emitter_write_fd(dif_emitter_t *emitter, const gchar *data, gsize n) {
+    while (n > 0 && !emitter->failed) {
+        ssize_t written = write(emitter->fd, data, n);
+        if (written < 0) {
+            if (errno != EINTR) {
+                emitter->failed = TRUE;
+            }
+            continue;
+        }
+        data += written;
+        n -= written;
+        emitter->flushed += written;
+    }
+}
+
+/**
+ * run n bytes through the codec and write what comes out of it; finish
+ * ends the compressed stream, after which nothing more can be written
+ */
+static void _dif_emitter_encode(dif_emitter_t *emitter, const gchar *data, gsize n, gboolean finish) {
+    if (emitter->compression == DIF_COMPRESSION_GZIP) {
+        z_stream *stream = emitter->encoder;
+        stream->next_in = (Bytef *) data;
+        stream->avail_in = n;
+        do {
+            stream->next_out = (Bytef *) emitter->packed;
+            stream->avail_out = EMITTER_PACKED_SIZE;
+            if (deflate(stream, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) {
+                emitter->failed = TRUE;
+                return;
+            }
+            _dif_emitter_write_fd(emitter, emitter->packed, EMITTER_PACKED_SIZE - stream->avail_out);
+        } while (stream->avail_out == 0);
+    }
+#ifdef HAVE_ZSTD
+    if (emitter->compression == DIF_COMPRESSION_ZSTD) {
+        ZSTD_inBuffer in = {data, n, 0};
+        gsize remaining;
+        do {
+            ZSTD_outBuffer out = {emitter->packed, EMITTER_PACKED_SIZE, 0};
+            remaining = ZSTD_compressStream2(emitter->encoder, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                emitter->failed = TRUE;
+                return;
+            }
+            _dif_emitter_write_fd(emitter, emitter->packed, out.pos);
+        } while (finish ? remaining > 0 : in.pos < in.size);
+    }
+#endif
+}
+
+/**
+ * write bytes to the file, through the codec if there is one
+ */
+static void _dif_emitter_sink(dif_emitter_t *emitter, const gchar *data, gsize n) {
+    if (emitter->encoder == NULL) {
+        _dif_emitter_write_fd(emitter, data, n);
+        return;
+    }
+    /* zlib counts its input in 32 bits */
+    while (n > 0 && !emitter->failed) {
+        gsize chunk = MIN(n, EMITTER_BUFFER_SIZE);
+        _dif_emitter_encode(emitter, data, chunk, FALSE);
+        data += chunk;
+        n -= chunk;
+    }
+}
+
+/**
+ * write out the buffer of a file emitter; a memory emitter keeps it
+ *
+ * @return FALSE if any write so far has failed
+ */
+gboolean dif_emitter_flush(dif_emitter_t *emitter) {
+    if (emitter->fd >= 0 && emitter->len > 0) {
+        _dif_emitter_sink(emitter, emitter->buffer, emitter->len);
+        emitter->len = 0;
+    }
+    return !emitter->failed;
+}
+
+/**
+ * make room for n more bytes after the end of the buffer
+ *
+ * a file emitter flushes; a memory emitter doubles its buffer. either way
+ * the buffer ends up at least n bytes larger than its contents.
+ */
+void dif_emitter_reserve(dif_emitter_t *emitter, gsize n) {
+    if (emitter->len + n <= emitter->size) {
+        return;
+    }
+    dif_emitter_flush(emitter);
+    while (emitter->len + n > emitter->size) {
+        emitter->size *= 2;
+    }
+    emitter->buffer = g_realloc(emitter->buffer, emitter->size);
+}
+
+void dif_emitter_write(dif_emitter_t *emitter, const gchar *data, gsize n) {
+    if (emitter->len + n > emitter->size) {
+        if (emitter->fd >= 0 && n >= emitter->size) {
+            /* nothing to gain from copying a block this large */
+            dif_emitter_flush(emitter);
+            _dif_emitter_sink(emitter, data, n);
+            return;
+        }
+        dif_emitter_reserve(emitter, n);
+    }
+    memcpy(emitter->buffer + emitter->len, data, n);
+    emitter->len += n;
+}
+
+void dif_emitter_write_string(dif_emitter_t *emitter, const gchar *str) {
+    dif_emitter_write(emitter, str, strlen(str));
+}
+
+/**
+ * write free text, escaping it the way libxml2 escapes element content
+ */
+void dif_emitter_write_text(dif_emitter_t *emitter, const gchar *text) {
+    const gchar *run = text;
+    const gchar *c;
+    for (c = text; *c != '\0'; c++) {
+        const gchar *entity;
+        switch (*c) {
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '&': entity = "&amp;"; break;
+        case '\r': entity = "&#13;"; break;
+        default: continue;
+        }
+        dif_emitter_write(emitter, run, c - run);
+        dif_emitter_write_string(emitter, entity);
+        run = c + 1;
+    }
+    dif_emitter_write(emitter, run, c - run);
+}
+
+/**
+ * write an attribute value, escaping it the way libxml2 escapes attributes
+ */
+void dif_emitter_write_attribute(dif_emitter_t *emitter, const gchar *value) {
+    const gchar *run = value;
+    const gchar *c;
+    for (c = value; *c != '\0'; c++) {
+        const gchar *entity;
+        switch (*c) {
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '&': entity = "&amp;"; break;
+        case '"': entity = "&quot;"; break;
+        case '\n': entity = "&#10;"; break;
+        case '\r': entity = "&#13;"; break;
+        case '\t': entity = "&#9;"; break;
+        default: continue;
+        }
+        dif_emitter_write(emitter, run, c - run);
+        dif_emitter_write_string(emitter, entity);
+        run = c + 1;
+    }
+    dif_emitter_write(emitter, run, c - run);
+}
+
+void dif_emitter_write_int(dif_emitter_t *emitter, gint64 value) {
+    dif_emitter_reserve(emitter, 24);
+    emitter->len += dif_format_int(emitter->buffer + emitter->len, emitter->size - emitter->len, value);
+}
+
+/**
+ * write a number with a fixed number of decimals, as "%.Nf" prints it
+ */
+void dif_emitter_write_double(dif_emitter_t *emitter, gdouble value, guint decimals) {
+    /* the longest double printed with %f has 309 digits before the point */
+    dif_emitter_reserve(emitter, 320 + decimals);
+    emitter->len += dif_format_fixed(emitter->buffer + emitter->len, emitter->size - emitter->len,
+                                     value, decimals);
+}
+
+/**
+ * end the compressed stream of an emitter and drop the codec
+ */
+static void _dif_emitter_finish(dif_emitter_t *emitter) {
+    if (!emitter->failed) {
+        _dif_emitter_encode(emitter, NULL, 0, TRUE);
+    }
+    if (emitter->compression == DIF_COMPRESSION_GZIP) {
+        deflateEnd(emitter->encoder);
+        g_free(emitter->encoder);
+    }
+#ifdef HAVE_ZSTD
+    if (emitter->compression == DIF_COMPRESSION_ZSTD) {
+        ZSTD_freeCCtx(emitter->encoder);
+    }
+#endif
+    emitter->encoder = NULL;
+    g_free(emitter->packed);
+}
+
+/**
+ * flush and close the emitter and free it
+ *
+ * @return FALSE if anything could not be written
+ */
+gboolean dif_emitter_close(dif_emitter_t *emitter) {
+    gboolean ok;
+    dif_emitter_flush(emitter);
+    if (emitter->encoder != NULL) {
+        _dif_emitter_finish(emitter);
+    }
+    ok = !emitter->failed;
+    if (emitter->fd >= 0 && close(emitter->fd) != 0) {
+        ok = FALSE;
+    }
+    g_free(emitter->buffer);
+    g_free(emitter);
+    return ok;
+}
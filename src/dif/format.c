@@ -0,0 +1,115 @@
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include "dif.h"
+
+/* more decimals than the serializer uses go through printf */
+#define FORMAT_MAX_DECIMALS 9
+/* room for a sign, 19 digits, a point and the terminator */
+#define FORMAT_DIGITS 24
+
+static const guint _scales[FORMAT_MAX_DECIMALS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static const gchar _digitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/**
+ * write the digits of value so they end right before end, two at a time
+ *
+ * @return where the digits start
+ */
+static gchar *_dif_format_digits(gchar *end, guint64 value) {
+    while (value >= 100) {
+        guint pair = value % 100;
+        value /= 100;
+        end -= 2;
+        memcpy(end, _digitPairs + pair * 2, 2);
+    }
+    if (value >= 10) {
+        end -= 2;
+        memcpy(end, _digitPairs + value * 2, 2);
+    } else {
+        *--end = '0' + value;
+    }
+    return end;
+}
+
+static gsize _dif_format_copy(gchar *buffer, const gchar *start, const gchar *end) {
+    gsize len = end - start;
+    memcpy(buffer, start, len);
+    buffer[len] = '\0';
+    return len;
+}
+
+/**
+ * print value with a fixed number of decimals, the same as "%.Nf" does
+ *
+ * the value is rounded to an integer count of 10^-N with
+ * dif_fixed_from_double, which settles ties the way printf does, and
+ * that integer is printed two digits at a time. values it cannot
+ * represent, and more than 9 decimals, are left to g_snprintf.
+ *
+ * @param size: size of buffer; the fast path needs at least 24 bytes
+ * @return the length of the output, as returned by g_snprintf
+ */
+gsize dif_format_fixed(gchar *buffer, gsize size, gdouble value, guint decimals) {
+    gchar digits[FORMAT_DIGITS];
+    gchar *end = digits + sizeof(digits);
+    gchar *c = end;
+    gint64 fixed;
+    guint64 magnitude, fraction;
+    guint i;
+
+    if (decimals > FORMAT_MAX_DECIMALS || size < FORMAT_DIGITS ||
+        !dif_fixed_from_double(value, _scales[decimals], &fixed)) {
+        return g_snprintf(buffer, size, "%.*f", decimals, value);
+    }
+    magnitude = fixed < 0 ? -(guint64) fixed : (guint64) fixed;
+    if (decimals > 0) {
+        fraction = magnitude % _scales[decimals];
+        magnitude /= _scales[decimals];
+        for (i = 0; i < decimals; i++) {
+            *--c = '0' + fraction % 10;
+            fraction /= 10;
+        }
+        *--c = '.';
+    }
+    c = _dif_format_digits(c, magnitude);
+    /* printf keeps the sign of values that round to zero, -0.001 is -0.00 */
+    if (signbit(value)) {
+        *--c = '-';
+    }
+    return _dif_format_copy(buffer, c, end);
+}
+
+/**
+ * print an integer, the same as "%" G_GINT64_FORMAT does
+ *
+ * @param size: size of buffer; the fast path needs at least 24 bytes
+ * @return the length of the output, as returned by g_snprintf
+ */
+gsize dif_format_int(gchar *buffer, gsize size, gint64 value) {
+    gchar digits[FORMAT_DIGITS];
+    gchar *end = digits + sizeof(digits);
+    gchar *c;
+
+    if (size < FORMAT_DIGITS) {
+        return g_snprintf(buffer, size, "%" G_GINT64_FORMAT, value);
+    }
+    c = _dif_format_digits(end, value < 0 ? -(guint64) value : (guint64) value);
+    if (value < 0) {
+        *--c = '-';
+    }
+    return _dif_format_copy(buffer, c, end);
+}
@@ -0,0 +1,143 @@
+#include <math.h>
+#include <glib.h>
+#include "dif.h"
+
+/* longest name of a mix, including the terminating NUL */
+#define GAS_NAME_LENGTH 26
+
+/**
+ * the gas table interns every distinct mix once, much like GQuark does for
+ * strings. two mixes are the same when they get the same name, which is
+ * also their id in the gasdefinitions of a UDDF file.
+ */
+static GMutex gasLock;
+static GPtrArray *gasMixes = NULL;
+static GHashTable *gasIndex = NULL;
+
+static const gchar *gasNames[] = {
+    [DIF_GASMIX_AIR] = "air",
+    [DIF_GASMIX_EANX30] = "eanx30",
+    [DIF_GASMIX_EANX31] = "eanx31",
+    [DIF_GASMIX_EANX32] = "eanx32",
+    [DIF_GASMIX_EANX33] = "eanx33",
+    [DIF_GASMIX_EANX34] = "eanx34",
+    [DIF_GASMIX_EANX35] = "eanx35",
+    [DIF_GASMIX_EANX36] = "eanx36",
+    [DIF_GASMIX_EANX37] = "eanx37",
+    [DIF_GASMIX_EANX38] = "eanx38",
+    [DIF_GASMIX_EANX39] = "eanx39",
+    [DIF_GASMIX_EANX40] = "eanx40",
+    [DIF_GASMIX_OXYGEN100] = "pureoxygen",
+};
+
+/**
+ * given a gasmix, return the type of the gasmix
+ *
+ * every standard mix is a whole percentage of oxygen with the rest
+ * nitrogen, so rounding the oxygen picks the only candidate and a single
+ * tolerance check decides
+ */
+dif_gasmix_type_t dif_gasmix_type(dif_gasmix_t *gasmix) {
+    gdouble o2 = round(gasmix->oxygen);
+    if (ABS(gasmix->oxygen - o2) < GAS_EPSILON &&
+        ABS(gasmix->nitrogen - (100.0 - o2)) < GAS_EPSILON &&
+        ABS(gasmix->helium) < GAS_EPSILON &&
+        ABS(gasmix->argon) < GAS_EPSILON &&
+        ABS(gasmix->hydrogen) < GAS_EPSILON) {
+        if (o2 == 21.0) {
+            return DIF_GASMIX_AIR;
+        } else if (o2 >= 30.0 && o2 <= 40.0) {
+            return DIF_GASMIX_EANX30 + (gint) o2 - 30;
+        } else if (o2 == 100.0) {
+            return DIF_GASMIX_OXYGEN100;
+        }
+    }
+    return DIF_GASMIX_UNKNOWN;
+}
+
+/**
+ * intern a gasmix in the gas table
+ *
+ * the composition is copied, so the caller keeps ownership of gasmix. the
+ * first mix seen under a name is the one kept for that name.
+ *
+ * @return the id of the mix, for dif_gas_get and dif_gas_name
+ */
+guint dif_gas_intern(dif_gasmix_t *gasmix) {
+    dif_gasmix_type_t type = dif_gasmix_type(gasmix);
+    gchar buffer[GAS_NAME_LENGTH];
+    const gchar *name;
+    dif_gasmix_t *interned;
+    gpointer existing;
+    guint id;
+
+    if (type != DIF_GASMIX_UNKNOWN) {
+        name = gasNames[type];
+    } else {
+        g_snprintf(buffer, GAS_NAME_LENGTH, "mix_%02do2_%02dn2%02dhe%02dar%02dh2",
+                (gint)gasmix->oxygen, (gint)gasmix->nitrogen,
+                (gint)gasmix->helium, (gint)gasmix->argon,
+                (gint)gasmix->hydrogen);
+        name = buffer;
+    }
+
+    g_mutex_lock(&gasLock);
+    if (gasIndex == NULL) {
+        gasMixes = g_ptr_array_new();
+        gasIndex = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    if (g_hash_table_lookup_extended(gasIndex, name, NULL, &existing)) {
+        id = GPOINTER_TO_UINT(existing);
+    } else {
+        id = gasMixes->len;
+        interned = g_new(dif_gasmix_t, 1);
+        *interned = *gasmix;
+        interned->id = id;
+        interned->type = type;
+        interned->name = type != DIF_GASMIX_UNKNOWN ? name : g_strdup(name);
+        g_ptr_array_add(gasMixes, interned);
+        g_hash_table_insert(gasIndex, (gpointer) interned->name, GUINT_TO_POINTER(id));
+    }
+    g_mutex_unlock(&gasLock);
+    return id;
+}
+
+/**
+ * given a gas id, get the interned mix
+ *
+ * the mix lives as long as the program and must not be modified or freed
+ */
+const dif_gasmix_t *dif_gas_get(guint id) {
+    const dif_gasmix_t *gasmix = NULL;
+    g_mutex_lock(&gasLock);
+    if (gasMixes != NULL && id < gasMixes->len) {
+        gasmix = g_ptr_array_index(gasMixes, id);
+    }
+    g_mutex_unlock(&gasLock);
+    return gasmix;
+}
+
+const gchar *dif_gas_name(guint id) {
+    const dif_gasmix_t *gasmix = dif_gas_get(id);
+    return gasmix != NULL ? gasmix->name : NULL;
+}
+
+/**
+ * @return the number of mixes interned so far; ids are below this
+ */
+guint dif_gas_count() {
+    guint count;
+    g_mutex_lock(&gasLock);
+    count = gasMixes != NULL ? gasMixes->len : 0;
+    g_mutex_unlock(&gasLock);
+    return count;
+}
+
+/**
+ * given a gasmix, get its name, which is also its id in a UDDF file
+ *
+ * the name belongs to the gas table and must not be freed
+ */
+const gchar *dif_gasmix_name(dif_gasmix_t *gasmix) {
+    return dif_gas_name(dif_gas_intern(gasmix));
+}
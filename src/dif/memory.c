@@ -0,0 +1,145 @@
+#include <string.h>
+#include <glib.h>
+#include "dif.h"
+
+/* GHashTable keeps a key, a value and a hash per entry */
+#define HASH_ENTRY_BYTES (2 * sizeof(gpointer) + sizeof(guint))
+/* a presence bitmap over n rows, see profile.c */
+#define BITMAP_BYTES(n) ((((n) + 31) / 32) * sizeof(guint32))
+
+static const gchar *_sampleTypeNames[] = {
+    "undefined", "time", "depth", "pressure", "temperature", "event", "rbt",
+    "heartbeat", "bearing", "vendor", "alarm", "setmarker"
+};
+
+const gchar *dif_sample_type_name(dif_sample_type_t type) {
+    if (type < 0 || type >= G_N_ELEMENTS(_sampleTypeNames)) {
+        return NULL;
+    }
+    return _sampleTypeNames[type];
+}
+
+static void _dif_memory_add(dif_memory_category_t *category, gsize count, gsize bytes) {
+    category->count += count;
+    category->bytes += bytes;
+}
+
+static gsize _dif_profile_bytes(const dif_profile_t *profile) {
+    gsize n = MAX(profile->nrows, 1);
+    gsize bytes = sizeof(dif_profile_t);
+    bytes += n * (sizeof(guint) * 5 + sizeof(gdouble) * 2);
+    bytes += BITMAP_BYTES(n) * 6;
+    bytes += profile->ntanks * (sizeof(dif_profile_tank_t) + n * sizeof(gdouble) + BITMAP_BYTES(n));
+    return bytes;
+}
+
+/**
+ * fold one dive into the memory statistics
+ *
+ * objects carved from the dive's arena are counted in their categories
+ * but only the arena itself goes into the total, so nothing is counted
+ * twice. likewise a source buffer shared by several dives is counted once,
+ * through sources.
+ */
+static void _dif_dive_memory_stats(dif_memory_stats_t *stats, GHashTable *sources, dif_dive_t *dive) {
+    guint i, j;
+    gsize heapBytes = sizeof(GPtrArray) + dive->samples->len * sizeof(gpointer) +
+                      sizeof(GArray) + dive->gasmixes->len * sizeof(guint);
+
+    _dif_memory_add(&stats->dives, 1, sizeof(dif_dive_t));
+    _dif_memory_add(&stats->pointerArrays, 2, heapBytes);
+
+    for (i = 0; i < dive->samples->len; i++) {
+        dif_sample_t *sample = g_ptr_array_index(dive->samples, i);
+        gsize arrayBytes = sample->subsampleCapacity * sizeof(dif_subsample_t *);
+        _dif_memory_add(&stats->samples, 1, sizeof(dif_sample_t));
+        if (sample->subsampleCapacity > 0) {
+            _dif_memory_add(&stats->pointerArrays, 1, arrayBytes);
+        }
+        if (sample->owner == DIF_OWNER_HEAP) {
+            heapBytes += sizeof(dif_sample_t) + arrayBytes;
+        }
+        for (j = 0; j < sample->nsubsamples; j++) {
+            dif_subsample_t *ss = sample->subsamples[j];
+            gsize payload = 0;
+            _dif_memory_add(&stats->subsamples[ss->type], 1, sizeof(dif_subsample_t));
+            if (ss->type == DIF_SAMPLE_VENDOR &&
+                dif_dive_source_contains(dive, ss->value.vendor.data, ss->value.vendor.size)) {
+                _dif_memory_add(&stats->vendorViews, 1, ss->value.vendor.size);
+            } else if (ss->type == DIF_SAMPLE_VENDOR && ss->value.vendor.data != NULL) {
+                payload = ss->value.vendor.size;
+                _dif_memory_add(&stats->vendorBlobs, 1, payload);
+            } else if (ss->type == DIF_SAMPLE_SETMARKER && ss->value.setmarker != NULL) {
+                payload = strlen(ss->value.setmarker) + 1;
+                _dif_memory_add(&stats->setmarkers, 1, payload);
+            }
+            if (ss->owner == DIF_OWNER_HEAP) {
+                heapBytes += sizeof(dif_subsample_t) + payload;
+            }
+        }
+    }
+
+    if (dive->arena != NULL) {
+        _dif_memory_add(&stats->arenas, dive->arena->nblocks, dive->arena->bytesAllocated);
+        stats->arenaBytesUsed += dive->arena->bytesUsed;
+    }
+    if (dive->source != NULL && g_hash_table_add(sources, dive->source)) {
+        _dif_memory_add(&stats->sources, 1, g_bytes_get_size(dive->source));
+    }
+    if (dive->compact != NULL) {
+        _dif_memory_add(&stats->compactRows, dive->compact->nrows,
+                        sizeof(dif_compact_samples_t) + dive->compact->arena->bytesAllocated);
+    }
+    if (dive->profile != NULL) {
+        _dif_memory_add(&stats->caches, 1, _dif_profile_bytes(dive->profile));
+    }
+    if (dive->sampleIndex != NULL) {
+        _dif_memory_add(&stats->caches, 1, g_hash_table_size(dive->sampleIndex) * HASH_ENTRY_BYTES);
+    }
+    if (dive->stats != NULL) {
+        _dif_memory_add(&stats->caches, 1,
+                        sizeof(dif_dive_stats_t) + dive->stats->tanks->len * sizeof(dif_tank_stats_t));
+    }
+    stats->heapBytes += heapBytes;
+}
+
+/**
+ * given a collection, report where its memory goes
+ *
+ * byte counts are what the structures need; allocator overhead and the
+ * spare capacity of glib arrays are not included, so treat the numbers as
+ * a close lower bound. the gas table is shared by every collection and is
+ * reported in full, as is every source buffer a dive retains.
+ *
+ * @return a newly allocated report, free with dif_memory_stats_free
+ */
+dif_memory_stats_t *dif_dive_collection_memory_stats(dif_dive_collection_t *dc) {
+    dif_memory_stats_t *stats = g_new0(dif_memory_stats_t, 1);
+    GHashTable *sources = g_hash_table_new(NULL, NULL);
+    guint i, ngases;
+
+    stats->heapBytes = sizeof(GPtrArray) + dc->dives->len * sizeof(gpointer);
+    _dif_memory_add(&stats->pointerArrays, 1, stats->heapBytes);
+    for (i = 0; i < dc->dives->len; i++) {
+        _dif_dive_memory_stats(stats, sources, g_ptr_array_index(dc->dives, i));
+    }
+    g_hash_table_destroy(sources);
+    if (dc->days != NULL) {
+        _dif_memory_add(&stats->caches, 1, sizeof(GArray) + dc->days->len * sizeof(dif_day_bucket_t));
+    }
+
+    ngases = dif_gas_count();
+    for (i = 0; i < ngases; i++) {
+        const dif_gasmix_t *gasmix = dif_gas_get(i);
+        _dif_memory_add(&stats->gasmixes, 1, sizeof(dif_gasmix_t) + strlen(gasmix->name) + 1 + HASH_ENTRY_BYTES);
+    }
+
+    stats->totalBytes = sizeof(dif_dive_collection_t) + stats->dives.bytes + stats->arenas.bytes +
+                        stats->heapBytes + stats->compactRows.bytes + stats->caches.bytes +
+                        stats->gasmixes.bytes + stats->sources.bytes;
+    return stats;
+}
+
+void dif_memory_stats_free(dif_memory_stats_t *stats) {
+    g_free(stats);
+}
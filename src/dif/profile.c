@@ -0,0 +1,182 @@
+#include <glib.h>
+#include "dif.h"
+
+/* number of guint32 words needed for a presence bitmap over n rows */
+#define BITMAP_WORDS(n) (((n) + 31) / 32)
+#define BITMAP_SET(bitmap, row) ((bitmap)[(row) >> 5] |= (1u << ((row) & 31)))
+
+/**
+ * find the pressure column for a tank, creating it if this is the first
+ * time the tank shows up in the dive
+ */
+static guint _dif_profile_tank_column(dif_profile_t *profile, guint tank) {
+    guint i;
+    for (i = 0; i < profile->ntanks; i++) {
+        if (profile->tanks[i].tank == tank) {
+            return i;
+        }
+    }
+    profile->tanks = g_renew(dif_profile_tank_t, profile->tanks, profile->ntanks + 1);
+    profile->tanks[i].tank = tank;
+    profile->tanks[i].pressure = g_new0(gdouble, MAX(profile->nrows, 1));
+    profile->tanks[i].present = g_new0(guint32, BITMAP_WORDS(MAX(profile->nrows, 1)));
+    profile->ntanks++;
+    return i;
+}
+
+/**
+ * build the columnar view of a dive from its samples
+ *
+ * the samples are sorted first so that row order is timestamp order. when a
+ * sample carries more than one subsample of a channel the first one wins,
+ * which is what dif_sample_get_subsample returns; pressures are split by
+ * tank so a second transmitter in the same sample gets its own column.
+ */
+static dif_profile_t *_dif_profile_build(dif_dive_t *dive) {
+    dif_profile_t *profile = g_new0(dif_profile_t, 1);
+    guint n, words, row;
+
+    dive = dif_dive_sort_samples(dive);
+    n = dive->samples->len;
+    words = BITMAP_WORDS(MAX(n, 1));
+    profile->nrows = n;
+    profile->timestamp = g_new0(guint, MAX(n, 1));
+    profile->depth = g_new0(gdouble, MAX(n, 1));
+    profile->depthPresent = g_new0(guint32, words);
+    profile->temperature = g_new0(gdouble, MAX(n, 1));
+    profile->temperaturePresent = g_new0(guint32, words);
+    profile->rbt = g_new0(guint, MAX(n, 1));
+    profile->rbtPresent = g_new0(guint32, words);
+    profile->heartbeat = g_new0(guint, MAX(n, 1));
+    profile->heartbeatPresent = g_new0(guint32, words);
+    profile->bearing = g_new0(guint, MAX(n, 1));
+    profile->bearingPresent = g_new0(guint32, words);
+    profile->pressureTank = g_new0(guint, MAX(n, 1));
+    profile->pressurePresent = g_new0(guint32, words);
+
+    for (row = 0; row < n; row++) {
+        dif_sample_t *sample = g_ptr_array_index(dive->samples, row);
+        guint i;
+        profile->timestamp[row] = sample->timestamp;
+        for (i = 0; i < sample->nsubsamples; i++) {
+            dif_subsample_t *ss = sample->subsamples[i];
+            switch (ss->type) {
+            case DIF_SAMPLE_DEPTH:
+                if (!DIF_PROFILE_HAS(profile->depthPresent, row)) {
+                    profile->depth[row] = ss->value.depth;
+                    BITMAP_SET(profile->depthPresent, row);
+                }
+                break;
+            case DIF_SAMPLE_TEMPERATURE:
+                if (!DIF_PROFILE_HAS(profile->temperaturePresent, row)) {
+                    profile->temperature[row] = ss->value.temperature;
+                    BITMAP_SET(profile->temperaturePresent, row);
+                }
+                break;
+            case DIF_SAMPLE_RBT:
+                if (!DIF_PROFILE_HAS(profile->rbtPresent, row)) {
+                    profile->rbt[row] = ss->value.rbt;
+                    BITMAP_SET(profile->rbtPresent, row);
+                }
+                break;
+            case DIF_SAMPLE_HEARTBEAT:
+                if (!DIF_PROFILE_HAS(profile->heartbeatPresent, row)) {
+                    profile->heartbeat[row] = ss->value.heartbeat;
+                    BITMAP_SET(profile->heartbeatPresent, row);
+                }
+                break;
+            case DIF_SAMPLE_BEARING:
+                if (!DIF_PROFILE_HAS(profile->bearingPresent, row)) {
+                    profile->bearing[row] = ss->value.bearing;
+                    BITMAP_SET(profile->bearingPresent, row);
+                }
+                break;
+            case DIF_SAMPLE_PRESSURE:
+            {
+                guint col = _dif_profile_tank_column(profile, ss->value.pressure.tank);
+                dif_profile_tank_t *tank = &profile->tanks[col];
+                if (!DIF_PROFILE_HAS(tank->present, row)) {
+                    tank->pressure[row] = ss->value.pressure.value;
+                    BITMAP_SET(tank->present, row);
+                }
+                if (!DIF_PROFILE_HAS(profile->pressurePresent, row)) {
+                    profile->pressureTank[row] = col;
+                    BITMAP_SET(profile->pressurePresent, row);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+    return profile;
+}
+
+void dif_profile_free(dif_profile_t *profile) {
+    guint i;
+    if (profile == NULL) {
+        return;
+    }
+    for (i = 0; i < profile->ntanks; i++) {
+        g_free(profile->tanks[i].pressure);
+        g_free(profile->tanks[i].present);
+    }
+    g_free(profile->tanks);
+    g_free(profile->timestamp);
+    g_free(profile->depth);
+    g_free(profile->depthPresent);
+    g_free(profile->temperature);
+    g_free(profile->temperaturePresent);
+    g_free(profile->rbt);
+    g_free(profile->rbtPresent);
+    g_free(profile->heartbeat);
+    g_free(profile->heartbeatPresent);
+    g_free(profile->bearing);
+    g_free(profile->bearingPresent);
+    g_free(profile->pressureTank);
+    g_free(profile->pressurePresent);
+    g_free(profile);
+}
+
+/**
+ * given a dive, get its columnar profile, building it if needed
+ *
+ * the profile is a cache owned by the dive: it stays valid until the dive's
+ * samples change, and must not be freed by the caller
+ */
+const dif_profile_t *dif_dive_get_profile(dif_dive_t *dive) {
+    if (dive->profile == NULL) {
+        dive->profile = _dif_profile_build(dive);
+    }
+    return dive->profile;
+}
+
+/**
+ * drop the cached profile of a dive so the next query rebuilds it
+ *
+ * adding samples or subsamples through the dif API does this automatically;
+ * code that edits subsample values in place should call
+ * dif_dive_invalidate_caches, which also drops the running statistics
+ */
+void dif_dive_invalidate_profile(dif_dive_t *dive) {
+    if (dive != NULL && dive->profile != NULL) {
+        dif_profile_free(dive->profile);
+        dive->profile = NULL;
+    }
+}
+
+/**
+ * find the pressure column for a tank in a built profile
+ *
+ * @return the column index, or -1 if the tank never reported a pressure
+ */
+gint dif_profile_find_tank(const dif_profile_t *profile, guint tank) {
+    guint i;
+    for (i = 0; i < profile->ntanks; i++) {
+        if (profile->tanks[i].tank == tank) {
+            return i;
+        }
+    }
+    return -1;
+}
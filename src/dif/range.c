@@ -0,0 +1,268 @@
+#include <glib.h>
+#include "dif.h"
+
+/**
+ * first row in [lo, hi) whose timestamp is at least timestamp, or hi
+ */
+static guint _dif_profile_lower_bound(const dif_profile_t *profile, guint lo, guint hi, guint timestamp) {
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (profile->timestamp[mid] < timestamp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static dif_sample_slice_t _dif_slice(dif_dive_t *dive, const dif_profile_t *profile,
+                                     guint first, guint end, guint from, guint to) {
+    dif_sample_slice_t slice;
+    slice.dive = dive;
+    slice.profile = profile;
+    slice.samples = dive->samples->pdata != NULL ? (dif_sample_t **) dive->samples->pdata + first : NULL;
+    slice.first = first;
+    slice.n = end - first;
+    slice.from = from;
+    slice.to = to;
+    return slice;
+}
+
+/**
+ * given a dive, get its samples with from <= timestamp < to
+ *
+ * the dive is sorted and its profile built if needed, then the range is
+ * found with two binary searches over the timestamp column. the slice
+ * points into the dive's own arrays, so nothing is copied; it stays valid
+ * until the samples of the dive change. pass G_MAXUINT as to for every
+ * sample from from on.
+ */
+dif_sample_slice_t dif_dive_samples_in_range(dif_dive_t *dive, guint from, guint to) {
+    const dif_profile_t *profile = dif_dive_get_profile(dive);
+    guint first = _dif_profile_lower_bound(profile, 0, profile->nrows, from);
+    guint end = to == G_MAXUINT ? profile->nrows :
+                _dif_profile_lower_bound(profile, first, profile->nrows, MAX(from, to));
+    return _dif_slice(dive, profile, first, end, from, to);
+}
+
+/**
+ * walk the samples with from <= timestamp < to in windows of window seconds
+ *
+ * a window of 0 yields the whole range as one slice. as with
+ * dif_dive_samples_in_range, G_MAXUINT as to runs to the last sample.
+ */
+void dif_sample_cursor_init(dif_sample_cursor_t *cursor, dif_dive_t *dive, guint from, guint to, guint window) {
+    dif_sample_slice_t range = dif_dive_samples_in_range(dive, from, to);
+    if (to == G_MAXUINT) {
+        /* stop right after the last sample instead of at the end of time */
+        guint last = range.n > 0 ? range.profile->timestamp[range.first + range.n - 1] : from;
+        to = range.n > 0 && last < G_MAXUINT ? last + 1 : MAX(from, last);
+    }
+    cursor->dive = dive;
+    cursor->start = from;
+    cursor->to = to;
+    cursor->window = window;
+    cursor->row = range.first;
+    cursor->end = range.first + range.n;
+    cursor->done = from >= to;
+}
+
+/**
+ * get the next window of a cursor
+ *
+ * windows follow each other without gaps, so a window without samples
+ * comes back with n of 0. each window is found with a binary search that
+ * starts where the previous one ended.
+ *
+ * @return FALSE once the range is used up, leaving slice alone
+ */
+gboolean dif_sample_cursor_next(dif_sample_cursor_t *cursor, dif_sample_slice_t *slice) {
+    const dif_profile_t *profile;
+    guint stop, end;
+    if (cursor->done) {
+        return FALSE;
+    }
+    profile = dif_dive_get_profile(cursor->dive);
+    if (cursor->window == 0 || cursor->to - cursor->start <= cursor->window) {
+        stop = cursor->to;
+        end = cursor->end;
+        cursor->done = TRUE;
+    } else {
+        stop = cursor->start + cursor->window;
+        end = _dif_profile_lower_bound(profile, cursor->row, cursor->end, stop);
+    }
+    *slice = _dif_slice(cursor->dive, profile, cursor->row, end, cursor->start, stop);
+    cursor->row = end;
+    cursor->start = stop;
+    return TRUE;
+}
+
+/**
+ * the first pressure of a row if it is valid and of the tank in column
+ * col, or any tank for -1; 0.0 otherwise
+ */
+static gdouble _dif_slice_row_pressure(const dif_profile_t *profile, guint row, gint col) {
+    gdouble pressure;
+    if (!DIF_PROFILE_HAS(profile->pressurePresent, row) ||
+        (col >= 0 && profile->pressureTank[row] != (guint) col)) {
+        return 0.0;
+    }
+    pressure = profile->tanks[profile->pressureTank[row]].pressure[row];
+    return pressure > GAS_EPSILON ? pressure : 0.0;
+}
+
+/**
+ * given a slice, get its first valid pressure
+ *
+ * like dif_sample_get_subsample, only the first pressure of a sample
+ * counts, also when looking for a particular tank: a sample where another
+ * tank is listed first has no reading for it.
+ *
+ * @param tank: the id of the tank to scan for. Using -1 gets the first valid tank
+ * @return: the first valid pressure, or 0.0 if not found
+ */
+gdouble dif_sample_slice_get_initial_pressure(const dif_sample_slice_t *slice, gint tank) {
+    const dif_profile_t *profile = slice->profile;
+    gint col = tank < 0 ? -1 : dif_profile_find_tank(profile, tank);
+    guint row, end = slice->first + slice->n;
+    if (tank >= 0 && col < 0) {
+        return 0.0;
+    }
+    for (row = slice->first; row < end; row++) {
+        gdouble pressure = _dif_slice_row_pressure(profile, row, col);
+        if (pressure > GAS_EPSILON) {
+            return pressure;
+        }
+    }
+    return 0.0;
+}
+
+/**
+ * given a slice, get the tank id of its first valid pressure sample
+ *
+ * @return: the tank id, or -1 if the slice has no valid pressure samples
+ */
+gint dif_sample_slice_get_initial_pressure_tank(const dif_sample_slice_t *slice) {
+    const dif_profile_t *profile = slice->profile;
+    guint row, end = slice->first + slice->n;
+    for (row = slice->first; row < end; row++) {
+        if (DIF_PROFILE_HAS(profile->pressurePresent, row)) {
+            const dif_profile_tank_t *column = &profile->tanks[profile->pressureTank[row]];
+            if (column->pressure[row] > GAS_EPSILON) {
+                return column->tank;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * given a slice, get its last valid pressure
+ *
+ * the same readings count as for dif_sample_slice_get_initial_pressure
+ *
+ * @param tank: the id of the tank to scan for. Using -1 gets the first valid tank
+ * @return: the last valid pressure, or 0.0 if not found
+ */
+gdouble dif_sample_slice_get_final_pressure(const dif_sample_slice_t *slice, gint tank) {
+    const dif_profile_t *profile = slice->profile;
+    gint col = tank < 0 ? -1 : dif_profile_find_tank(profile, tank);
+    guint row;
+    if (tank >= 0 && col < 0) {
+        return 0.0;
+    }
+    for (row = slice->first + slice->n; row > slice->first; row--) {
+        gdouble pressure = _dif_slice_row_pressure(profile, row - 1, col);
+        if (pressure > GAS_EPSILON) {
+            return pressure;
+        }
+    }
+    return 0.0;
+}
+
+/**
+ * given a slice, compute the time-weighted average depth from its depth
+ * samples using trapezoidal integration over the sample timestamps
+ *
+ * @return: the average depth in meters, or 0.0 if there are no depth samples
+ */
+gdouble dif_sample_slice_get_average_depth(const dif_sample_slice_t *slice) {
+    const dif_profile_t *profile = slice->profile;
+    guint row, end = slice->first + slice->n;
+    gdouble area = 0.0;
+    gdouble depthSum = 0.0;
+    guint nDepths = 0;
+    gdouble prevDepth = 0.0;
+    guint prevTimestamp = 0;
+    guint firstTimestamp = 0;
+    guint lastTimestamp = 0;
+    for (row = slice->first; row < end; row++) {
+        if (DIF_PROFILE_HAS(profile->depthPresent, row)) {
+            gdouble depth = profile->depth[row];
+            guint timestamp = profile->timestamp[row];
+            if (nDepths == 0) {
+                firstTimestamp = timestamp;
+            } else {
+                area += (prevDepth + depth) / 2.0 * (timestamp - prevTimestamp);
+            }
+            lastTimestamp = timestamp;
+            prevDepth = depth;
+            prevTimestamp = timestamp;
+            depthSum += depth;
+            nDepths++;
+        }
+    }
+    if (nDepths == 0) {
+        return 0.0;
+    }
+    if (lastTimestamp == firstTimestamp) {
+        /* single depth sample or zero elapsed time, fall back to a simple mean */
+        return depthSum / nDepths;
+    }
+    return area / (lastTimestamp - firstTimestamp);
+}
+
+/**
+ * given a slice, get the greatest depth recorded in it
+ *
+ * missing rows hold 0.0 in the depth column, so the scan can ignore the
+ * presence bitmap without changing the result
+ *
+ * @return: the greatest depth in meters, or 0.0 if there are no depth samples
+ */
+gdouble dif_sample_slice_get_greatest_depth(const dif_sample_slice_t *slice) {
+    const dif_profile_t *profile = slice->profile;
+    guint row, end = slice->first + slice->n;
+    gdouble greatestDepth = 0.0;
+    for (row = slice->first; row < end; row++) {
+        if (profile->depth[row] > greatestDepth) {
+            greatestDepth = profile->depth[row];
+        }
+    }
+    return greatestDepth;
+}
+
+/**
+ * given a slice, get the lowest temperature recorded in it. temperatures
+ * at or below 0.1C are treated as missing readings, like
+ * dif_dive_get_lowest_temperature does
+ *
+ * @return: the lowest temperature in Celsius, or 0.0 if there are no
+ *          usable temperature samples
+ */
+gdouble dif_sample_slice_get_lowest_temperature(const dif_sample_slice_t *slice) {
+    const dif_profile_t *profile = slice->profile;
+    guint row, end = slice->first + slice->n;
+    gdouble lowestTemperature = 9999;
+    for (row = slice->first; row < end; row++) {
+        gdouble temperature = profile->temperature[row];
+        if (temperature > 0.1 && temperature < lowestTemperature) {
+            lowestTemperature = temperature;
+        }
+    }
+    if (lowestTemperature > 9998) {
+        return 0.0;
+    }
+    return lowestTemperature;
+}
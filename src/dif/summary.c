@@ -0,0 +1,228 @@
+#include <glib.h>
+#include "dif.h"
+
+/* the subsample types that feed the statistics */
+#define STATS_TYPES ((1u << DIF_SAMPLE_DEPTH) | (1u << DIF_SAMPLE_TEMPERATURE) | (1u << DIF_SAMPLE_PRESSURE))
+
+dif_dive_stats_t *dif_dive_stats_alloc() {
+    dif_dive_stats_t *stats;
+    stats = g_malloc0(sizeof(dif_dive_stats_t));
+    stats->initialPressureTank = -1;
+    stats->tanks = g_array_new(FALSE, FALSE, sizeof(dif_tank_stats_t));
+    return stats;
+}
+
+void dif_dive_stats_free(dif_dive_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    g_array_free(stats->tanks, TRUE);
+    g_free(stats);
+}
+
+static dif_tank_stats_t *_dif_stats_tank(dif_dive_stats_t *stats, guint tank) {
+    guint i;
+    dif_tank_stats_t state = {tank, 0.0, 0.0};
+    for (i = 0; i < stats->tanks->len; i++) {
+        dif_tank_stats_t *existing = &g_array_index(stats->tanks, dif_tank_stats_t, i);
+        if (existing->tank == tank) {
+            return existing;
+        }
+    }
+    g_array_append_val(stats->tanks, state);
+    return &g_array_index(stats->tanks, dif_tank_stats_t, stats->tanks->len - 1);
+}
+
+/**
+ * fold one subsample of the latest sample into the statistics
+ *
+ * the same rules as the getters apply: only the first subsample of a kind
+ * in a sample counts. that goes for the pressures of each tank too, so a
+ * sample where another tank is listed first has no reading for a tank.
+ */
+static void _dif_stats_add_subsample(dif_dive_stats_t *stats, dif_sample_t *sample, dif_subsample_t *ss) {
+    gboolean first = dif_sample_get_subsample(sample, ss->type) == ss;
+    switch (ss->type) {
+    case DIF_SAMPLE_DEPTH:
+    {
+        gdouble depth = ss->value.depth;
+        if (!first) {
+            break;
+        }
+        if (stats->nDepths == 0) {
+            stats->firstTimestamp = sample->timestamp;
+        } else {
+            stats->depthArea += (stats->prevDepth + depth) / 2.0 * (sample->timestamp - stats->prevTimestamp);
+        }
+        stats->prevDepth = depth;
+        stats->prevTimestamp = sample->timestamp;
+        stats->depthSum += depth;
+        stats->nDepths++;
+        if (stats->prevTimestamp == stats->firstTimestamp) {
+            /* single depth sample or zero elapsed time, fall back to a simple mean */
+            stats->averageDepth = stats->depthSum / stats->nDepths;
+        } else {
+            stats->averageDepth = stats->depthArea / (stats->prevTimestamp - stats->firstTimestamp);
+        }
+        if (depth > stats->greatestDepth) {
+            stats->greatestDepth = depth;
+        }
+        break;
+    }
+    case DIF_SAMPLE_TEMPERATURE:
+        if (first && ss->value.temperature > 0.1 &&
+            (stats->lowestTemperature < 0.1 || ss->value.temperature < stats->lowestTemperature)) {
+            stats->lowestTemperature = ss->value.temperature;
+        }
+        break;
+    case DIF_SAMPLE_PRESSURE:
+    {
+        gdouble pressure = ss->value.pressure.value;
+        dif_tank_stats_t *tank;
+        if (!first) {
+            break;
+        }
+        tank = _dif_stats_tank(stats, ss->value.pressure.tank);
+        if (pressure > GAS_EPSILON) {
+            if (stats->initialPressureTank < 0) {
+                stats->initialPressureTank = ss->value.pressure.tank;
+                stats->initialPressure = pressure;
+            }
+            stats->finalPressure = pressure;
+            if (tank->beginPressure < GAS_EPSILON) {
+                tank->beginPressure = pressure;
+            }
+            tank->endPressure = pressure;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void _dif_stats_add_sample(dif_dive_stats_t *stats, dif_sample_t *sample) {
+    guint i;
+    stats->nrows++;
+    stats->lastSample = sample;
+    stats->duration = sample->timestamp;
+    for (i = 0; i < sample->nsubsamples; i++) {
+        _dif_stats_add_subsample(stats, sample, sample->subsamples[i]);
+    }
+}
+
+/**
+ * called by dif_dive_add_sample to keep the running statistics current
+ *
+ * a sample at or after the latest timestamp is folded in. an earlier one
+ * only matters if it carries depth, temperature or pressure, in which case
+ * the running statistics are dropped
+ */
+void dif_dive_stats_sample_added(dif_dive_t *dive, dif_sample_t *sample) {
+    dif_dive_stats_t *stats = dive->stats;
+    if (stats == NULL) {
+        return;
+    }
+    if (stats->nrows == 0 || sample->timestamp >= stats->duration) {
+        _dif_stats_add_sample(stats, sample);
+    } else if (sample->present & STATS_TYPES) {
+        dif_dive_invalidate_stats(dive);
+    }
+}
+
+/**
+ * called by dif_sample_add_subsample for samples that are part of a dive
+ */
+void dif_dive_stats_subsample_added(dif_dive_t *dive, dif_sample_t *sample, dif_subsample_t *subsample) {
+    dif_dive_stats_t *stats = dive->stats;
+    if (stats == NULL || !((1u << subsample->type) & STATS_TYPES)) {
+        return;
+    }
+    if (sample == stats->lastSample) {
+        _dif_stats_add_subsample(stats, sample, subsample);
+    } else {
+        dif_dive_invalidate_stats(dive);
+    }
+}
+
+/**
+ * drop the running statistics of a dive; dif_dive_compute_summary
+ * rebuilds them with a scan of the samples
+ */
+void dif_dive_invalidate_stats(dif_dive_t *dive) {
+    if (dive->stats != NULL) {
+        dif_dive_stats_free(dive->stats);
+        dive->stats = NULL;
+    }
+}
+
+/**
+ * the running statistics of a dive, rebuilt with a single pass over the
+ * sorted samples if they were dropped
+ */
+dif_dive_stats_t *dif_dive_get_stats(dif_dive_t *dive) {
+    dif_dive_stats_t *stats;
+    guint i;
+
+    if (dive->stats == NULL) {
+        dive = dif_dive_sort_samples(dive);
+        stats = dif_dive_stats_alloc();
+        for (i = 0; i < dive->samples->len; i++) {
+            _dif_stats_add_sample(stats, g_ptr_array_index(dive->samples, i));
+        }
+        dive->stats = stats;
+    }
+    return dive->stats;
+}
+
+/**
+ * given a dive, get all of its sample statistics at once
+ *
+ * this replaces calling dif_dive_get_greatest_depth, _average_depth,
+ * _lowest_temperature, _dive_duration, _initial_pressure_tank,
+ * _initial_pressure and _final_pressure one after the other, each of which
+ * is a scan of its own. a dive whose samples arrived in order already has
+ * the numbers; otherwise they are rebuilt in a single pass and kept.
+ *
+ * @param dive: the dif_dive_t object
+ * @return: a newly allocated summary, free with dif_dive_summary_free
+ */
+dif_dive_summary_t *dif_dive_compute_summary(dif_dive_t *dive) {
+    dif_dive_summary_t *summary = g_new0(dif_dive_summary_t, 1);
+    dif_dive_stats_t *stats = dif_dive_get_stats(dive);
+    guint i, ntanks;
+
+    summary->duration = stats->duration;
+    summary->greatestDepth = stats->greatestDepth;
+    summary->averageDepth = stats->averageDepth;
+    summary->lowestTemperature = stats->lowestTemperature;
+    summary->initialPressure = stats->initialPressure;
+    summary->finalPressure = stats->finalPressure;
+    summary->initialPressureTank = stats->initialPressureTank;
+    summary->tanks = g_new0(dif_tank_summary_t, MAX(stats->tanks->len, 1));
+    ntanks = 0;
+    for (i = 0; i < stats->tanks->len; i++) {
+        dif_tank_stats_t *tank = &g_array_index(stats->tanks, dif_tank_stats_t, i);
+        if (tank->beginPressure < GAS_EPSILON) {
+            continue;
+        }
+        summary->tanks[ntanks].tank = tank->tank;
+        summary->tanks[ntanks].beginPressure = tank->beginPressure;
+        summary->tanks[ntanks].endPressure = tank->endPressure;
+        if (summary->initialPressureTank >= 0 && tank->tank == (guint) summary->initialPressureTank) {
+            summary->beginPressure = tank->beginPressure;
+            summary->endPressure = tank->endPressure;
+        }
+        ntanks++;
+    }
+    summary->ntanks = ntanks;
+    return summary;
+}
+
+void dif_dive_summary_free(dif_dive_summary_t *summary) {
+    if (summary == NULL) {
+        return;
+    }
+    g_free(summary->tanks);
+    g_free(summary);
+}
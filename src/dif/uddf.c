@@ -1,7 +1,9 @@
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/xmlwriter.h>
 #include <glib.h>
 #include <stdio.h>
+#include <string.h>
 #include "dif.h"
 
 #define DC2UDDF_VERSION "1.0"
@@ -12,15 +14,47 @@
 #define UDDF_SCHEMA_LOCATION "http://www.streit.cc/uddf/3.2/ http://www.streit.cc/resources/UDDF/v3.2.3/schema/uddf_3.2.3.xsd"
 
 #define MAX_STRING_LENGTH 100
-#define BAR_TO_PASCAL(a) ((a)*100000)
-#define CELSIUS_TO_KELVIN(a) ((a)+273.15)
 
 /**
  * Child elements of <waypoint> in the exact order required by the
  * waypointType xs:sequence in the UDDF 3.2.3 schema. Note this is NOT
  * alphabetical (e.g. divemode, gradientfactor, measuredpo2 and nodecotime
  * come after temperature). Elements not in this list (e.g. the non-schema
- * event/vendor debug elements) sort last.
+ * event/vendor debug elements) go last, as UDDF_WAYPOINT_OTHER.
+ *
+ * Waypoint children are ordered by these values, so the order is fixed at
+ * compile time and no names are compared.
+ */
+typedef enum uddf_waypoint_element_t {
+    UDDF_WAYPOINT_ALARM = 0,
+    UDDF_WAYPOINT_BATTERYCHARGECONDITION,
+    UDDF_WAYPOINT_CNS,
+    UDDF_WAYPOINT_DECOSTOP,
+    UDDF_WAYPOINT_BODYTEMPERATURE,
+    UDDF_WAYPOINT_CALCULATEDPO2,
+    UDDF_WAYPOINT_DEPTH,
+    UDDF_WAYPOINT_DIVETIME,
+    UDDF_WAYPOINT_HEADING,
+    UDDF_WAYPOINT_HEARTRATE,
+    UDDF_WAYPOINT_OTU,
+    UDDF_WAYPOINT_PULSERATE,
+    UDDF_WAYPOINT_REMAININGBOTTOMTIME,
+    UDDF_WAYPOINT_REMAININGO2TIME,
+    UDDF_WAYPOINT_SETMARKER,
+    UDDF_WAYPOINT_SETPO2,
+    UDDF_WAYPOINT_SWITCHMIX,
+    UDDF_WAYPOINT_TANKPRESSURE,
+    UDDF_WAYPOINT_TEMPERATURE,
+    UDDF_WAYPOINT_DIVEMODE,
+    UDDF_WAYPOINT_GRADIENTFACTOR,
+    UDDF_WAYPOINT_MEASUREDPO2,
+    UDDF_WAYPOINT_NODECOTIME,
+    UDDF_WAYPOINT_OTHER,
+    UDDF_WAYPOINT_ELEMENTS
+} uddf_waypoint_element_t;
+
+/**
+ * names of the schema elements, indexed by uddf_waypoint_element_t
  */
 static const char *_waypointElementOrder[] = {
     "alarm", "batterychargecondition", "cns", "decostop", "bodytemperature",
@@ -29,41 +63,165 @@ static const char *_waypointElementOrder[] = {
     "setpo2", "switchmix", "tankpressure", "temperature", "divemode",
     "gradientfactor", "measuredpo2", "nodecotime", NULL};
 
-static gint _waypointElementRank(const xmlChar *name) {
-    gint i;
-    for (i = 0; _waypointElementOrder[i] != NULL; i++) {
-        if (xmlStrcmp(name, BAD_CAST _waypointElementOrder[i]) == 0) {
-            return i;
-        }
-    }
-    return i;
-}
+/**
+ * names of the libdivecomputer events, for the non-schema <event> element
+ */
+static const char *_eventNames[] = {
+    "none", "deco", "rbt", "ascent", "ceiling", "workload", "transmitter",
+    "violation", "bookmark", "surface", "safety stop", "gaschange",
+    "safety stop (voluntary)", "safety stop (mandatory)", "deepstop",
+    "ceiling (safety stop)", "unknown", "divetime", "maxdepth",
+    "OLF", "PO2", "airtime", "rgbm", "heading", "tissue level warning",
+    "gaschange2", "ndl"};
+
+/**
+ * a waypoint child: the element it is written as and the subsample it
+ * comes from, NULL for the divetime every waypoint has
+ */
+typedef struct uddf_waypoint_child_t {
+    uddf_waypoint_element_t element;
+    dif_subsample_t *subsample;
+} uddf_waypoint_child_t;
+
+/* the most children a sample can have: an event can turn into an alarm or
+ * setmarker as well as an <event>, and there is always a divetime */
+#define WAYPOINT_MAX_CHILDREN(sample) (2 * (sample)->nsubsamples + 1)
+/* waypoints with up to this many children are put in order on the stack */
+#define WAYPOINT_STACK_CHILDREN 33
+/* dives the direct writer queues per worker ahead of the one it writes */
+#define DIRECT_JOBS_PER_THREAD 4
 
 /**
- * helper function for comparing two nodes and sorting them
+ * put the children of a waypoint in schema order
  *
- * This is used for the <waypoint> tag whose children must appear in the
- * order defined by the waypointType sequence in the UDDF schema
+ * every subsample is bucketed by the element it becomes, then the buckets
+ * are laid out one after the other in uddf_waypoint_element_t order with a
+ * counting sort. subsamples that become the same element keep their
+ * order.
+ *
+ * @param found: scratch space for WAYPOINT_MAX_CHILDREN(sample) children
+ * @param children: set to the children in order, same size as found
+ * @return the number of children
  */
-gint _g_list_sort_xmlNodePtrs(gconstpointer a, gconstpointer b) {
-    xmlNodePtr node1 = (xmlNodePtr) a;
-    xmlNodePtr node2 = (xmlNodePtr) b;
-    return _waypointElementRank(node1->name) - _waypointElementRank(node2->name);
+static guint _waypointChildren(dif_sample_t *sample, xml_options_t *options,
+                               uddf_waypoint_child_t *found, uddf_waypoint_child_t *children) {
+    guint slots[UDDF_WAYPOINT_ELEMENTS + 1] = {0};
+    /* the schema allows at most one <setmarker> per waypoint (unlike
+     * <alarm>, which is unbounded) */
+    gboolean haveSetmarker = FALSE;
+    guint n = 0;
+    guint i;
+
+#define ADD_CHILD(e, ss) do { found[n].element = (e); found[n].subsample = (ss); slots[(e) + 1]++; n++; } while (0)
+    ADD_CHILD(UDDF_WAYPOINT_DIVETIME, NULL);
+    for (i = 0; i < sample->nsubsamples; i++) {
+        dif_subsample_t *ss = sample->subsamples[i];
+        dif_alarm_type_t alarmType;
+        switch (ss->type) {
+        case DIF_SAMPLE_TIME:
+            printf("** Unable to process DIF_SAMPLE_TIME\n");
+            break;
+        case DIF_SAMPLE_DEPTH:
+            ADD_CHILD(UDDF_WAYPOINT_DEPTH, ss);
+            break;
+        case DIF_SAMPLE_PRESSURE:
+            ADD_CHILD(UDDF_WAYPOINT_TANKPRESSURE, ss);
+            break;
+        case DIF_SAMPLE_TEMPERATURE:
+            ADD_CHILD(UDDF_WAYPOINT_TEMPERATURE, ss);
+            break;
+        case DIF_SAMPLE_EVENT:
+            /* schema-valid output first: bookmarks become <setmarker>,
+             * alarm-like events become <alarm> (see dif_sample_event_to_alarm) */
+            if (ss->value.event.type == DIF_SAMPLE_EVENT_BOOKMARK) {
+                if (!haveSetmarker) {
+                    ADD_CHILD(UDDF_WAYPOINT_SETMARKER, ss);
+                    haveSetmarker = TRUE;
+                }
+            } else if (dif_sample_event_to_alarm(ss->value.event.type, &alarmType)) {
+                ADD_CHILD(UDDF_WAYPOINT_ALARM, ss);
+            }
+            if (options->useInvalidElements) {
+                // WARNING: the event tag is NOT part of UDDF, however there are cases when
+                // it might be desirable to save these events for debugging and validation.
+                //
+                // This is partially because there are various events in the UDDF schema
+                // that don't easily map, so I haven't implemented them yet. This will at
+                // at least tell you if the event happened.
+                ADD_CHILD(UDDF_WAYPOINT_OTHER, ss);
+            }
+            break;
+        case DIF_SAMPLE_ALARM:
+            ADD_CHILD(UDDF_WAYPOINT_ALARM, ss);
+            break;
+        case DIF_SAMPLE_SETMARKER:
+            if (!haveSetmarker && ss->value.setmarker != NULL) {
+                ADD_CHILD(UDDF_WAYPOINT_SETMARKER, ss);
+                haveSetmarker = TRUE;
+            }
+            break;
+        case DIF_SAMPLE_RBT:
+            ADD_CHILD(UDDF_WAYPOINT_REMAININGBOTTOMTIME, ss);
+            break;
+        case DIF_SAMPLE_HEARTBEAT:
+            ADD_CHILD(UDDF_WAYPOINT_HEARTRATE, ss);
+            break;
+        case DIF_SAMPLE_BEARING:
+            /* 65535 is the "no data" sentinel from some parsers (e.g. Uwatec);
+             * only emit compass headings in the valid 0-359 range */
+            if (ss->value.bearing <= 359) {
+                ADD_CHILD(UDDF_WAYPOINT_HEADING, ss);
+            }
+            break;
+        case DIF_SAMPLE_VENDOR:
+            if (options->useInvalidElements) {
+                // WARNING: similar to the event tag, the vendor tag is not a
+                // part of UDDF but can be recorded by dc2uddf.  I haven't had
+                // any of these tags fire of on my computer, so I'm not certain
+                // when they come up or what they mean.
+                ADD_CHILD(UDDF_WAYPOINT_OTHER, ss);
+            } else {
+                printf("** Received a VENDOR event that I don't understand and isn't part of the schema. To dump this event please set xml_options_t->useInvalidElements to TRUE\n");
+            }
+            break;
+        case DIF_SAMPLE_UNDEFINED:
+            printf("** Unable to process DIF_SAMPLE_UNKNOWN\n");
+            break;
+        default:
+            printf("** Unable to process unknown type: %d\n", ss->type);
+            break;
+        }
+    }
+#undef ADD_CHILD
+
+    /* slots[e + 1] counted the children of element e; now slots[e] is
+     * where its bucket starts */
+    for (i = 1; i <= UDDF_WAYPOINT_ELEMENTS; i++) {
+        slots[i] += slots[i - 1];
+    }
+    for (i = 0; i < n; i++) {
+        children[slots[found[i].element]++] = found[i];
+    }
+    return n;
 }
 
 /**
  * helper function for creating datetime nodes
  */
-xmlNodePtr _createDateTime(GDateTime *dt, xml_options_t *options) {
-    xmlNodePtr xmlDateTime = xmlNewNode(NULL, BAD_CAST "datetime");
+static void _formatDateTime(GDateTime *dt, gchar *xmlstr) {
     gchar *tzstr = g_date_time_format(dt, "%z");
     gchar *dtstr = g_date_time_format(dt, "%Y-%m-%dT%H:%M:%S");
-    gchar *xmlstr = g_malloc(MAX_STRING_LENGTH);
     g_snprintf(xmlstr, MAX_STRING_LENGTH, "%s%c%c%c:%c%c",
             dtstr, tzstr[0], tzstr[1], tzstr[2], tzstr[3], tzstr[4]);
-    xmlAddChild(xmlDateTime, xmlNewText(BAD_CAST xmlstr));
     g_free(dtstr);
     g_free(tzstr);
+}
+
+xmlNodePtr _createDateTime(GDateTime *dt, xml_options_t *options) {
+    xmlNodePtr xmlDateTime = xmlNewNode(NULL, BAD_CAST "datetime");
+    gchar *xmlstr = g_malloc(MAX_STRING_LENGTH);
+    _formatDateTime(dt, xmlstr);
+    xmlAddChild(xmlDateTime, xmlNewText(BAD_CAST xmlstr));
     g_free(xmlstr);
     return xmlDateTime;
 }
@@ -134,191 +292,169 @@ xmlNodePtr _createGeneratorBlock(xml_options_t *options) {
  * </waypoint>
  */
 xmlNodePtr _createWaypoint(dif_sample_t *sample, xml_options_t *options) {
-    static const char *events[] = {
-        "none", "deco", "rbt", "ascent", "ceiling", "workload", "transmitter",
-        "violation", "bookmark", "surface", "safety stop", "gaschange",
-        "safety stop (voluntary)", "safety stop (mandatory)", "deepstop",
-        "ceiling (safety stop)", "unknown", "divetime", "maxdepth",
-        "OLF", "PO2", "airtime", "rgbm", "heading", "tissue level warning",
-        "gaschange2", "ndl"};
-
-    GList *xmlSubsamples= NULL;
-    /* the schema allows at most one <setmarker> per waypoint (unlike
-     * <alarm>, which is unbounded) */
-    gboolean haveSetmarker = FALSE;
+    uddf_waypoint_child_t stackFound[WAYPOINT_STACK_CHILDREN];
+    uddf_waypoint_child_t stackChildren[WAYPOINT_STACK_CHILDREN];
+    uddf_waypoint_child_t *found = stackFound;
+    uddf_waypoint_child_t *children = stackChildren;
+    guint nchildren, i;
+    dif_alarm_type_t alarmType;
+
+    if (WAYPOINT_MAX_CHILDREN(sample) > WAYPOINT_STACK_CHILDREN) {
+        found = g_new(uddf_waypoint_child_t, WAYPOINT_MAX_CHILDREN(sample));
+        children = g_new(uddf_waypoint_child_t, WAYPOINT_MAX_CHILDREN(sample));
+    }
+    nchildren = _waypointChildren(sample, options, found, children);
 
     xmlNodePtr xmlWaypoint = xmlNewNode(NULL, BAD_CAST "waypoint");
 
     gchar *nodeText = g_malloc(MAX_STRING_LENGTH);
 
-    g_snprintf(nodeText, MAX_STRING_LENGTH, "%d", sample->timestamp);
-
-    xmlNodePtr xmlDivetime = xmlNewNode(NULL, BAD_CAST "divetime");
-    xmlAddChild(xmlDivetime, xmlNewText(BAD_CAST nodeText));
-    xmlSubsamples = g_list_append(xmlSubsamples, xmlDivetime);
-
-
-    GList *subsample = g_list_first(sample->subsamples);
-    while (subsample != NULL) {
-        dif_subsample_t *ss = subsample->data;
-        switch (ss->type) {
-        case DIF_SAMPLE_TIME:
-            printf("** Unable to process DIF_SAMPLE_TIME\n");
+    for (i = 0; i < nchildren; i++) {
+        dif_subsample_t *ss = children[i].subsample;
+        xmlNodePtr xmlChild;
+        if (children[i].element == UDDF_WAYPOINT_OTHER) {
+            xmlChild = xmlNewNode(NULL, BAD_CAST (ss->type == DIF_SAMPLE_VENDOR ? "vendor" : "event"));
+        } else {
+            xmlChild = xmlNewNode(NULL, BAD_CAST _waypointElementOrder[children[i].element]);
+        }
+        switch (children[i].element) {
+        case UDDF_WAYPOINT_ALARM:
+            if (ss->type == DIF_SAMPLE_EVENT) {
+                dif_sample_event_to_alarm(ss->value.event.type, &alarmType);
+            } else {
+                alarmType = ss->value.alarm.type;
+                if (ss->value.alarm.hasLevel) {
+                    g_snprintf(nodeText, MAX_STRING_LENGTH, "%g", ss->value.alarm.level);
+                    xmlNewProp(xmlChild, BAD_CAST "level", BAD_CAST nodeText);
+                }
+            }
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST dif_alarm_type_name(alarmType)));
             break;
-        case DIF_SAMPLE_DEPTH:
-            g_snprintf(nodeText, MAX_STRING_LENGTH, "%0.2f", ss->value.depth);
-            xmlNodePtr xmlDepth = xmlNewNode(NULL, BAD_CAST "depth");
-            xmlAddChild(xmlDepth, xmlNewText(BAD_CAST nodeText));
-            xmlSubsamples = g_list_append(xmlSubsamples, xmlDepth);
+        case UDDF_WAYPOINT_DEPTH:
+            dif_format_fixed(nodeText, MAX_STRING_LENGTH, ss->value.depth, 2);
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST nodeText));
             break;
-        case DIF_SAMPLE_PRESSURE:
-            g_snprintf(nodeText, MAX_STRING_LENGTH, "%0.2f", BAR_TO_PASCAL(ss->value.pressure.value));
-            xmlNodePtr xmlTankpressure = xmlNewNode(NULL, BAD_CAST "tankpressure");
-            xmlAddChild(xmlTankpressure, xmlNewText(BAD_CAST nodeText));
-            xmlSubsamples = g_list_append(xmlSubsamples, xmlTankpressure);
+        case UDDF_WAYPOINT_DIVETIME:
+            dif_format_int(nodeText, MAX_STRING_LENGTH, (gint) sample->timestamp);
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST nodeText));
             break;
-        case DIF_SAMPLE_TEMPERATURE:
-            g_snprintf(nodeText, MAX_STRING_LENGTH, "%0.2f", CELSIUS_TO_KELVIN(ss->value.temperature));
-            xmlNodePtr xmlTemperature = xmlNewNode(NULL, BAD_CAST "temperature");
-            xmlAddChild(xmlTemperature, xmlNewText(BAD_CAST nodeText));
-            xmlSubsamples = g_list_append(xmlSubsamples, xmlTemperature);
+        case UDDF_WAYPOINT_HEADING:
+            dif_format_int(nodeText, MAX_STRING_LENGTH, (gint) ss->value.bearing);
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST nodeText));
             break;
-        case DIF_SAMPLE_EVENT: {
-            /* schema-valid output first: bookmarks become <setmarker>,
-             * alarm-like events become <alarm> (see dif_sample_event_to_alarm) */
-            dif_alarm_type_t alarmType;
-            if (ss->value.event.type == DIF_SAMPLE_EVENT_BOOKMARK) {
-                if (!haveSetmarker) {
-                    xmlNodePtr xmlSetmarker = xmlNewNode(NULL, BAD_CAST "setmarker");
-                    xmlAddChild(xmlSetmarker, xmlNewText(BAD_CAST "bookmark"));
-                    xmlSubsamples = g_list_append(xmlSubsamples, xmlSetmarker);
-                    haveSetmarker = TRUE;
-                }
-            } else if (dif_sample_event_to_alarm(ss->value.event.type, &alarmType)) {
-                xmlNodePtr xmlAlarm = xmlNewNode(NULL, BAD_CAST "alarm");
-                xmlAddChild(xmlAlarm, xmlNewText(BAD_CAST dif_alarm_type_name(alarmType)));
-                xmlSubsamples = g_list_append(xmlSubsamples, xmlAlarm);
-            }
-            if (options->useInvalidElements) {
-                // WARNING: the event tag is NOT part of UDDF, however there are cases when
-                // it might be desirable to save these events for debugging and validation.
-                //
-                // This is partially because there are various events in the UDDF schema
-                // that don't easily map, so I haven't implemented them yet. This will at
-                // at least tell you if the event happened.
-                xmlNodePtr xmlEvent = xmlNewNode(NULL, BAD_CAST "event");
-                g_snprintf(nodeText, MAX_STRING_LENGTH, "%u", ss->value.event.type);
-                xmlNewProp(xmlEvent, BAD_CAST "type", BAD_CAST nodeText);
-                g_snprintf(nodeText, MAX_STRING_LENGTH, "%u", ss->value.event.time);
-                xmlNewProp(xmlEvent, BAD_CAST "time", BAD_CAST nodeText);
-                g_snprintf(nodeText, MAX_STRING_LENGTH, "%u", ss->value.event.flags);
-                xmlNewProp(xmlEvent, BAD_CAST "flags", BAD_CAST nodeText);
-                g_snprintf(nodeText, MAX_STRING_LENGTH, "%u", ss->value.event.value);
-                xmlNewProp(xmlEvent, BAD_CAST "value", BAD_CAST nodeText);
-                xmlAddChild(xmlEvent, xmlNewText(BAD_CAST (
-                    ss->value.event.type < G_N_ELEMENTS(events)
-                        ? events[ss->value.event.type] : "out-of-range")));
-                xmlSubsamples = g_list_append(xmlSubsamples, xmlEvent);
-            }
+        case UDDF_WAYPOINT_HEARTRATE:
+            dif_format_int(nodeText, MAX_STRING_LENGTH, (gint) ss->value.heartbeat);
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST nodeText));
             break;
-        }
-        case DIF_SAMPLE_ALARM: {
-            xmlNodePtr xmlAlarm = xmlNewNode(NULL, BAD_CAST "alarm");
-            if (ss->value.alarm.hasLevel) {
-                g_snprintf(nodeText, MAX_STRING_LENGTH, "%g", ss->value.alarm.level);
-                xmlNewProp(xmlAlarm, BAD_CAST "level", BAD_CAST nodeText);
-            }
-            xmlAddChild(xmlAlarm, xmlNewText(BAD_CAST dif_alarm_type_name(ss->value.alarm.type)));
-            xmlSubsamples = g_list_append(xmlSubsamples, xmlAlarm);
+        case UDDF_WAYPOINT_REMAININGBOTTOMTIME:
+            dif_format_int(nodeText, MAX_STRING_LENGTH, (gint) ss->value.rbt);
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST nodeText));
             break;
-        }
-        case DIF_SAMPLE_SETMARKER:
-            if (!haveSetmarker && ss->value.setmarker != NULL) {
-                xmlNodePtr xmlSetmarker = xmlNewNode(NULL, BAD_CAST "setmarker");
-                xmlAddChild(xmlSetmarker, xmlNewText(BAD_CAST ss->value.setmarker));
-                xmlSubsamples = g_list_append(xmlSubsamples, xmlSetmarker);
-                haveSetmarker = TRUE;
-            }
+        case UDDF_WAYPOINT_SETMARKER:
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST (ss->type == DIF_SAMPLE_EVENT ? "bookmark" : ss->value.setmarker)));
             break;
-        case DIF_SAMPLE_RBT:
-            g_snprintf(nodeText, MAX_STRING_LENGTH, "%d", ss->value.rbt);
-            xmlNodePtr xmlRemainingbottomtime = xmlNewNode(NULL, BAD_CAST "remainingbottomtime");
-            xmlAddChild(xmlRemainingbottomtime, xmlNewText(BAD_CAST nodeText));
-            xmlSubsamples = g_list_append(xmlSubsamples, xmlRemainingbottomtime);
+        case UDDF_WAYPOINT_TANKPRESSURE:
+            dif_format_fixed(nodeText, MAX_STRING_LENGTH, BAR_TO_PASCAL(ss->value.pressure.value), 2);
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST nodeText));
             break;
-        case DIF_SAMPLE_HEARTBEAT:
-            g_snprintf(nodeText, MAX_STRING_LENGTH, "%d", ss->value.heartbeat);
-            xmlNodePtr xmlHeartrate = xmlNewNode(NULL, BAD_CAST "heartrate");
-            xmlAddChild(xmlHeartrate, xmlNewText(BAD_CAST nodeText));
-            xmlSubsamples = g_list_append(xmlSubsamples, xmlHeartrate);
+        case UDDF_WAYPOINT_TEMPERATURE:
+            dif_format_fixed(nodeText, MAX_STRING_LENGTH, CELSIUS_TO_KELVIN(ss->value.temperature), 2);
+            xmlAddChild(xmlChild, xmlNewText(BAD_CAST nodeText));
             break;
-        case DIF_SAMPLE_BEARING:
-            /* 65535 is the "no data" sentinel from some parsers (e.g. Uwatec);
-             * only emit compass headings in the valid 0-359 range */
-            if (ss->value.bearing <= 359) {
-                g_snprintf(nodeText, MAX_STRING_LENGTH, "%d", ss->value.bearing);
-                xmlNodePtr xmlHeading = xmlNewNode(NULL, BAD_CAST "heading");
-                xmlAddChild(xmlHeading, xmlNewText(BAD_CAST nodeText));
-                xmlSubsamples = g_list_append(xmlSubsamples, xmlHeading);
-            }
-            break;
-        case DIF_SAMPLE_VENDOR:
-            if (options->useInvalidElements) {
-                // WARNING: similar to the event tag, the vendor tag is not a
-                // part of UDDF but can be recorded by dc2uddf.  I haven't had
-                // any of these tags fire of on my computer, so I'm not certain
-                // when they come up or what they mean.
-                xmlNodePtr xmlVendor = xmlNewNode(NULL, BAD_CAST "vendor");
-                gchar *propText = g_malloc(MAX_STRING_LENGTH);
-                g_snprintf(propText, MAX_STRING_LENGTH, "%u", ss->value.vendor.type);
-                xmlNewProp(xmlVendor, BAD_CAST "type", BAD_CAST propText);
-                g_snprintf(propText, MAX_STRING_LENGTH, "%u", ss->value.vendor.size);
-                xmlNewProp(xmlVendor, BAD_CAST "size", BAD_CAST propText);
+        default:
+            if (ss->type == DIF_SAMPLE_VENDOR) {
+                dif_format_int(nodeText, MAX_STRING_LENGTH, ss->value.vendor.type);
+                xmlNewProp(xmlChild, BAD_CAST "type", BAD_CAST nodeText);
+                dif_format_int(nodeText, MAX_STRING_LENGTH, ss->value.vendor.size);
+                xmlNewProp(xmlChild, BAD_CAST "size", BAD_CAST nodeText);
                 guint vendorTextLength = ss->value.vendor.size*2+1;
                 gchar *vendorText = g_malloc0(ss->value.vendor.size*2+1);
-                unsigned int i;
-                for (i=0; i < ss->value.vendor.size; i++) {
-                    g_snprintf((vendorText + i * 2), vendorTextLength - i * 2, "%02X", ((unsigned char *) ss->value.vendor.data)[i]);
+                guint b;
+                for (b = 0; b < ss->value.vendor.size; b++) {
+                    g_snprintf((vendorText + b * 2), vendorTextLength - b * 2, "%02X", ((unsigned char *) ss->value.vendor.data)[b]);
                 }
-                xmlAddChild(xmlVendor, xmlNewText(BAD_CAST vendorText));
-                xmlSubsamples = g_list_append(xmlSubsamples, xmlVendor);
-                g_free(propText);
+                xmlAddChild(xmlChild, xmlNewText(BAD_CAST vendorText));
                 g_free(vendorText);
             } else {
-                printf("** Received a VENDOR event that I don't understand and isn't part of the schema. To dump this event please set xml_options_t->useInvalidElements to TRUE\n");
+                dif_format_int(nodeText, MAX_STRING_LENGTH, ss->value.event.type);
+                xmlNewProp(xmlChild, BAD_CAST "type", BAD_CAST nodeText);
+                dif_format_int(nodeText, MAX_STRING_LENGTH, ss->value.event.time);
+                xmlNewProp(xmlChild, BAD_CAST "time", BAD_CAST nodeText);
+                dif_format_int(nodeText, MAX_STRING_LENGTH, ss->value.event.flags);
+                xmlNewProp(xmlChild, BAD_CAST "flags", BAD_CAST nodeText);
+                dif_format_int(nodeText, MAX_STRING_LENGTH, ss->value.event.value);
+                xmlNewProp(xmlChild, BAD_CAST "value", BAD_CAST nodeText);
+                xmlAddChild(xmlChild, xmlNewText(BAD_CAST (
+                    ss->value.event.type < G_N_ELEMENTS(_eventNames)
+                        ? _eventNames[ss->value.event.type] : "out-of-range")));
             }
             break;
-        case DIF_SAMPLE_UNDEFINED:
-            printf("** Unable to process DIF_SAMPLE_UNKNOWN\n");
-            break;
-        default:
-            printf("** Unable to process unknown type: %d\n", ss->type);
-            break;
         }
-        subsample = g_list_next(subsample);
-    }
-
-    // sort the different subsamples and save them as children of the waypoint
-    xmlSubsamples = g_list_sort(xmlSubsamples, _g_list_sort_xmlNodePtrs);
-    xmlSubsamples = g_list_first(xmlSubsamples);
-    while (xmlSubsamples != NULL) {
-        xmlAddChild(xmlWaypoint, xmlSubsamples->data);
-        xmlSubsamples = g_list_next(xmlSubsamples);
+        xmlAddChild(xmlWaypoint, xmlChild);
     }
     g_free(nodeText);
-    g_list_free(xmlSubsamples);
+    if (found != stackFound) {
+        g_free(found);
+        g_free(children);
+    }
     return xmlWaypoint;
 }
 
+/**
+ * the values of <informationafterdive>
+ */
+typedef struct uddf_dive_values_t {
+    gdouble lowestTemperature;  /* Celsius, written when above 0.1 */
+    gdouble greatestDepth;
+    gdouble duration;
+    gdouble averageDepth;       /* written when above 0.0 */
+    gdouble pressureDrop;       /* bar, written when above 0.0 */
+} uddf_dive_values_t;
+
+/**
+ * work out the values of <informationafterdive>, preferring what the
+ * device reported over what the samples give
+ */
+static void _diveValues(dif_dive_t *dive, dif_dive_summary_t *summary, uddf_dive_values_t *values) {
+    values->lowestTemperature = dive->hasMinTemperature ? dive->minTemperature : summary->lowestTemperature;
+    values->greatestDepth = summary->greatestDepth;
+    values->duration = summary->duration;
+    values->averageDepth = dive->hasAvgdepth ? dive->avgdepth : summary->averageDepth;
+
+    /* the sample fallback pins begin and end to the tank that produced the
+     * first valid reading so multi-tank dives never mix pressures from
+     * different tanks */
+    gdouble beginPressure, endPressure;
+    if (dive->hasTankPressures) {
+        beginPressure = dive->beginPressure;
+        endPressure = dive->endPressure;
+    } else {
+        beginPressure = summary->beginPressure;
+        endPressure = summary->endPressure;
+    }
+    values->pressureDrop = 0.0;
+    if (beginPressure > GAS_EPSILON && endPressure > GAS_EPSILON && beginPressure - endPressure > 0.0) {
+        values->pressureDrop = beginPressure - endPressure;
+    }
+}
+
 xmlNodePtr _createDive(dif_dive_t *dive, gchar *diveid, xml_options_t *options) {
     gchar *tempStr = g_malloc(MAX_STRING_LENGTH);
+    /* a compacted dive is expanded while it is written, then packed again */
+    gboolean wasCompact = dive->compact != NULL;
+    dif_dive_summary_t *summary;
+
+    dive = dif_dive_expand(dive);
+    /* every statistic below comes from this one pass over the samples */
+    summary = dif_dive_compute_summary(dive);
 
     xmlNodePtr xmlDive = xmlNewNode(NULL, BAD_CAST "dive");
     xmlNewProp(xmlDive, BAD_CAST "id", BAD_CAST diveid);
     xmlNodePtr xmlInformationBeforeDive = xmlNewNode(NULL, BAD_CAST "informationbeforedive");
-    if (dive->datetime != NULL) {
-        GDateTime *dt = dive->datetime;
+    GDateTime *dt = dif_dive_get_datetime(dive);
+    if (dt != NULL) {
         xmlAddChild(xmlInformationBeforeDive, _createDateTime(dt, options));
+        g_date_time_unref(dt);
     }
 
     xmlNodePtr xmlSurfaceIntervalBeforeDive = xmlNewNode(NULL, BAD_CAST "surfaceintervalbeforedive");
@@ -327,7 +463,7 @@ xmlNodePtr _createDive(dif_dive_t *dive, gchar *diveid, xml_options_t *options)
         xmlAddChild(xmlSurfaceIntervalBeforeDive, xmlInfinity);
     } else {
         xmlNodePtr xmlPassedTime = xmlNewNode(NULL, BAD_CAST "passedtime");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%d", dive->surfaceInterval);
+        dif_format_int(tempStr, MAX_STRING_LENGTH, dive->surfaceInterval);
         xmlAddChild(xmlPassedTime, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlSurfaceIntervalBeforeDive, xmlPassedTime);
     }
@@ -338,119 +474,108 @@ xmlNodePtr _createDive(dif_dive_t *dive, gchar *diveid, xml_options_t *options)
     /* if gasmixes are specified, then we'll link to them */
     /* per the UDDF 3.2.3 diveType sequence, tankdata elements are direct
      * children of <dive>, between informationbeforedive and samples */
-    if (dive->gasmixes != NULL) {
-        GList *gasmixes = g_list_first(dive->gasmixes);
-        while (gasmixes != NULL) {
-            xmlNodePtr xmlTankdata = xmlNewNode(NULL, BAD_CAST "tankdata");
-            // id is NOT a valid parameter for tankdata
-            dif_gasmix_t *gasmix = gasmixes->data;
-            xmlNodePtr xmlLink = xmlNewNode(NULL, BAD_CAST "link");
-            xmlNewProp(xmlLink, BAD_CAST "ref", BAD_CAST dif_gasmix_name(gasmix));
-            xmlAddChild(xmlTankdata, xmlLink);
-            xmlAddChild(xmlDive, xmlTankdata);
-
-            // FIXME: this gets the initial pressure of any tank and isn't bound
-            // to the specific tank. Need to see how this actually works in more
-            // detail and understand the numbering that libdivecomputer uses
-            // when creating tanks
-            gdouble initialPressure = dif_dive_get_initial_pressure(dive, -1);
-            if (initialPressure > GAS_EPSILON) {
-                g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.1f", BAR_TO_PASCAL(initialPressure));
-                xmlNodePtr xmlTankPressureBegin = xmlNewNode(NULL, BAD_CAST "tankpressurebegin");
-                xmlAddChild(xmlTankPressureBegin, xmlNewText(BAD_CAST tempStr));
-                xmlAddChild(xmlTankdata, xmlTankPressureBegin);
-            }
-            gasmixes = g_list_next(gasmixes);
+    guint mix;
+    for (mix = 0; mix < dive->gasmixes->len; mix++) {
+        xmlNodePtr xmlTankdata = xmlNewNode(NULL, BAD_CAST "tankdata");
+        // id is NOT a valid parameter for tankdata
+        guint gasId = g_array_index(dive->gasmixes, guint, mix);
+        xmlNodePtr xmlLink = xmlNewNode(NULL, BAD_CAST "link");
+        xmlNewProp(xmlLink, BAD_CAST "ref", BAD_CAST dif_gas_name(gasId));
+        xmlAddChild(xmlTankdata, xmlLink);
+        xmlAddChild(xmlDive, xmlTankdata);
+
+        // FIXME: this gets the initial pressure of any tank and isn't bound
+        // to the specific tank. Need to see how this actually works in more
+        // detail and understand the numbering that libdivecomputer uses
+        // when creating tanks
+        gdouble initialPressure = summary->initialPressure;
+        if (initialPressure > GAS_EPSILON) {
+            dif_format_fixed(tempStr, MAX_STRING_LENGTH, BAR_TO_PASCAL(initialPressure), 1);
+            xmlNodePtr xmlTankPressureBegin = xmlNewNode(NULL, BAD_CAST "tankpressurebegin");
+            xmlAddChild(xmlTankPressureBegin, xmlNewText(BAD_CAST tempStr));
+            xmlAddChild(xmlTankdata, xmlTankPressureBegin);
         }
     }
 
     /* iterate over all of the samples; samples requires at least one
      * waypoint child, so omit the element entirely when there are none */
     dive = dif_dive_sort_samples(dive);
-    GList *samples = g_list_first(dive->samples);
-    if (samples != NULL) {
+    if (dive->samples->len > 0) {
+        guint i;
         xmlNodePtr xmlSamples = xmlNewNode(NULL, BAD_CAST "samples");
         xmlAddChild(xmlDive, xmlSamples);
-        while (samples != NULL) {
-            xmlNodePtr xmlWaypoint = _createWaypoint(samples->data, options);
+        for (i = 0; i < dive->samples->len; i++) {
+            xmlNodePtr xmlWaypoint = _createWaypoint(g_ptr_array_index(dive->samples, i), options);
             xmlAddChild(xmlSamples, xmlWaypoint);
-            samples = g_list_next(samples);
         }
     }
 
     /* create the informationafterdive field */
     xmlNodePtr xmlInformationAfterDive = xmlNewNode(NULL, BAD_CAST "informationafterdive");
+    uddf_dive_values_t values;
+    _diveValues(dive, summary, &values);
 
-    /* create the lowest temperature field, preferring the device-reported value */
-    gdouble lowestTemperature = dive->hasMinTemperature ? dive->minTemperature : dif_dive_get_lowest_temperature(dive);
-    if (lowestTemperature > 0.1) {
+    /* create the lowest temperature field */
+    if (values.lowestTemperature > 0.1) {
         xmlNodePtr xmlLowestTemperature = xmlNewNode(NULL, BAD_CAST "lowesttemperature");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.1f", (double)CELSIUS_TO_KELVIN(lowestTemperature));
+        dif_format_fixed(tempStr, MAX_STRING_LENGTH, (double)CELSIUS_TO_KELVIN(values.lowestTemperature), 1);
         xmlAddChild(xmlLowestTemperature, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlInformationAfterDive, xmlLowestTemperature);
     }
 
     /* calculate the greatest depth */
     xmlNodePtr xmlGreatestDepth = xmlNewNode(NULL, BAD_CAST "greatestdepth");
-    gdouble greatestDepth = dif_dive_get_greatest_depth(dive);
-    g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.1f", greatestDepth);
+    dif_format_fixed(tempStr, MAX_STRING_LENGTH, values.greatestDepth, 1);
     xmlAddChild(xmlGreatestDepth, xmlNewText(BAD_CAST tempStr));
     xmlAddChild(xmlInformationAfterDive, xmlGreatestDepth);
 
     /* create the dive duration field */
     xmlNodePtr xmlDiveDuration = xmlNewNode(NULL, BAD_CAST "diveduration");
-    guint maxtimestamp = dif_dive_get_dive_duration(dive);
-    g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.1f", (gdouble)maxtimestamp);
+    dif_format_fixed(tempStr, MAX_STRING_LENGTH, values.duration, 1);
     xmlAddChild(xmlDiveDuration, xmlNewText(BAD_CAST tempStr));
     xmlAddChild(xmlInformationAfterDive, xmlDiveDuration);
 
-    /* create the average depth field, preferring the device-reported value */
-    gdouble averageDepth = dive->hasAvgdepth ? dive->avgdepth : dif_dive_get_average_depth(dive);
-    if (averageDepth > 0.0) {
+    /* create the average depth field */
+    if (values.averageDepth > 0.0) {
         xmlNodePtr xmlAverageDepth = xmlNewNode(NULL, BAD_CAST "averagedepth");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.1f", averageDepth);
+        dif_format_fixed(tempStr, MAX_STRING_LENGTH, values.averageDepth, 1);
         xmlAddChild(xmlAverageDepth, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlInformationAfterDive, xmlAverageDepth);
     }
 
-    /* create the pressure drop field, preferring device-reported tank
-     * pressures; the sample fallback pins begin and end to the tank that
-     * produced the first valid reading so multi-tank dives never mix
-     * pressures from different tanks */
-    gdouble beginPressure, endPressure;
-    if (dive->hasTankPressures) {
-        beginPressure = dive->beginPressure;
-        endPressure = dive->endPressure;
-    } else {
-        gint pressureTank = dif_dive_get_initial_pressure_tank(dive);
-        beginPressure = dif_dive_get_initial_pressure(dive, pressureTank);
-        endPressure = dif_dive_get_final_pressure(dive, pressureTank);
-    }
-    if (beginPressure > GAS_EPSILON && endPressure > GAS_EPSILON && beginPressure - endPressure > 0.0) {
+    /* create the pressure drop field */
+    if (values.pressureDrop > 0.0) {
         xmlNodePtr xmlPressureDrop = xmlNewNode(NULL, BAD_CAST "pressuredrop");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.1f", (double)BAR_TO_PASCAL(beginPressure - endPressure));
+        dif_format_fixed(tempStr, MAX_STRING_LENGTH, (double)BAR_TO_PASCAL(values.pressureDrop), 1);
         xmlAddChild(xmlPressureDrop, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlInformationAfterDive, xmlPressureDrop);
     }
 
     xmlAddChild(xmlDive, xmlInformationAfterDive);
 
+    dif_dive_summary_free(summary);
     g_free(tempStr);
+    if (wasCompact) {
+        dive = dif_dive_compact(dive);
+    }
 
     return xmlDive;
 }
 
-xmlNodePtr _createRepetitionGroup(GList *dives, gchar *groupid, xml_options_t *options) {
+/**
+ * create a repetition group from the dives first up to, but not including,
+ * end of the collection
+ */
+xmlNodePtr _createRepetitionGroup(GPtrArray *dives, guint first, guint end, gchar *groupid, xml_options_t *options) {
     xmlNodePtr repetitionGroup = xmlNewNode(NULL, BAD_CAST "repetitiongroup");
     xmlNewProp(repetitionGroup, BAD_CAST "id", BAD_CAST groupid);
 
     guint ctr = 0;
     gchar *diveid = g_malloc(MAX_STRING_LENGTH);
-    dives = g_list_first(dives);
-    while (dives != NULL) {
+    guint i;
+    for (i = first; i < end; i++) {
         g_snprintf(diveid, MAX_STRING_LENGTH, "%s_dive%d", groupid, ctr++);
-        xmlAddChild(repetitionGroup, _createDive(dives->data, diveid, options));
-        dives = g_list_next(dives);
+        xmlAddChild(repetitionGroup, _createDive(g_ptr_array_index(dives, i), diveid, options));
     }
     g_free(diveid);
     return repetitionGroup;
@@ -463,88 +588,70 @@ xmlNodePtr _createProfileData(dif_dive_collection_t *dc, xml_options_t *options)
     dc = dif_dive_collection_sort_dives(dc);
     dc = dif_dive_collection_calculate_surface_interval(dc);
 
-    GList *dives = g_list_first(dc->dives);
-    int year1 = 0, month1 = 0, day1 = 0;
-    int year2 = 0, month2 = 0, day2 = 0;
-    GList *repetitionDives = NULL;
+    /* every day with dives is a repetition group, then every dive
+     * without a date gets a group of its own */
+    const GArray *days = dif_dive_collection_get_days(dc);
     guint groupCtr = 0;
-    while (dives != NULL) {
-        dif_dive_t *dive = dives->data;
-        GDateTime *dt = dive->datetime;
-        /* if a date isn't present, always give it a new repetition group */
-        if (dt != NULL) {
-            g_date_time_get_ymd(dt, &year2, &month2, &day2);
-        } else {
-            /* no date available: force this dive into its own group */
-            year2 = year1 + 1;
-            month2 = 0;
-            day2 = 0;
-        }
-        /* if this next dive doesn't belong to this group, output the current
-         * repetition group and clear the list
-         */
-        if (year1 != year2 || month1 != month2 || day1 != day2) {
-            if (repetitionDives != NULL) {
-                g_snprintf(groupid, MAX_STRING_LENGTH, "group%d", groupCtr++);
-                xmlAddChild(profile_data, _createRepetitionGroup(repetitionDives, groupid, options));
-                g_list_free (repetitionDives);
-            }
-            repetitionDives = NULL;
-        }
-        repetitionDives = g_list_append(repetitionDives, dive);
-        year1 = year2; month1 = month2; day1 = day2;
-        dives = g_list_next(dives);
+    guint i;
+    for (i = 0; i < days->len; i++) {
+        const dif_day_bucket_t *bucket = &g_array_index(days, dif_day_bucket_t, i);
+        g_snprintf(groupid, MAX_STRING_LENGTH, "group%d", groupCtr++);
+        xmlAddChild(profile_data, _createRepetitionGroup(dc->dives, bucket->first, bucket->first + bucket->n,
+                                                         groupid, options));
     }
-    if (repetitionDives != NULL) {
+    /* the dives without a date follow the last bucket */
+    dif_dive_collection_dives_between(dc, G_MAXINT64, G_MAXINT64, &i);
+    for (; i < dc->dives->len; i++) {
         g_snprintf(groupid, MAX_STRING_LENGTH, "group%d", groupCtr++);
-        xmlAddChild(profile_data, _createRepetitionGroup(repetitionDives, groupid, options));
-        g_list_free (repetitionDives);
+        xmlAddChild(profile_data, _createRepetitionGroup(dc->dives, i, i + 1, groupid, options));
     }
     g_free(groupid);
 
     return profile_data;
 }
 
+static gint _gasmix_name_compare(gconstpointer a, gconstpointer b) {
+    const dif_gasmix_t *mix1 = *(const dif_gasmix_t **)a;
+    const dif_gasmix_t *mix2 = *(const dif_gasmix_t **)b;
+    return strcmp(mix1->name, mix2->name);
+}
+
 xmlNodePtr _createGasDefinitions(dif_dive_collection_t *dc, xml_options_t *options) {
-    /* iterate over all of the dives and iterate over their gasmixes
-     * and store the different gas mixes in a hash table
+    /* iterate over all of the dives and collect the distinct gas mixes they
+     * use; the dives only hold gas table ids, so this is a flag per id
      */
-    GList *dives = g_list_first(dc->dives);
-    GHashTable *gasMixes = g_hash_table_new(g_str_hash, g_str_equal);
-    while(dives != NULL) {
-        dif_dive_t *dive = dives->data;
-        GList *diveMixes = g_list_first(dive->gasmixes);
-        while (diveMixes != NULL) {
-            dif_gasmix_t *gasmix = diveMixes->data;
-            gasmix->type = dif_gasmix_type(gasmix);
-            gchar *gasmixName = dif_gasmix_name(gasmix);
-            if (!g_hash_table_contains(gasMixes, gasmixName)) {
-                g_hash_table_insert(gasMixes, gasmixName, gasmix);
+    guint ngases = dif_gas_count();
+    gboolean *used = g_new0(gboolean, MAX(ngases, 1));
+    GPtrArray *gasMixes = g_ptr_array_new();
+    guint i, j;
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_dive_t *dive = g_ptr_array_index(dc->dives, i);
+        for (j = 0; j < dive->gasmixes->len; j++) {
+            guint gasId = g_array_index(dive->gasmixes, guint, j);
+            if (!used[gasId]) {
+                used[gasId] = TRUE;
+                g_ptr_array_add(gasMixes, (gpointer) dif_gas_get(gasId));
             }
-            diveMixes = g_list_next(diveMixes);
         }
-        dives = g_list_next(dives);
     }
+    g_free(used);
 
     /* gasdefinitions requires at least one mix child; omit the element
      * entirely when no gas mixes were found */
-    if (g_hash_table_size(gasMixes) == 0) {
-        g_hash_table_destroy(gasMixes);
+    if (gasMixes->len == 0) {
+        g_ptr_array_free(gasMixes, TRUE);
         return NULL;
     }
 
     xmlNodePtr xmlGasDefinitions = xmlNewNode(NULL, BAD_CAST "gasdefinitions");
 
-    /* iterate over the hash table to output the mixes */
+    /* output the mixes by name, which does not depend on the order the
+     * dives were loaded in */
+    g_ptr_array_sort(gasMixes, _gasmix_name_compare);
     gchar *tempStr = g_malloc(MAX_STRING_LENGTH);
-    GHashTableIter iter;
-    gpointer key, value;
-
-    g_hash_table_iter_init (&iter, gasMixes);
-    while (g_hash_table_iter_next (&iter, &key, &value))
-    {
-        gchar *mixname = (gchar *)key;
-        dif_gasmix_t *gasmix = (dif_gasmix_t *)value;
+    for (i = 0; i < gasMixes->len; i++) {
+        const dif_gasmix_t *gasmix = g_ptr_array_index(gasMixes, i);
+        const gchar *mixname = gasmix->name;
         xmlNodePtr xmlMix = xmlNewNode(NULL, BAD_CAST "mix");
         xmlNewProp(xmlMix, BAD_CAST "id", BAD_CAST mixname);
 
@@ -553,33 +660,34 @@ xmlNodePtr _createGasDefinitions(dif_dive_collection_t *dc, xml_options_t *optio
         xmlAddChild(xmlMix, xmlName);
 
         xmlNodePtr xmlO2 = xmlNewNode(NULL, BAD_CAST "o2");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.4f", gasmix->oxygen/100);
+        dif_format_fixed(tempStr, MAX_STRING_LENGTH, gasmix->oxygen/100, 4);
         xmlAddChild(xmlO2, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlMix, xmlO2);
 
         xmlNodePtr xmlN2 = xmlNewNode(NULL, BAD_CAST "n2");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.4f", gasmix->nitrogen/100);
+        dif_format_fixed(tempStr, MAX_STRING_LENGTH, gasmix->nitrogen/100, 4);
         xmlAddChild(xmlN2, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlMix, xmlN2);
 
         xmlNodePtr xmlHe = xmlNewNode(NULL, BAD_CAST "he");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.4f", gasmix->helium/100);
+        dif_format_fixed(tempStr, MAX_STRING_LENGTH, gasmix->helium/100, 4);
         xmlAddChild(xmlHe, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlMix, xmlHe);
 
         xmlNodePtr xmlAr = xmlNewNode(NULL, BAD_CAST "ar");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.4f", gasmix->argon/100);
+        dif_format_fixed(tempStr, MAX_STRING_LENGTH, gasmix->argon/100, 4);
         xmlAddChild(xmlAr, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlMix, xmlAr);
 
         xmlNodePtr xmlH2 = xmlNewNode(NULL, BAD_CAST "h2");
-        g_snprintf(tempStr, MAX_STRING_LENGTH, "%0.4f", gasmix->hydrogen/100);
+        dif_format_fixed(tempStr, MAX_STRING_LENGTH, gasmix->hydrogen/100, 4);
         xmlAddChild(xmlH2, xmlNewText(BAD_CAST tempStr));
         xmlAddChild(xmlMix, xmlH2);
 
         xmlAddChild(xmlGasDefinitions, xmlMix);
     }
     g_free(tempStr);
+    g_ptr_array_free(gasMixes, TRUE);
 
     return xmlGasDefinitions;
 }
@@ -593,6 +701,13 @@ xml_options_t *dif_xml_options_alloc() {
     xml_options_t *options = g_malloc(sizeof(xml_options_t));
     options->filename = NULL;
     options->useInvalidElements = FALSE;
+    options->writer = DIF_XML_WRITER_TREE;
+    options->threads = 0;
+    options->compression = DIF_COMPRESSION_NONE;
+    options->compressionLevel = 0;
+    options->measureDocument = FALSE;
+    options->documentNodes = 0;
+    options->documentBytes = 0;
     return options;
 }
 
@@ -621,9 +736,706 @@ void dif_save_dive_collection_uddf(dif_dive_collection_t *dc, gchar* filename) {
     dif_xml_options_free(options);
 }
 
+/**
+ * add up the nodes of a document tree and roughly what libxml2 allocated
+ * for them: the structures, names, text content and namespaces
+ */
+static void _measureNode(xmlNodePtr node, gsize *nodes, gsize *bytes) {
+    for (; node != NULL; node = node->next) {
+        xmlAttrPtr attr;
+        xmlNsPtr ns;
+        *nodes += 1;
+        *bytes += sizeof(xmlNode);
+        if (node->name != NULL && node->type == XML_ELEMENT_NODE) {
+            *bytes += xmlStrlen(node->name) + 1;
+        }
+        if (node->content != NULL) {
+            *bytes += xmlStrlen(node->content) + 1;
+        }
+        if (node->type == XML_ELEMENT_NODE) {
+            for (attr = node->properties; attr != NULL; attr = attr->next) {
+                *nodes += 1;
+                *bytes += sizeof(xmlAttr) + xmlStrlen(attr->name) + 1;
+                _measureNode(attr->children, nodes, bytes);
+            }
+            for (ns = node->nsDef; ns != NULL; ns = ns->next) {
+                *nodes += 1;
+                *bytes += sizeof(xmlNs) + xmlStrlen(ns->href) + 1 + xmlStrlen(ns->prefix) + 1;
+            }
+        }
+        _measureNode(node->children, nodes, bytes);
+    }
+}
+
+/**
+ * open the output file of options, compressed with its codec if it has one
+ *
+ * @return the emitter, or NULL after a message if it cannot be opened
+ */
+static dif_emitter_t *_openOutput(xml_options_t *options) {
+    dif_emitter_t *emitter = dif_emitter_open_compressed(options->filename, options->compression,
+                                                         options->compressionLevel);
+    if (emitter == NULL) {
+        printf("** Unable to open %s for writing\n", options->filename);
+    }
+    return emitter;
+}
+
+static void _closeOutput(dif_emitter_t *emitter, xml_options_t *options) {
+    if (!dif_emitter_close(emitter)) {
+        printf("** Unable to write %s\n", options->filename);
+    }
+}
+
+static int _emitterOutputWrite(void *context, const char *buffer, int len) {
+    dif_emitter_t *emitter = context;
+    dif_emitter_write(emitter, buffer, len);
+    return emitter->failed ? -1 : len;
+}
+
+/**
+ * an output buffer for libxml2 that writes into an emitter, so a
+ * compressed file is written without its plain bytes touching the disk.
+ * the emitter outlives the buffer and is closed by the caller.
+ */
+static xmlOutputBufferPtr _emitterOutputBuffer(dif_emitter_t *emitter) {
+    return xmlOutputBufferCreateIO(_emitterOutputWrite, NULL, emitter, NULL);
+}
+
+/**
+ * write a node and everything below it with a text writer, the way
+ * xmlSaveFormatFileEnc would have written it as part of the document
+ */
+static void _writeNode(xmlTextWriterPtr writer, xmlNodePtr node) {
+    xmlAttrPtr attr;
+    xmlNodePtr child;
+    if (node->type == XML_TEXT_NODE) {
+        /* the text writer would also escape quotes, which the document
+         * tree leaves alone in element content */
+        GString *escaped = g_string_sized_new(xmlStrlen(node->content));
+        const xmlChar *c;
+        for (c = node->content; *c != '\0'; c++) {
+            switch (*c) {
+            case '<': g_string_append(escaped, "&lt;"); break;
+            case '>': g_string_append(escaped, "&gt;"); break;
+            case '&': g_string_append(escaped, "&amp;"); break;
+            case '\r': g_string_append(escaped, "&#13;"); break;
+            default: g_string_append_c(escaped, *c); break;
+            }
+        }
+        xmlTextWriterWriteRaw(writer, BAD_CAST escaped->str);
+        g_string_free(escaped, TRUE);
+        return;
+    }
+    if (node->type != XML_ELEMENT_NODE) {
+        return;
+    }
+    xmlTextWriterStartElement(writer, node->name);
+    for (attr = node->properties; attr != NULL; attr = attr->next) {
+        xmlChar *value = xmlNodeListGetString(node->doc, attr->children, 1);
+        xmlTextWriterWriteAttribute(writer, attr->name, value);
+        xmlFree(value);
+    }
+    for (child = node->children; child != NULL; child = child->next) {
+        _writeNode(writer, child);
+    }
+    xmlTextWriterEndElement(writer);
+}
+
+/**
+ * write a subtree and free it, keeping track of the largest one written
+ * when the document is measured
+ */
+static void _writeAndFreeNode(xmlTextWriterPtr writer, xmlNodePtr node, xml_options_t *options) {
+    _writeNode(writer, node);
+    if (options->measureDocument) {
+        gsize nodes = 0, bytes = 0;
+        _measureNode(node, &nodes, &bytes);
+        if (bytes > options->documentBytes) {
+            options->documentNodes = nodes;
+            options->documentBytes = bytes;
+        }
+    }
+    xmlFreeNode(node);
+}
+
+/**
+ * streaming version of _createRepetitionGroup, one dive at a time
+ */
+static void _writeRepetitionGroup(xmlTextWriterPtr writer, GPtrArray *dives, guint first, guint end,
+                                  gchar *groupid, xml_options_t *options) {
+    gchar *diveid = g_malloc(MAX_STRING_LENGTH);
+    guint i;
+    xmlTextWriterStartElement(writer, BAD_CAST "repetitiongroup");
+    xmlTextWriterWriteAttribute(writer, BAD_CAST "id", BAD_CAST groupid);
+    for (i = first; i < end; i++) {
+        g_snprintf(diveid, MAX_STRING_LENGTH, "%s_dive%d", groupid, i - first);
+        _writeAndFreeNode(writer, _createDive(g_ptr_array_index(dives, i), diveid, options), options);
+    }
+    xmlTextWriterEndElement(writer);
+    g_free(diveid);
+}
+
+/**
+ * streaming version of dif_save_dive_collection_uddf_options
+ *
+ * the document is written as the collection is walked, so only the tree of
+ * the dive being written is ever held in memory. the output is the same as
+ * the one of the document tree.
+ */
+static void _saveStreaming(dif_dive_collection_t *dc, xml_options_t *options) {
+    dif_emitter_t *emitter = NULL;
+    xmlTextWriterPtr writer;
+    if (options->compression == DIF_COMPRESSION_NONE) {
+        writer = xmlNewTextWriterFilename(options->filename, 0);
+        if (writer == NULL) {
+            printf("** Unable to open %s for writing\n", options->filename);
+            return;
+        }
+    } else {
+        emitter = _openOutput(options);
+        if (emitter == NULL) {
+            return;
+        }
+        writer = xmlNewTextWriter(_emitterOutputBuffer(emitter));
+    }
+    xmlTextWriterSetIndent(writer, 1);
+    xmlTextWriterSetIndentString(writer, BAD_CAST "  ");
+    xmlTextWriterStartDocument(writer, "1.0", "UTF-8", NULL);
+    xmlTextWriterStartElement(writer, BAD_CAST "uddf");
+    xmlTextWriterWriteAttribute(writer, BAD_CAST "xmlns", BAD_CAST UDDF_NAMESPACE);
+    xmlTextWriterWriteAttribute(writer, BAD_CAST "xmlns:xsi", BAD_CAST "http://www.w3.org/2001/XMLSchema-instance");
+    xmlTextWriterWriteAttribute(writer, BAD_CAST "xsi:schemaLocation", BAD_CAST UDDF_SCHEMA_LOCATION);
+    xmlTextWriterWriteAttribute(writer, BAD_CAST "version", BAD_CAST UDDF_VERSION);
+
+    _writeAndFreeNode(writer, _createGeneratorBlock(options), options);
+    xmlNodePtr gasDefinitions = _createGasDefinitions(dc, options);
+    if (gasDefinitions != NULL) {
+        _writeAndFreeNode(writer, gasDefinitions, options);
+    }
+
+    printf("creating profile data\n");
+    xmlTextWriterStartElement(writer, BAD_CAST "profiledata");
+    gchar *groupid = g_malloc(MAX_STRING_LENGTH);
+    dc = dif_dive_collection_sort_dives(dc);
+    dc = dif_dive_collection_calculate_surface_interval(dc);
+
+    /* the same repetition groups as _createProfileData */
+    const GArray *days = dif_dive_collection_get_days(dc);
+    guint groupCtr = 0;
+    guint i;
+    for (i = 0; i < days->len; i++) {
+        const dif_day_bucket_t *bucket = &g_array_index(days, dif_day_bucket_t, i);
+        g_snprintf(groupid, MAX_STRING_LENGTH, "group%d", groupCtr++);
+        _writeRepetitionGroup(writer, dc->dives, bucket->first, bucket->first + bucket->n, groupid, options);
+    }
+    dif_dive_collection_dives_between(dc, G_MAXINT64, G_MAXINT64, &i);
+    for (; i < dc->dives->len; i++) {
+        g_snprintf(groupid, MAX_STRING_LENGTH, "group%d", groupCtr++);
+        _writeRepetitionGroup(writer, dc->dives, i, i + 1, groupid, options);
+    }
+    g_free(groupid);
+
+    xmlTextWriterEndElement(writer);
+    xmlTextWriterEndDocument(writer);
+    xmlFreeTextWriter(writer);
+    if (emitter != NULL) {
+        _closeOutput(emitter, options);
+    }
+}
+
+/**
+ * state of the direct writer, reused from one waypoint to the next
+ */
+typedef struct uddf_direct_t {
+    dif_emitter_t *emitter;
+    xml_options_t *options;
+    GArray *found;            /* uddf_waypoint_child_t in subsample order */
+    GArray *children;         /* the same in schema order */
+} uddf_direct_t;
+
+/**
+ * _waypointChildren with scratch space that is reused across waypoints
+ */
+static const uddf_waypoint_child_t *_directWaypointChildren(uddf_direct_t *direct, dif_sample_t *sample,
+                                                            guint *nchildren) {
+    if (direct->found->len < WAYPOINT_MAX_CHILDREN(sample)) {
+        g_array_set_size(direct->found, WAYPOINT_MAX_CHILDREN(sample));
+        g_array_set_size(direct->children, WAYPOINT_MAX_CHILDREN(sample));
+    }
+    *nchildren = _waypointChildren(sample, direct->options, (uddf_waypoint_child_t *) direct->found->data,
+                                   (uddf_waypoint_child_t *) direct->children->data);
+    return (const uddf_waypoint_child_t *) direct->children->data;
+}
+
+static void _emitVendor(dif_emitter_t *emitter, const dif_subsample_t *ss) {
+    static const gchar hex[] = "0123456789ABCDEF";
+    const guchar *data = ss->value.vendor.data;
+    guint i;
+    DIF_EMIT_LITERAL(emitter, "            <vendor type=\"");
+    dif_emitter_write_int(emitter, ss->value.vendor.type);
+    DIF_EMIT_LITERAL(emitter, "\" size=\"");
+    dif_emitter_write_int(emitter, ss->value.vendor.size);
+    DIF_EMIT_LITERAL(emitter, "\">");
+    dif_emitter_reserve(emitter, ss->value.vendor.size * 2);
+    for (i = 0; i < ss->value.vendor.size; i++) {
+        emitter->buffer[emitter->len++] = hex[data[i] >> 4];
+        emitter->buffer[emitter->len++] = hex[data[i] & 0xf];
+    }
+    DIF_EMIT_LITERAL(emitter, "</vendor>\n");
+}
+
+static void _emitEvent(dif_emitter_t *emitter, const dif_subsample_t *ss) {
+    DIF_EMIT_LITERAL(emitter, "            <event type=\"");
+    dif_emitter_write_int(emitter, ss->value.event.type);
+    DIF_EMIT_LITERAL(emitter, "\" time=\"");
+    dif_emitter_write_int(emitter, ss->value.event.time);
+    DIF_EMIT_LITERAL(emitter, "\" flags=\"");
+    dif_emitter_write_int(emitter, ss->value.event.flags);
+    DIF_EMIT_LITERAL(emitter, "\" value=\"");
+    dif_emitter_write_int(emitter, ss->value.event.value);
+    DIF_EMIT_LITERAL(emitter, "\">");
+    dif_emitter_write_string(emitter, ss->value.event.type < G_N_ELEMENTS(_eventNames)
+                                      ? _eventNames[ss->value.event.type] : "out-of-range");
+    DIF_EMIT_LITERAL(emitter, "</event>\n");
+}
+
+/**
+ * direct version of _createWaypoint
+ */
+static void _emitWaypoint(uddf_direct_t *direct, dif_sample_t *sample) {
+    dif_emitter_t *emitter = direct->emitter;
+    const uddf_waypoint_child_t *children;
+    guint nchildren, i;
+    gchar level[MAX_STRING_LENGTH];
+    dif_alarm_type_t alarmType;
+
+    children = _directWaypointChildren(direct, sample, &nchildren);
+    DIF_EMIT_LITERAL(emitter, "          <waypoint>\n");
+    for (i = 0; i < nchildren; i++) {
+        const dif_subsample_t *ss = children[i].subsample;
+        switch (children[i].element) {
+        case UDDF_WAYPOINT_ALARM:
+            if (ss->type == DIF_SAMPLE_EVENT) {
+                dif_sample_event_to_alarm(ss->value.event.type, &alarmType);
+                DIF_EMIT_LITERAL(emitter, "            <alarm>");
+            } else {
+                alarmType = ss->value.alarm.type;
+                if (ss->value.alarm.hasLevel) {
+                    g_snprintf(level, sizeof(level), "%g", ss->value.alarm.level);
+                    DIF_EMIT_LITERAL(emitter, "            <alarm level=\"");
+                    dif_emitter_write_string(emitter, level);
+                    DIF_EMIT_LITERAL(emitter, "\">");
+                } else {
+                    DIF_EMIT_LITERAL(emitter, "            <alarm>");
+                }
+            }
+            dif_emitter_write_text(emitter, dif_alarm_type_name(alarmType));
+            DIF_EMIT_LITERAL(emitter, "</alarm>\n");
+            break;
+        case UDDF_WAYPOINT_DEPTH:
+            DIF_EMIT_LITERAL(emitter, "            <depth>");
+            dif_emitter_write_double(emitter, ss->value.depth, 2);
+            DIF_EMIT_LITERAL(emitter, "</depth>\n");
+            break;
+        case UDDF_WAYPOINT_DIVETIME:
+            DIF_EMIT_LITERAL(emitter, "            <divetime>");
+            dif_emitter_write_int(emitter, (gint) sample->timestamp);
+            DIF_EMIT_LITERAL(emitter, "</divetime>\n");
+            break;
+        case UDDF_WAYPOINT_HEADING:
+            DIF_EMIT_LITERAL(emitter, "            <heading>");
+            dif_emitter_write_int(emitter, (gint) ss->value.bearing);
+            DIF_EMIT_LITERAL(emitter, "</heading>\n");
+            break;
+        case UDDF_WAYPOINT_HEARTRATE:
+            DIF_EMIT_LITERAL(emitter, "            <heartrate>");
+            dif_emitter_write_int(emitter, (gint) ss->value.heartbeat);
+            DIF_EMIT_LITERAL(emitter, "</heartrate>\n");
+            break;
+        case UDDF_WAYPOINT_REMAININGBOTTOMTIME:
+            DIF_EMIT_LITERAL(emitter, "            <remainingbottomtime>");
+            dif_emitter_write_int(emitter, (gint) ss->value.rbt);
+            DIF_EMIT_LITERAL(emitter, "</remainingbottomtime>\n");
+            break;
+        case UDDF_WAYPOINT_SETMARKER:
+            DIF_EMIT_LITERAL(emitter, "            <setmarker>");
+            dif_emitter_write_text(emitter, ss->type == DIF_SAMPLE_EVENT ? "bookmark" : ss->value.setmarker);
+            DIF_EMIT_LITERAL(emitter, "</setmarker>\n");
+            break;
+        case UDDF_WAYPOINT_TANKPRESSURE:
+            DIF_EMIT_LITERAL(emitter, "            <tankpressure>");
+            dif_emitter_write_double(emitter, BAR_TO_PASCAL(ss->value.pressure.value), 2);
+            DIF_EMIT_LITERAL(emitter, "</tankpressure>\n");
+            break;
+        case UDDF_WAYPOINT_TEMPERATURE:
+            DIF_EMIT_LITERAL(emitter, "            <temperature>");
+            dif_emitter_write_double(emitter, CELSIUS_TO_KELVIN(ss->value.temperature), 2);
+            DIF_EMIT_LITERAL(emitter, "</temperature>\n");
+            break;
+        default:
+            if (ss->type == DIF_SAMPLE_VENDOR) {
+                _emitVendor(emitter, ss);
+            } else {
+                _emitEvent(emitter, ss);
+            }
+            break;
+        }
+    }
+    DIF_EMIT_LITERAL(emitter, "          </waypoint>\n");
+}
+
+/**
+ * direct version of _createDive
+ */
+static void _emitDive(uddf_direct_t *direct, dif_dive_t *dive, const gchar *diveid) {
+    dif_emitter_t *emitter = direct->emitter;
+    gchar dateTime[MAX_STRING_LENGTH];
+    gboolean wasCompact = dive->compact != NULL;
+    dif_dive_summary_t *summary;
+    uddf_dive_values_t values;
+    guint i;
+
+    dive = dif_dive_expand(dive);
+    summary = dif_dive_compute_summary(dive);
+
+    DIF_EMIT_LITERAL(emitter, "      <dive id=\"");
+    dif_emitter_write_attribute(emitter, diveid);
+    DIF_EMIT_LITERAL(emitter, "\">\n        <informationbeforedive>\n");
+    GDateTime *dt = dif_dive_get_datetime(dive);
+    if (dt != NULL) {
+        _formatDateTime(dt, dateTime);
+        g_date_time_unref(dt);
+        DIF_EMIT_LITERAL(emitter, "          <datetime>");
+        dif_emitter_write_string(emitter, dateTime);
+        DIF_EMIT_LITERAL(emitter, "</datetime>\n");
+    }
+    DIF_EMIT_LITERAL(emitter, "          <surfaceintervalbeforedive>\n");
+    if (dive->surfaceInterval < 0) {
+        DIF_EMIT_LITERAL(emitter, "            <infinity/>\n");
+    } else {
+        DIF_EMIT_LITERAL(emitter, "            <passedtime>");
+        dif_emitter_write_int(emitter, dive->surfaceInterval);
+        DIF_EMIT_LITERAL(emitter, "</passedtime>\n");
+    }
+    DIF_EMIT_LITERAL(emitter, "          </surfaceintervalbeforedive>\n        </informationbeforedive>\n");
+
+    for (i = 0; i < dive->gasmixes->len; i++) {
+        DIF_EMIT_LITERAL(emitter, "        <tankdata>\n          <link ref=\"");
+        dif_emitter_write_attribute(emitter, dif_gas_name(g_array_index(dive->gasmixes, guint, i)));
+        DIF_EMIT_LITERAL(emitter, "\"/>\n");
+        if (summary->initialPressure > GAS_EPSILON) {
+            DIF_EMIT_LITERAL(emitter, "          <tankpressurebegin>");
+            dif_emitter_write_double(emitter, BAR_TO_PASCAL(summary->initialPressure), 1);
+            DIF_EMIT_LITERAL(emitter, "</tankpressurebegin>\n");
+        }
+        DIF_EMIT_LITERAL(emitter, "        </tankdata>\n");
+    }
+
+    dive = dif_dive_sort_samples(dive);
+    if (dive->samples->len > 0) {
+        DIF_EMIT_LITERAL(emitter, "        <samples>\n");
+        for (i = 0; i < dive->samples->len; i++) {
+            _emitWaypoint(direct, g_ptr_array_index(dive->samples, i));
+        }
+        DIF_EMIT_LITERAL(emitter, "        </samples>\n");
+    }
+
+    _diveValues(dive, summary, &values);
+    DIF_EMIT_LITERAL(emitter, "        <informationafterdive>\n");
+    if (values.lowestTemperature > 0.1) {
+        DIF_EMIT_LITERAL(emitter, "          <lowesttemperature>");
+        dif_emitter_write_double(emitter, CELSIUS_TO_KELVIN(values.lowestTemperature), 1);
+        DIF_EMIT_LITERAL(emitter, "</lowesttemperature>\n");
+    }
+    DIF_EMIT_LITERAL(emitter, "          <greatestdepth>");
+    dif_emitter_write_double(emitter, values.greatestDepth, 1);
+    DIF_EMIT_LITERAL(emitter, "</greatestdepth>\n          <diveduration>");
+    dif_emitter_write_double(emitter, values.duration, 1);
+    DIF_EMIT_LITERAL(emitter, "</diveduration>\n");
+    if (values.averageDepth > 0.0) {
+        DIF_EMIT_LITERAL(emitter, "          <averagedepth>");
+        dif_emitter_write_double(emitter, values.averageDepth, 1);
+        DIF_EMIT_LITERAL(emitter, "</averagedepth>\n");
+    }
+    if (values.pressureDrop > 0.0) {
+        DIF_EMIT_LITERAL(emitter, "          <pressuredrop>");
+        dif_emitter_write_double(emitter, BAR_TO_PASCAL(values.pressureDrop), 1);
+        DIF_EMIT_LITERAL(emitter, "</pressuredrop>\n");
+    }
+    DIF_EMIT_LITERAL(emitter, "        </informationafterdive>\n      </dive>\n");
+
+    dif_dive_summary_free(summary);
+    if (wasCompact) {
+        dive = dif_dive_compact(dive);
+    }
+}
+
+/**
+ * a dive for the direct writer to render into a buffer of its own
+ */
+typedef struct uddf_direct_job_t {
+    dif_dive_t *dive;         /* a reference, dropped once the dive is written */
+    guint group;
+    guint index;              /* position of the dive in its repetition group */
+    dif_emitter_t *rendered;  /* the <dive> element, NULL until it is rendered */
+} uddf_direct_job_t;
+
+/**
+ * the worker pool of the direct writer
+ */
+typedef struct uddf_direct_pool_t {
+    GThreadPool *pool;
+    xml_options_t *options;
+    GMutex lock;
+    GCond rendered;           /* signalled whenever a job is done */
+} uddf_direct_pool_t;
+
+static dif_emitter_t *_renderDirectJob(uddf_direct_job_t *job, xml_options_t *options) {
+    uddf_direct_t direct;
+    gchar diveid[MAX_STRING_LENGTH];
+
+    direct.emitter = dif_emitter_new();
+    direct.options = options;
+    direct.found = g_array_new(FALSE, FALSE, sizeof(uddf_waypoint_child_t));
+    direct.children = g_array_new(FALSE, FALSE, sizeof(uddf_waypoint_child_t));
+    g_snprintf(diveid, MAX_STRING_LENGTH, "group%u_dive%u", job->group, job->index);
+    _emitDive(&direct, job->dive, diveid);
+    g_array_free(direct.found, TRUE);
+    g_array_free(direct.children, TRUE);
+    return direct.emitter;
+}
+
+static void _directWorker(gpointer data, gpointer userData) {
+    uddf_direct_job_t *job = data;
+    uddf_direct_pool_t *pool = userData;
+    dif_emitter_t *rendered = _renderDirectJob(job, pool->options);
+
+    g_mutex_lock(&pool->lock);
+    job->rendered = rendered;
+    g_cond_broadcast(&pool->rendered);
+    g_mutex_unlock(&pool->lock);
+}
+
+/**
+ * lay the dives out in the same repetition groups as _createProfileData
+ *
+ * @return an array of uddf_direct_job_t in document order
+ */
+static GArray *_directJobs(dif_dive_collection_t *dc) {
+    const GArray *days = dif_dive_collection_get_days(dc);
+    GArray *jobs = g_array_sized_new(FALSE, FALSE, sizeof(uddf_direct_job_t), dc->dives->len);
+    uddf_direct_job_t job;
+    guint i, j;
+
+    job.group = 0;
+    job.rendered = NULL;
+    for (i = 0; i < days->len; i++) {
+        const dif_day_bucket_t *bucket = &g_array_index(days, dif_day_bucket_t, i);
+        for (j = 0; j < bucket->n; j++) {
+            job.dive = dif_dive_ref(g_ptr_array_index(dc->dives, bucket->first + j));
+            job.index = j;
+            g_array_append_val(jobs, job);
+        }
+        job.group++;
+    }
+    dif_dive_collection_dives_between(dc, G_MAXINT64, G_MAXINT64, &i);
+    for (; i < dc->dives->len; i++) {
+        job.dive = dif_dive_ref(g_ptr_array_index(dc->dives, i));
+        job.index = 0;
+        g_array_append_val(jobs, job);
+        job.group++;
+    }
+    return jobs;
+}
+
+/**
+ * write the repetition groups of a sorted collection whose surface
+ * intervals are worked out
+ *
+ * from there on the dives are independent of each other, so each one is
+ * rendered into a buffer of its own on a pool of workers and the buffers
+ * are written out in document order. at most DIRECT_JOBS_PER_THREAD dives
+ * per worker are queued ahead of the one being written, which bounds the
+ * memory held in buffers however long the logbook is.
+ */
+static void _emitProfileData(dif_emitter_t *emitter, dif_dive_collection_t *dc, xml_options_t *options) {
+    GArray *jobs = _directJobs(dc);
+    guint threads = options->threads > 0 ? options->threads : (guint) g_get_num_processors();
+    uddf_direct_pool_t pool;
+    guint queued = 0;
+    guint i;
+
+    pool.pool = NULL;
+    pool.options = options;
+    g_mutex_init(&pool.lock);
+    g_cond_init(&pool.rendered);
+    if (threads > 1 && jobs->len > 1) {
+        pool.pool = g_thread_pool_new(_directWorker, &pool, MIN(threads, jobs->len), TRUE, NULL);
+    }
+    if (pool.pool != NULL) {
+        for (; queued < jobs->len && queued < threads * DIRECT_JOBS_PER_THREAD; queued++) {
+            g_thread_pool_push(pool.pool, &g_array_index(jobs, uddf_direct_job_t, queued), NULL);
+        }
+    }
+
+    DIF_EMIT_LITERAL(emitter, "  <profiledata>\n");
+    for (i = 0; i < jobs->len; i++) {
+        uddf_direct_job_t *job = &g_array_index(jobs, uddf_direct_job_t, i);
+        if (pool.pool == NULL) {
+            job->rendered = _renderDirectJob(job, options);
+        } else {
+            g_mutex_lock(&pool.lock);
+            while (job->rendered == NULL) {
+                g_cond_wait(&pool.rendered, &pool.lock);
+            }
+            g_mutex_unlock(&pool.lock);
+            if (queued < jobs->len) {
+                g_thread_pool_push(pool.pool, &g_array_index(jobs, uddf_direct_job_t, queued++), NULL);
+            }
+        }
+        if (job->index == 0) {
+            if (i > 0) {
+                DIF_EMIT_LITERAL(emitter, "    </repetitiongroup>\n");
+            }
+            DIF_EMIT_LITERAL(emitter, "    <repetitiongroup id=\"group");
+            dif_emitter_write_int(emitter, job->group);
+            DIF_EMIT_LITERAL(emitter, "\">\n");
+        }
+        dif_emitter_write(emitter, job->rendered->buffer, job->rendered->len);
+        dif_emitter_close(job->rendered);
+        dif_dive_unref(job->dive);
+    }
+    DIF_EMIT_LITERAL(emitter, "    </repetitiongroup>\n  </profiledata>\n");
+
+    if (pool.pool != NULL) {
+        g_thread_pool_free(pool.pool, FALSE, TRUE);
+    }
+    g_mutex_clear(&pool.lock);
+    g_cond_clear(&pool.rendered);
+    g_array_free(jobs, TRUE);
+}
+
+static void _emitGenerator(dif_emitter_t *emitter) {
+    gchar dateTime[MAX_STRING_LENGTH];
+    GDateTime *dt = g_date_time_new_now_utc();
+    _formatDateTime(dt, dateTime);
+    g_date_time_unref(dt);
+
+    DIF_EMIT_LITERAL(emitter, "  <generator>\n    <name>");
+    dif_emitter_write_text(emitter, "dc2uddf");
+    DIF_EMIT_LITERAL(emitter, "</name>\n    <type>");
+    dif_emitter_write_text(emitter, "converter");
+    DIF_EMIT_LITERAL(emitter, "</type>\n    <manufacturer id=\"");
+    dif_emitter_write_attribute(emitter, "dc2uddf");
+    DIF_EMIT_LITERAL(emitter, "\">\n      <name>");
+    dif_emitter_write_text(emitter, DC2UDDF_AUTHOR);
+    DIF_EMIT_LITERAL(emitter, "</name>\n      <contact>\n        <email>");
+    dif_emitter_write_text(emitter, DC2UDDF_EMAIL);
+    DIF_EMIT_LITERAL(emitter, "</email>\n      </contact>\n    </manufacturer>\n    <version>");
+    dif_emitter_write_text(emitter, DC2UDDF_VERSION);
+    DIF_EMIT_LITERAL(emitter, "</version>\n    <datetime>");
+    dif_emitter_write_string(emitter, dateTime);
+    DIF_EMIT_LITERAL(emitter, "</datetime>\n  </generator>\n");
+}
+
+/**
+ * direct version of _createGasDefinitions
+ */
+static void _emitGasDefinitions(dif_emitter_t *emitter, dif_dive_collection_t *dc) {
+    static const gchar *components[] = {"o2", "n2", "he", "ar", "h2"};
+    guint ngases = dif_gas_count();
+    gboolean *used = g_new0(gboolean, MAX(ngases, 1));
+    GPtrArray *gasMixes = g_ptr_array_new();
+    guint i, j;
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_dive_t *dive = g_ptr_array_index(dc->dives, i);
+        for (j = 0; j < dive->gasmixes->len; j++) {
+            guint gasId = g_array_index(dive->gasmixes, guint, j);
+            if (!used[gasId]) {
+                used[gasId] = TRUE;
+                g_ptr_array_add(gasMixes, (gpointer) dif_gas_get(gasId));
+            }
+        }
+    }
+    g_free(used);
+
+    if (gasMixes->len > 0) {
+        g_ptr_array_sort(gasMixes, _gasmix_name_compare);
+        DIF_EMIT_LITERAL(emitter, "  <gasdefinitions>\n");
+        for (i = 0; i < gasMixes->len; i++) {
+            const dif_gasmix_t *gasmix = g_ptr_array_index(gasMixes, i);
+            gdouble fractions[] = {gasmix->oxygen, gasmix->nitrogen, gasmix->helium,
+                                   gasmix->argon, gasmix->hydrogen};
+            DIF_EMIT_LITERAL(emitter, "    <mix id=\"");
+            dif_emitter_write_attribute(emitter, gasmix->name);
+            DIF_EMIT_LITERAL(emitter, "\">\n      <name>");
+            dif_emitter_write_text(emitter, gasmix->name);
+            DIF_EMIT_LITERAL(emitter, "</name>\n");
+            for (j = 0; j < G_N_ELEMENTS(components); j++) {
+                DIF_EMIT_LITERAL(emitter, "      <");
+                dif_emitter_write_string(emitter, components[j]);
+                DIF_EMIT_LITERAL(emitter, ">");
+                dif_emitter_write_double(emitter, fractions[j] / 100, 4);
+                DIF_EMIT_LITERAL(emitter, "</");
+                dif_emitter_write_string(emitter, components[j]);
+                DIF_EMIT_LITERAL(emitter, ">\n");
+            }
+            DIF_EMIT_LITERAL(emitter, "    </mix>\n");
+        }
+        DIF_EMIT_LITERAL(emitter, "  </gasdefinitions>\n");
+    }
+    g_ptr_array_free(gasMixes, TRUE);
+}
+
+/**
+ * direct version of dif_save_dive_collection_uddf_options
+ *
+ * the markup of the fixed UDDF vocabulary is written as literal strings
+ * into the buffer of an emitter, with the indentation libxml2 would use,
+ * and only free text is escaped. nothing is allocated per waypoint.
+ */
+static void _saveDirect(dif_dive_collection_t *dc, xml_options_t *options) {
+    dif_emitter_t *emitter = _openOutput(options);
+    if (emitter == NULL) {
+        return;
+    }
+
+    DIF_EMIT_LITERAL(emitter, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                     "<uddf xmlns=\"" UDDF_NAMESPACE "\" "
+                     "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+                     "xsi:schemaLocation=\"" UDDF_SCHEMA_LOCATION "\" "
+                     "version=\"" UDDF_VERSION "\">\n");
+    _emitGenerator(emitter);
+    _emitGasDefinitions(emitter, dc);
+
+    printf("creating profile data\n");
+    dc = dif_dive_collection_sort_dives(dc);
+    dc = dif_dive_collection_calculate_surface_interval(dc);
+    if (dc->dives->len == 0) {
+        DIF_EMIT_LITERAL(emitter, "  <profiledata/>\n");
+    } else {
+        _emitProfileData(emitter, dc, options);
+    }
+    DIF_EMIT_LITERAL(emitter, "</uddf>\n");
+
+    if (options->measureDocument) {
+        options->documentNodes = 0;
+        options->documentBytes = emitter->size;
+    }
+    _closeOutput(emitter, options);
+}
+
 /**
  * saves a collection of dives to a file
  *
+ * options->writer picks how: the default builds up the document as a tree
+ * first, DIF_XML_WRITER_STREAM writes it as it is created (see
+ * _saveStreaming) and DIF_XML_WRITER_DIRECT leaves libxml2 out
+ * altogether (see _saveDirect). all three write the same bytes.
+ * with options->compression set, those bytes go through the codec on
+ * their way to the file and are never written out plain.
+ *
  * @param dc: collection of dives to save
  * @param options: the set of serialization options
  */
@@ -631,6 +1443,17 @@ void dif_save_dive_collection_uddf_options(dif_dive_collection_t *dc, xml_option
     xmlDocPtr doc = NULL;
     xmlNodePtr root_node = NULL;
     printf("saving file to %s\n", options->filename);
+    if (options->writer == DIF_XML_WRITER_STREAM) {
+        options->documentNodes = 0;
+        options->documentBytes = 0;
+        _saveStreaming(dc, options);
+        xmlCleanupParser();
+        return;
+    }
+    if (options->writer == DIF_XML_WRITER_DIRECT) {
+        _saveDirect(dc, options);
+        return;
+    }
     doc = xmlNewDoc(BAD_CAST "1.0");
     root_node = xmlNewNode(NULL, BAD_CAST "uddf");
     xmlNsPtr nsptr = xmlNewNs(root_node, UDDF_NAMESPACE, NULL);
@@ -646,7 +1469,20 @@ void dif_save_dive_collection_uddf_options(dif_dive_collection_t *dc, xml_option
     printf("creating profile data\n");
     xmlAddChild(root_node, _createProfileData(dc, options));
     printf("saving data\n");
-    xmlSaveFormatFileEnc(options->filename, doc, "UTF-8", 1);
+    if (options->compression == DIF_COMPRESSION_NONE) {
+        xmlSaveFormatFileEnc(options->filename, doc, "UTF-8", 1);
+    } else {
+        dif_emitter_t *emitter = _openOutput(options);
+        if (emitter != NULL) {
+            xmlSaveFormatFileTo(_emitterOutputBuffer(emitter), doc, "UTF-8", 1);
+            _closeOutput(emitter, options);
+        }
+    }
+    if (options->measureDocument) {
+        options->documentNodes = 0;
+        options->documentBytes = sizeof(xmlDoc);
+        _measureNode(doc->children, &options->documentNodes, &options->documentBytes);
+    }
     xmlFreeDoc(doc);
     xmlCleanupParser();
 }
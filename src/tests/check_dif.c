@@ -3,6 +3,10 @@
 #include <string.h>
 #include <math.h>
 #include <check.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include <libxml/parser.h>
 #include <libxml/xpath.h>
 #include "dif/dif.h"
@@ -131,6 +135,135 @@ START_TEST (test_dif_dive_alloc)
 }
 END_TEST
 
+/**
+ * dive start times are plain integers; they must agree with GDateTime for
+ * UTC and local dates, and format with the dive's own offset
+ */
+/**
+ * helper: count the criticals raised by refused calls
+ */
+static void _count_criticals(const gchar *domain, GLogLevelFlags level, const gchar *message, gpointer userdata) {
+    (*(guint *) userdata)++;
+}
+
+START_TEST (test_dif_dive_ref_freeze)
+{
+    dif_dive_collection_t *dc = dif_dive_collection_alloc();
+    dif_dive_t *dive = dif_dive_alloc();
+    dif_dive_t *shared;
+    dif_dive_summary_t *summary;
+    guint i, criticals = 0, handler;
+    guint timestamps[] = {20, 0, 10, 30};
+
+    for (i = 0; i < G_N_ELEMENTS(timestamps); i++) {
+        dif_sample_t *sample = dif_dive_alloc_sample(dive);
+        dif_subsample_t *ss = dif_dive_alloc_subsample(dive);
+        sample->timestamp = timestamps[i];
+        ss->type = DIF_SAMPLE_DEPTH;
+        ss->value.depth = timestamps[i] / 2.0;
+        dif_sample_add_subsample(sample, ss);
+        dive = dif_dive_add_sample(dive, sample);
+    }
+    dc = dif_dive_collection_add_dive(dc, dive);
+    dive = dif_dive_compact(dive);
+    shared = dif_dive_ref(dive);
+    fail_unless(shared == dive && dive->refcount == 2);
+
+    /* freezing expands, sorts and builds every cache up front */
+    dc = dif_dive_collection_freeze(dc);
+    fail_unless(dif_dive_is_frozen(dive));
+    fail_unless(dive->compact == NULL && dive->samples->len == 4, "frozen dive should be expanded");
+    fail_unless(dive->samplesSorted && dive->profile != NULL && dive->sampleIndex != NULL && dive->stats != NULL,
+                "frozen dive should have all of its caches");
+    fail_unless(((dif_sample_t *) g_ptr_array_index(dive->samples, 0))->timestamp == 0);
+
+    /* anything that would change the dive is refused */
+    handler = g_log_set_handler(NULL, G_LOG_LEVEL_CRITICAL, _count_criticals, &criticals);
+    fail_unless(dif_dive_alloc_sample(dive) == NULL);
+    dive = dif_dive_set_duration(dive, 99);
+    dive = dif_dive_add_alarm(dive, 10, DIF_ALARM_ERROR, 0.0, FALSE);
+    dive = dif_alg_dive_truncate_dive(dive);
+    dive = dif_dive_compact(dive);
+    g_log_remove_handler(NULL, handler);
+    fail_unless(criticals == 5, "expected 5 refused calls, got %u", criticals);
+    fail_unless(dive->duration != 99 && dive->compact == NULL && dive->samples->len == 4);
+    fail_unless(!DIF_SAMPLE_HAS(dif_dive_find_sample(dive, 10), DIF_SAMPLE_ALARM));
+
+    /* the dive outlives the collection while a reference is held */
+    dif_dive_collection_free(dc);
+    fail_unless(shared->refcount == 1);
+    summary = dif_dive_compute_summary(shared);
+    fail_unless(summary->duration == 30 && ABS(summary->greatestDepth - 15.0) < 0.001);
+    dif_dive_summary_free(summary);
+    dif_dive_unref(shared);
+}
+END_TEST
+
+START_TEST (test_dif_dive_set_datetime)
+{
+    guint dates[][6] = {
+        {2012, 2, 1, 12, 0, 0}, {2000, 2, 29, 23, 59, 59}, {1969, 12, 31, 6, 30, 0},
+        {2024, 3, 31, 2, 30, 0}, {2038, 1, 19, 3, 14, 8}, {1900, 3, 1, 0, 0, 0}
+    };
+    dif_dive_t *dive = dif_dive_alloc();
+    guint ctr;
+    for (ctr = 0; ctr < G_N_ELEMENTS(dates); ctr++) {
+        guint *d = dates[ctr];
+        GDateTime *dt = g_date_time_new_utc(d[0], d[1], d[2], d[3], d[4], d[5]);
+        dive = dif_dive_set_datetime_utc(dive, d[0], d[1], d[2], d[3], d[4], d[5]);
+        fail_unless(dive->hasStartTime && dive->utcOffset == 0);
+        fail_unless(dive->startTime == g_date_time_to_unix(dt), "utc mismatch for date %u", ctr);
+        g_date_time_unref(dt);
+
+        dt = g_date_time_new_local(d[0], d[1], d[2], d[3], d[4], d[5]);
+        dive = dif_dive_set_datetime(dive, d[0], d[1], d[2], d[3], d[4], d[5]);
+        fail_unless(dive->startTime == g_date_time_to_unix(dt), "local mismatch for date %u", ctr);
+        fail_unless(dive->utcOffset == g_date_time_get_utc_offset(dt) / G_TIME_SPAN_SECOND);
+        g_date_time_unref(dt);
+    }
+
+    /* late in the evening west of Greenwich is still the same local day */
+    dive = dif_dive_set_datetime_offset(dive, 2012, 2, 1, 23, 30, 0, -5 * 3600);
+    dif_dive_t *other = dif_dive_alloc();
+    other = dif_dive_set_datetime_utc(other, 2012, 2, 1, 0, 0, 0);
+    fail_unless(dif_dive_get_local_day(dive) == dif_dive_get_local_day(other));
+    fail_unless(dif_dive_get_local_day(other) == 15371);
+    other = dif_dive_set_datetime_utc(other, 1969, 12, 31, 23, 59, 59);
+    fail_unless(dif_dive_get_local_day(other) == -1);
+
+    GDateTime *dt = dif_dive_get_datetime(dive);
+    gchar *formatted = g_date_time_format(dt, "%Y-%m-%dT%H:%M:%S%z");
+    fail_unless(strcmp(formatted, "2012-02-01T23:30:00-0500") == 0, "got %s", formatted);
+    g_free(formatted);
+    g_date_time_unref(dt);
+
+    dive->hasStartTime = FALSE;
+    fail_unless(dif_dive_get_datetime(dive) == NULL);
+
+    /* a dive computer without a date reports all zeroes */
+    guint invalid[][6] = {
+        {0, 0, 0, 0, 0, 0}, {2012, 2, 30, 12, 0, 0}, {2012, 13, 1, 12, 0, 0},
+        {10000, 1, 1, 0, 0, 0}, {2012, 2, 1, 24, 0, 0}, {2012, 2, 1, 12, 60, 0}, {2012, 2, 1, 12, 0, 60}
+    };
+    for (ctr = 0; ctr < G_N_ELEMENTS(invalid); ctr++) {
+        guint *d = invalid[ctr];
+        other = dif_dive_set_datetime_utc(other, 2012, 2, 1, 0, 0, 0);
+        other = dif_dive_set_datetime_utc(other, d[0], d[1], d[2], d[3], d[4], d[5]);
+        fail_unless(!other->hasStartTime, "date %u should be refused", ctr);
+        dive = dif_dive_set_datetime(dive, 2012, 2, 1, 0, 0, 0);
+        dive = dif_dive_set_datetime(dive, d[0], d[1], d[2], d[3], d[4], d[5]);
+        fail_unless(!dive->hasStartTime, "local date %u should be refused", ctr);
+    }
+
+    /* a start time GDateTime cannot hold has no date either */
+    dive->hasStartTime = TRUE;
+    dive->startTime = G_GINT64_CONSTANT(-70000000000);
+    fail_unless(dif_dive_get_datetime(dive) == NULL);
+    dif_dive_free(other);
+    dif_dive_free(dive);
+}
+END_TEST
+
 START_TEST (test_dif_sample_alloc)
 {
     dif_sample_t *sample = NULL;
@@ -168,12 +301,165 @@ START_TEST (test_dif_dive_collection_add_dive)
     dc = dif_dive_collection_alloc();
     dive = dif_dive_alloc();
     dc = dif_dive_collection_add_dive(dc, dive);
-    fail_unless(g_list_length(dc->dives) == 1,
+    fail_unless(dc->dives->len == 1,
                 "dive not properly added");
     dif_dive_collection_free(dc);
 }
 END_TEST
 
+/**
+ * a large collection added in reverse order sorts by date, dives without a
+ * date go to the end and keep the order they were added in
+ */
+START_TEST (test_dif_dive_collection_sort_dives)
+{
+    dif_dive_collection_t *dc = dif_dive_collection_alloc();
+    guint ctr;
+    for (ctr = 0; ctr < 20000; ctr++) {
+        dif_dive_t *dive = dif_dive_alloc();
+        if (ctr % 1000 == 0) {
+            dive->hasStartTime = FALSE;
+            dive->duration = ctr;
+        } else {
+            dive = dif_dive_set_datetime_utc(dive, 2020, 1, 1, 0, 0, 0);
+            dive->startTime += 20000 - ctr;
+        }
+        dc = dif_dive_collection_add_dive(dc, dive);
+    }
+    dc = dif_dive_collection_sort_dives(dc);
+    fail_unless(dc->dives->len == 20000);
+    for (ctr = 1; ctr < dc->dives->len; ctr++) {
+        dif_dive_t *previous = g_ptr_array_index(dc->dives, ctr - 1);
+        dif_dive_t *dive = g_ptr_array_index(dc->dives, ctr);
+        if (!dive->hasStartTime) {
+            fail_unless(previous->hasStartTime || previous->duration < dive->duration,
+                        "undated dives should keep their order");
+        } else {
+            fail_unless(previous->hasStartTime && previous->startTime < dive->startTime,
+                        "dives out of order at %u", ctr);
+        }
+    }
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * helper: check that dives are in date order and that dives with the same
+ * date kept the order they were added in, which is stored in duration
+ */
+static gboolean _dives_stably_sorted(dif_dive_collection_t *dc) {
+    guint i;
+    for (i = 1; i < dc->dives->len; i++) {
+        dif_dive_t *previous = g_ptr_array_index(dc->dives, i - 1);
+        dif_dive_t *dive = g_ptr_array_index(dc->dives, i);
+        if (previous->startTime > dive->startTime ||
+            (previous->startTime == dive->startTime && previous->duration > dive->duration)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * the runs a merge sort finds: newest first with ties, and shuffled dates
+ * with many ties
+ */
+START_TEST (test_dif_dive_collection_sort_dives_runs)
+{
+    dif_dive_collection_t *dc = dif_dive_collection_alloc();
+    guint32 seed = 12345;
+    guint ctr;
+
+    /* dives come in pairs with the same date, newest pair first */
+    for (ctr = 0; ctr < 1000; ctr++) {
+        dif_dive_t *dive = dif_dive_alloc();
+        dive = dif_dive_set_datetime_utc(dive, 2020, 1, 1, 0, 0, 0);
+        dive->startTime += 1000 - ctr / 2;
+        dive->duration = ctr;
+        dc = dif_dive_collection_add_dive(dc, dive);
+    }
+    dc = dif_dive_collection_sort_dives(dc);
+    fail_unless(dc->dives->len == 1000 && _dives_stably_sorted(dc), "paired dives not stably sorted");
+    dif_dive_collection_free(dc);
+
+    dc = dif_dive_collection_alloc();
+    for (ctr = 0; ctr < 5000; ctr++) {
+        dif_dive_t *dive = dif_dive_alloc();
+        seed = seed * 1103515245 + 12345;
+        dive = dif_dive_set_datetime_utc(dive, 2020, 1, 1, 0, 0, 0);
+        dive->startTime += (seed >> 16) % 100;
+        dive->duration = ctr;
+        dc = dif_dive_collection_add_dive(dc, dive);
+    }
+    dc = dif_dive_collection_sort_dives(dc);
+    fail_unless(dc->dives->len == 5000 && _dives_stably_sorted(dc), "shuffled dives not stably sorted");
+
+    /* sorting again leaves everything where it is */
+    dc = dif_dive_collection_sort_dives(dc);
+    fail_unless(_dives_stably_sorted(dc));
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * dives bucketed by their local day, with the undated ones after the
+ * last bucket
+ */
+START_TEST (test_dif_dive_collection_days)
+{
+    dif_dive_collection_t *dc = dif_dive_collection_alloc();
+    const GArray *days;
+    const dif_day_bucket_t *bucket;
+    gint64 day1 = dif_days_from_civil(2021, 6, 1);
+    guint first, n;
+    dif_dive_t *dive;
+
+    fail_unless(dif_days_from_civil(1970, 1, 1) == 0);
+    fail_unless(dif_days_from_civil(1969, 12, 31) == -1);
+    fail_unless(dif_days_from_civil(2000, 3, 1) == 11017);
+
+    /* added newest first like a download, two dives on June 3rd */
+    dc = dif_dive_collection_add_dive(dc, dif_dive_set_datetime_offset(dif_dive_alloc(), 2021, 6, 3, 15, 0, 0, 7200));
+    dc = dif_dive_collection_add_dive(dc, dif_dive_set_datetime_offset(dif_dive_alloc(), 2021, 6, 3, 9, 0, 0, 7200));
+    /* 23:30 local on June 1st is already June 2nd in UTC */
+    dc = dif_dive_collection_add_dive(dc, dif_dive_set_datetime_offset(dif_dive_alloc(), 2021, 6, 1, 23, 30, 0, -3600));
+    dive = dif_dive_alloc();
+    dive->hasStartTime = FALSE;
+    dc = dif_dive_collection_add_dive(dc, dive);
+
+    days = dif_dive_collection_get_days(dc);
+    fail_unless(days->len == 2, "expected 2 days, got %u", days->len);
+    bucket = &g_array_index(days, dif_day_bucket_t, 0);
+    fail_unless(bucket->day == day1 && bucket->first == 0 && bucket->n == 1);
+    bucket = &g_array_index(days, dif_day_bucket_t, 1);
+    fail_unless(bucket->day == day1 + 2 && bucket->first == 1 && bucket->n == 2);
+    fail_unless(dif_dive_collection_get_days(dc) == days, "the index should be kept");
+
+    fail_unless(dif_dive_collection_find_day(dc, day1 + 1) == NULL);
+    bucket = dif_dive_collection_find_day(dc, day1 + 2);
+    fail_unless(bucket != NULL && bucket->n == 2);
+    fail_unless(((dif_dive_t *) g_ptr_array_index(dc->dives, bucket->first))->startTime <
+                ((dif_dive_t *) g_ptr_array_index(dc->dives, bucket->first + 1))->startTime);
+
+    n = dif_dive_collection_dives_between(dc, day1 + 1, G_MAXINT64, &first);
+    fail_unless(first == 1 && n == 2, "since filter should find the June 3rd dives");
+    n = dif_dive_collection_dives_between(dc, G_MININT64, day1 + 2, &first);
+    fail_unless(first == 0 && n == 1);
+    n = dif_dive_collection_dives_between(dc, day1 + 3, day1 + 10, &first);
+    fail_unless(first == 3 && n == 0, "the undated dive should follow the last bucket");
+    n = dif_dive_collection_dives_between(dc, day1 + 2, day1, &first);
+    fail_unless(n == 0);
+
+    /* a new dive drops the index */
+    dc = dif_dive_collection_add_dive(dc, dif_dive_set_datetime_offset(dif_dive_alloc(), 2021, 6, 2, 10, 0, 0, 0));
+    fail_unless(dc->days == NULL);
+    bucket = dif_dive_collection_find_day(dc, day1 + 1);
+    fail_unless(bucket != NULL && bucket->first == 1 && bucket->n == 1);
+    fail_unless(dif_dive_collection_get_days(dc)->len == 3);
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
 START_TEST (test_dif_dive_add_sample)
 {
     dif_dive_t *dive = NULL;
@@ -183,8 +469,93 @@ START_TEST (test_dif_dive_add_sample)
     sample = dif_sample_alloc();
 
     dive = dif_dive_add_sample(dive, sample);
-    fail_unless(g_list_length(dive->samples) == 1,
+    fail_unless(dive->samples->len == 1,
                 "sample not properly added");
+    fail_unless(g_ptr_array_index(dive->samples, 0) == sample,
+                "sample not reachable by index");
+    dif_dive_free(dive);
+}
+END_TEST
+
+/**
+ * a multi-hour dive at a one second interval; appends are amortized O(1)
+ * so this stays fast, and every sample must be reachable by index
+ */
+START_TEST (test_dif_dive_add_many_samples)
+{
+    dif_dive_t *dive = dif_dive_alloc();
+    guint nsamples = 6 * 3600;
+    guint ctr;
+    for (ctr = 0; ctr < nsamples; ctr++) {
+        dif_sample_t *sample = dif_sample_alloc();
+        sample->timestamp = ctr;
+        dive = dif_dive_add_sample(dive, sample);
+    }
+    fail_unless(dive->samples->len == nsamples,
+                "expected %u samples, got %u", nsamples, dive->samples->len);
+    for (ctr = 0; ctr < nsamples; ctr += 997) {
+        dif_sample_t *sample = g_ptr_array_index(dive->samples, ctr);
+        fail_unless(sample->timestamp == ctr,
+                    "sample %u has timestamp %u", ctr, sample->timestamp);
+    }
+    fail_unless(dif_dive_get_dive_duration(dive) == nsamples - 1);
+    dif_dive_free(dive);
+}
+END_TEST
+
+/**
+ * an hour at one second intervals with depth, temperature and a vendor
+ * payload per sample. through the heap API that is one allocation per
+ * sample, per subsample, per payload and per subsample array; from the
+ * dive's arena it is a handful of blocks
+ */
+START_TEST (test_dif_dive_arena_allocations)
+{
+    dif_dive_t *dive = dif_dive_alloc();
+    guint nsamples = 3600;
+    guint8 payload[16] = {0};
+    guint heapAllocations = 0;
+    guint ctr;
+    for (ctr = 0; ctr < nsamples; ctr++) {
+        dif_sample_t *sample = dif_dive_alloc_sample(dive);
+        sample->timestamp = ctr;
+        dive = dif_dive_add_sample(dive, sample);
+        dif_subsample_t *ssdepth = dif_dive_alloc_subsample(dive);
+        ssdepth->type = DIF_SAMPLE_DEPTH;
+        ssdepth->value.depth = 10.0;
+        dif_sample_add_subsample(sample, ssdepth);
+        dif_subsample_t *sstemp = dif_dive_alloc_subsample(dive);
+        sstemp->type = DIF_SAMPLE_TEMPERATURE;
+        sstemp->value.temperature = 20.0;
+        dif_sample_add_subsample(sample, sstemp);
+        payload[0] = ctr & 0xff;
+        dif_subsample_t *ssvendor = dif_dive_alloc_subsample(dive);
+        dif_dive_subsample_set_vendor(dive, ssvendor, 1, sizeof(payload), payload);
+        dif_sample_add_subsample(sample, ssvendor);
+        /* sample, three subsamples, one payload, one subsample array */
+        heapAllocations += 6;
+    }
+    fail_unless(dive->nHeapOwned == 0, "arena samples should not be counted as heap owned");
+    fail_unless(dive->arena->nallocations == heapAllocations,
+                "expected %u arena allocations, got %u", heapAllocations, dive->arena->nallocations);
+    fail_unless(dive->arena->nblocks * 100 < heapAllocations,
+                "%u heap allocations took %u arena blocks", heapAllocations, dive->arena->nblocks);
+
+    dif_sample_t *sample = g_ptr_array_index(dive->samples, 1234);
+    dif_subsample_t *ssvendor = dif_sample_get_subsample(sample, DIF_SAMPLE_VENDOR);
+    fail_unless(ssvendor->value.vendor.size == sizeof(payload) &&
+                ((guint8 *) ssvendor->value.vendor.data)[0] == (1234 & 0xff),
+                "vendor payload not copied into the arena");
+    fail_unless(fabs(dif_dive_get_greatest_depth(dive) - 10.0) < 0.001);
+
+    /* heap samples can still be mixed in and are released with the dive */
+    sample = dif_sample_alloc();
+    sample->timestamp = nsamples;
+    dif_subsample_t *ssmarker = dif_subsample_alloc();
+    dif_dive_subsample_set_setmarker(dive, ssmarker, "heap");
+    dif_sample_add_subsample(sample, ssmarker);
+    dive = dif_dive_add_sample(dive, sample);
+    fail_unless(dive->nHeapOwned == 1, "heap sample should be counted");
     dif_dive_free(dive);
 }
 END_TEST
@@ -198,7 +569,7 @@ START_TEST (test_dif_dive_add_gasmix)
     gasmix = dif_gasmix_alloc();
 
     dive = dif_dive_add_gasmix(dive, gasmix);
-    fail_unless(g_list_length(dive->gasmixes) == 1,
+    fail_unless(dive->gasmixes->len == 1,
                 "gasmix not properly added");
     dif_dive_free(dive);
 }
@@ -213,12 +584,46 @@ START_TEST (test_dif_sample_add_subsample)
     subsample = dif_subsample_alloc();
 
     sample = dif_sample_add_subsample(sample, subsample);
-    fail_unless(g_list_length(sample->subsamples) == 1,
+    fail_unless(sample->nsubsamples == 1,
                 "subsample not properly added");
     dif_sample_free(sample);
 }
 END_TEST
 
+/**
+ * lookups by type go through the presence mask and slot table; a second
+ * subsample of a type is kept but the first one stays the answer
+ */
+START_TEST (test_dif_sample_get_subsample)
+{
+    dif_sample_t *sample = dif_sample_alloc();
+    dif_subsample_t *tank1 = dif_subsample_alloc();
+    tank1->type = DIF_SAMPLE_PRESSURE;
+    tank1->value.pressure.tank = 1;
+    dif_subsample_t *ssdepth = dif_subsample_alloc();
+    ssdepth->type = DIF_SAMPLE_DEPTH;
+    dif_subsample_t *tank2 = dif_subsample_alloc();
+    tank2->type = DIF_SAMPLE_PRESSURE;
+    tank2->value.pressure.tank = 2;
+
+    fail_unless(dif_sample_get_subsample(sample, DIF_SAMPLE_DEPTH) == NULL,
+                "empty sample should have no depth");
+    sample = dif_sample_add_subsample(sample, tank1);
+    sample = dif_sample_add_subsample(sample, ssdepth);
+    sample = dif_sample_add_subsample(sample, tank2);
+    fail_unless(sample->nsubsamples == 3, "all subsamples should be kept");
+    fail_unless(DIF_SAMPLE_HAS(sample, DIF_SAMPLE_PRESSURE) && DIF_SAMPLE_HAS(sample, DIF_SAMPLE_DEPTH),
+                "presence mask not updated");
+    fail_unless(!DIF_SAMPLE_HAS(sample, DIF_SAMPLE_TEMPERATURE), "no temperature was added");
+    fail_unless(dif_sample_get_subsample(sample, DIF_SAMPLE_DEPTH) == ssdepth, "depth lookup failed");
+    fail_unless(dif_sample_get_subsample(sample, DIF_SAMPLE_PRESSURE) == tank1,
+                "the first pressure subsample should win");
+    fail_unless(dif_sample_get_subsample(sample, DIF_SAMPLE_TEMPERATURE) == NULL,
+                "missing types should return NULL");
+    dif_sample_free(sample);
+}
+END_TEST
+
 START_TEST (test_dif_dive_set_avgdepth)
 {
     dif_dive_t *dive = dif_dive_alloc();
@@ -266,7 +671,7 @@ END_TEST
 START_TEST (test_dif_dive_get_final_pressure)
 {
     dif_dive_collection_t *dc = _create_simple_dive_collection();
-    dif_dive_t *dive = g_list_first(dc->dives)->data;
+    dif_dive_t *dive = g_ptr_array_index(dc->dives, 0);
     fail_unless(fabs(dif_dive_get_final_pressure(dive, -1) - 177.5) < 0.001,
                 "final pressure for any tank should be 177.5");
     fail_unless(fabs(dif_dive_get_final_pressure(dive, 1) - 177.5) < 0.001,
@@ -296,7 +701,7 @@ END_TEST
 START_TEST (test_dif_dive_get_initial_pressure_tank)
 {
     dif_dive_collection_t *dc = _create_simple_dive_collection();
-    dif_dive_t *dive = g_list_first(dc->dives)->data;
+    dif_dive_t *dive = g_ptr_array_index(dc->dives, 0);
     fail_unless(dif_dive_get_initial_pressure_tank(dive) == 1,
                 "initial pressure tank of dive1 should be 1");
     dif_dive_collection_free(dc);
@@ -343,10 +748,689 @@ START_TEST (test_dif_dive_pressures_multi_tank)
 }
 END_TEST
 
+static dif_sample_t *_add_pressure(dif_sample_t *sample, guint tank, gdouble value) {
+    dif_subsample_t *ss = dif_subsample_alloc();
+    ss->type = DIF_SAMPLE_PRESSURE;
+    ss->value.pressure.tank = tank;
+    ss->value.pressure.value = value;
+    return dif_sample_add_subsample(sample, ss);
+}
+
+/**
+ * two transmitters in every sample, listed in either order: as with
+ * dif_sample_get_subsample only the first pressure of a sample counts,
+ * also for the per-tank getters
+ */
+START_TEST (test_dif_sample_slice_pressures_shared_sample)
+{
+    guint   firstTanks[] = {1, 2, 1, 2};
+    gdouble tank1[]      = {200.0, 190.0, 180.0, 170.0};
+    gdouble tank2[]      = {100.0, 95.0, 90.0, 85.0};
+    dif_dive_t *dive = dif_dive_alloc();
+    guint ctr;
+    for (ctr = 0; ctr < G_N_ELEMENTS(firstTanks); ctr++) {
+        dif_sample_t *sample = dif_sample_alloc();
+        sample->timestamp = ctr * 10;
+        if (firstTanks[ctr] == 1) {
+            sample = _add_pressure(sample, 1, tank1[ctr]);
+            sample = _add_pressure(sample, 2, tank2[ctr]);
+        } else {
+            sample = _add_pressure(sample, 2, tank2[ctr]);
+            sample = _add_pressure(sample, 1, tank1[ctr]);
+        }
+        dive = dif_dive_add_sample(dive, sample);
+    }
+
+    dif_sample_slice_t slice = dif_dive_samples_in_range(dive, 0, G_MAXUINT);
+    fail_unless(fabs(dif_sample_slice_get_initial_pressure(&slice, -1) - 200.0) < 1e-9);
+    fail_unless(fabs(dif_sample_slice_get_final_pressure(&slice, -1) - 85.0) < 1e-9);
+    fail_unless(fabs(dif_sample_slice_get_initial_pressure(&slice, 1) - 200.0) < 1e-9);
+    fail_unless(fabs(dif_sample_slice_get_final_pressure(&slice, 1) - 180.0) < 1e-9,
+                "tank 1 is listed second at 30s, its last reading is the one at 20s");
+    fail_unless(fabs(dif_sample_slice_get_initial_pressure(&slice, 2) - 95.0) < 1e-9,
+                "tank 2 is listed second at 0s, its first reading is the one at 10s");
+    fail_unless(fabs(dif_sample_slice_get_final_pressure(&slice, 2) - 85.0) < 1e-9);
+    fail_unless(fabs(dif_sample_slice_get_initial_pressure(&slice, 3)) < 1e-9);
+    fail_unless(dif_sample_slice_get_initial_pressure_tank(&slice) == 1);
+    dif_dive_free(dive);
+}
+END_TEST
+
+/**
+ * the profile lays dive1 out as columns in timestamp order, with presence
+ * bits for the channels each sample reported, and is rebuilt once the
+ * dive changes
+ */
+START_TEST (test_dif_dive_get_profile)
+{
+    dif_dive_collection_t *dc = _create_simple_dive_collection();
+    dif_dive_t *dive = g_ptr_array_index(dc->dives, 0);
+    const dif_profile_t *profile = dif_dive_get_profile(dive);
+    fail_unless(profile->nrows == 6, "expected 6 rows, got %u", profile->nrows);
+    fail_unless(profile->timestamp[5] == 150, "last row should be at 150s");
+    fail_unless(fabs(profile->depth[2] - 2.0) < 0.001, "depth column mismatch");
+    fail_unless(DIF_PROFILE_HAS(profile->depthPresent, 0), "depth 0.0 should still be present");
+    fail_unless(fabs(profile->temperature[3] - 20.0) < 0.001, "temperature column mismatch");
+    fail_unless(!DIF_PROFILE_HAS(profile->rbtPresent, 0), "dive1 has no rbt samples");
+    fail_unless(profile->ntanks == 1 && profile->tanks[0].tank == 1,
+                "dive1 should have a single pressure column for tank 1");
+    fail_unless(fabs(profile->tanks[0].pressure[5] - 177.5) < 0.001, "pressure column mismatch");
+    fail_unless(dif_dive_get_profile(dive) == profile, "profile should be cached");
+
+    /* an out of order sample lands in its timestamp row after a rebuild */
+    dif_sample_t *sample = dif_sample_alloc();
+    sample->timestamp = 45;
+    dive = dif_dive_add_sample(dive, sample);
+    dif_subsample_t *ssdepth = dif_subsample_alloc();
+    ssdepth->type = DIF_SAMPLE_DEPTH;
+    ssdepth->value.depth = 3.0;
+    dif_sample_add_subsample(sample, ssdepth);
+    profile = dif_dive_get_profile(dive);
+    fail_unless(profile->nrows == 7, "expected 7 rows after adding a sample");
+    fail_unless(profile->timestamp[2] == 45, "new sample should be row 2");
+    fail_unless(fabs(profile->depth[2] - 3.0) < 0.001, "subsample added after the sample is missing");
+    fail_unless(!DIF_PROFILE_HAS(profile->temperaturePresent, 2), "new row has no temperature");
+    fail_unless(fabs(dif_dive_get_greatest_depth(dive) - 3.0) < 0.001, "greatest depth should be 3.0");
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * in-order appends keep the dive sorted; one late sample flips the flag
+ * and the next sort puts it in place
+ */
+START_TEST (test_dif_dive_sort_samples)
+{
+    guint timestamps[] = {0, 10, 10, 20, 5};
+    dif_dive_t *dive = dif_dive_alloc();
+    guint ctr;
+    for (ctr = 0; ctr < G_N_ELEMENTS(timestamps); ctr++) {
+        dif_sample_t *sample = dif_sample_alloc();
+        sample->timestamp = timestamps[ctr];
+        dive = dif_dive_add_sample(dive, sample);
+        if (ctr == 3) {
+            fail_unless(dive->samplesSorted, "in-order appends should keep the dive sorted");
+        }
+    }
+    fail_unless(!dive->samplesSorted, "an earlier timestamp should mark the dive unsorted");
+    dif_sample_t *late = g_ptr_array_index(dive->samples, 4);
+    dive = dif_dive_sort_samples(dive);
+    fail_unless(dive->samplesSorted, "sorting should mark the dive sorted");
+    fail_unless(g_ptr_array_index(dive->samples, 1) == late, "late sample should move to index 1");
+    fail_unless(((dif_sample_t *) g_ptr_array_index(dive->samples, 4))->timestamp == 20);
+    dif_dive_free(dive);
+}
+END_TEST
+
+/**
+ * the one-pass summary must agree with each of the individual getters,
+ * and report begin/end pressures per tank
+ */
+START_TEST (test_dif_dive_compute_summary)
+{
+    dif_dive_collection_t *dc = _create_simple_dive_collection();
+    guint ctr;
+    for (ctr = 0; ctr < dc->dives->len; ctr++) {
+        dif_dive_t *dive = g_ptr_array_index(dc->dives, ctr);
+        dif_dive_summary_t *summary = dif_dive_compute_summary(dive);
+        /* make the getters scan the samples rather than reuse the summary */
+        dif_dive_invalidate_caches(dive);
+        gint tank = dif_dive_get_initial_pressure_tank(dive);
+        fail_unless(summary->duration == dif_dive_get_dive_duration(dive));
+        fail_unless(fabs(summary->greatestDepth - dif_dive_get_greatest_depth(dive)) < 1e-9);
+        fail_unless(fabs(summary->averageDepth - dif_dive_get_average_depth(dive)) < 1e-9);
+        fail_unless(fabs(summary->lowestTemperature - dif_dive_get_lowest_temperature(dive)) < 1e-9);
+        fail_unless(summary->initialPressureTank == tank);
+        fail_unless(fabs(summary->initialPressure - dif_dive_get_initial_pressure(dive, -1)) < 1e-9);
+        fail_unless(fabs(summary->finalPressure - dif_dive_get_final_pressure(dive, -1)) < 1e-9);
+        fail_unless(fabs(summary->beginPressure - dif_dive_get_initial_pressure(dive, tank)) < 1e-9);
+        fail_unless(fabs(summary->endPressure - dif_dive_get_final_pressure(dive, tank)) < 1e-9);
+        dif_dive_summary_free(summary);
+    }
+    dif_dive_collection_free(dc);
+
+    /* two tanks in the same samples, tank 2 listed first in the last one */
+    dif_dive_t *dive = dif_dive_alloc();
+    for (ctr = 0; ctr < 3; ctr++) {
+        dif_sample_t *sample = dif_sample_alloc();
+        sample->timestamp = ctr * 10;
+        if (ctr == 2) {
+            sample = _add_pressure(sample, 2, 100.0 - ctr * 5);
+            sample = _add_pressure(sample, 1, 200.0 - ctr * 10);
+        } else {
+            sample = _add_pressure(sample, 1, 200.0 - ctr * 10);
+            sample = _add_pressure(sample, 2, 100.0 - ctr * 5);
+        }
+        dive = dif_dive_add_sample(dive, sample);
+    }
+    dif_dive_summary_t *summary = dif_dive_compute_summary(dive);
+    fail_unless(summary->ntanks == 2, "expected 2 tanks, got %u", summary->ntanks);
+    fail_unless(summary->tanks[0].tank == 1 && fabs(summary->tanks[0].endPressure - 190.0) < 1e-9,
+                "tank 1 is listed second in the last sample, which has no reading for it");
+    fail_unless(summary->tanks[1].tank == 2 && fabs(summary->tanks[1].beginPressure - 90.0) < 1e-9 &&
+                fabs(summary->tanks[1].endPressure - 90.0) < 1e-9);
+    fail_unless(summary->initialPressureTank == 1 && fabs(summary->endPressure - 190.0) < 1e-9);
+    fail_unless(fabs(summary->finalPressure - 90.0) < 1e-9,
+                "final pressure of any tank follows the first reading of the last sample");
+    fail_unless(fabs(summary->greatestDepth) < 1e-9 && summary->duration == 20);
+    dif_dive_summary_free(summary);
+    dif_dive_invalidate_caches(dive);
+    fail_unless(fabs(dif_dive_get_final_pressure(dive, 1) - 190.0) < 1e-9);
+    fail_unless(fabs(dif_dive_get_initial_pressure(dive, 2) - 90.0) < 1e-9);
+    dif_dive_free(dive);
+
+    /* every sample lists tank 2 first, so tank 1 has no readings at all */
+    dive = dif_dive_alloc();
+    for (ctr = 0; ctr < 3; ctr++) {
+        dif_sample_t *sample = dif_sample_alloc();
+        sample->timestamp = ctr * 10;
+        sample = _add_pressure(sample, 2, 100.0 - ctr * 5);
+        sample = _add_pressure(sample, 1, 200.0 - ctr * 10);
+        dive = dif_dive_add_sample(dive, sample);
+    }
+    summary = dif_dive_compute_summary(dive);
+    fail_unless(summary->ntanks == 1 && summary->tanks[0].tank == 2,
+                "only tank 2 should be summarized");
+    fail_unless(summary->initialPressureTank == 2 && fabs(summary->beginPressure - 100.0) < 1e-9 &&
+                fabs(summary->endPressure - 90.0) < 1e-9);
+    dif_dive_invalidate_caches(dive);
+    fail_unless(summary->initialPressureTank == dif_dive_get_initial_pressure_tank(dive));
+    fail_unless(fabs(summary->beginPressure - dif_dive_get_initial_pressure(dive, 2)) < 1e-9);
+    fail_unless(fabs(summary->endPressure - dif_dive_get_final_pressure(dive, 2)) < 1e-9);
+    fail_unless(fabs(dif_dive_get_initial_pressure(dive, 1)) < 1e-9 &&
+                fabs(dif_dive_get_final_pressure(dive, 1)) < 1e-9);
+    dif_dive_summary_free(summary);
+    dif_dive_free(dive);
+}
+END_TEST
+
+/**
+ * samples arriving in order, subsamples after their sample like the
+ * parser callback does, keep the running statistics current; they must
+ * match a fresh scan and be dropped by out-of-order data and truncation
+ */
+START_TEST (test_dif_dive_incremental_stats)
+{
+    gdouble depths[] =   {0.0, 3.0, 6.0, 6.0, 2.0, 0.0, 0.1};
+    gdouble temps[] =    {22.0, 21.0, 18.5, 18.0, 19.0, 20.0, 20.0};
+    gdouble pressures[] = {0.0, 200.0, 190.0, 180.0, 175.0, 172.0, 172.0};
+    dif_dive_t *dive = dif_dive_alloc();
+    guint ctr;
+    for (ctr = 0; ctr < G_N_ELEMENTS(depths); ctr++) {
+        dif_sample_t *sample = dif_dive_alloc_sample(dive);
+        sample->timestamp = ctr * 20;
+        dive = dif_dive_add_sample(dive, sample);
+        dif_subsample_t *ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_DEPTH;
+        ss->value.depth = depths[ctr];
+        dif_sample_add_subsample(sample, ss);
+        ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_TEMPERATURE;
+        ss->value.temperature = temps[ctr];
+        dif_sample_add_subsample(sample, ss);
+        ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_PRESSURE;
+        ss->value.pressure.tank = 0;
+        ss->value.pressure.value = pressures[ctr];
+        dif_sample_add_subsample(sample, ss);
+    }
+    /* alarms do not touch the statistics, wherever they land */
+    dive = dif_dive_add_alarm(dive, 20, DIF_ALARM_ASCENT, 0.0, FALSE);
+    fail_unless(dive->stats != NULL, "in-order ingest should keep running statistics");
+
+    guint duration = dif_dive_get_dive_duration(dive);
+    gdouble greatestDepth = dif_dive_get_greatest_depth(dive);
+    gdouble averageDepth = dif_dive_get_average_depth(dive);
+    gdouble lowestTemperature = dif_dive_get_lowest_temperature(dive);
+    gdouble beginPressure = dif_dive_get_initial_pressure(dive, 0);
+    gdouble endPressure = dif_dive_get_final_pressure(dive, 0);
+    gint tank = dif_dive_get_initial_pressure_tank(dive);
+
+    dif_dive_invalidate_caches(dive);
+    fail_unless(dive->stats == NULL);
+    fail_unless(duration == dif_dive_get_dive_duration(dive) && duration == 120);
+    fail_unless(fabs(greatestDepth - dif_dive_get_greatest_depth(dive)) < 1e-9);
+    fail_unless(fabs(averageDepth - dif_dive_get_average_depth(dive)) < 1e-9);
+    fail_unless(fabs(lowestTemperature - dif_dive_get_lowest_temperature(dive)) < 1e-9);
+    fail_unless(fabs(beginPressure - dif_dive_get_initial_pressure(dive, 0)) < 1e-9);
+    fail_unless(fabs(endPressure - dif_dive_get_final_pressure(dive, 0)) < 1e-9);
+    fail_unless(tank == dif_dive_get_initial_pressure_tank(dive) && tank == 0);
+
+    /* a summary rebuilds the statistics, a late depth reading drops them */
+    dif_dive_summary_free(dif_dive_compute_summary(dive));
+    fail_unless(dive->stats != NULL, "summary should rebuild the statistics");
+    dif_sample_t *sample = dif_dive_alloc_sample(dive);
+    sample->timestamp = 30;
+    dif_subsample_t *ss = dif_dive_alloc_subsample(dive);
+    ss->type = DIF_SAMPLE_DEPTH;
+    ss->value.depth = 9.0;
+    dif_sample_add_subsample(sample, ss);
+    dive = dif_dive_add_sample(dive, sample);
+    fail_unless(dive->stats == NULL, "an out of order depth should drop the statistics");
+    fail_unless(fabs(dif_dive_get_greatest_depth(dive) - 9.0) < 1e-9);
+
+    dif_dive_summary_free(dif_dive_compute_summary(dive));
+    dive = dif_alg_dive_truncate_dive(dive);
+    fail_unless(dive->stats == NULL, "truncation should drop the statistics");
+    fail_unless(dif_dive_get_dive_duration(dive) == 100);
+    dif_dive_free(dive);
+}
+END_TEST
+
+/**
+ * print a dive's samples the way the serializer would see them, one line
+ * per subsample, so two dives can be compared as strings. like the
+ * serializer this groups subsamples by type and keeps their order within
+ * a type
+ */
+static gchar *_dive_fingerprint(dif_dive_t *dive) {
+    GString *out = g_string_new(NULL);
+    guint i, j, type;
+    for (i = 0; i < dive->samples->len; i++) {
+        dif_sample_t *sample = g_ptr_array_index(dive->samples, i);
+        for (type = 0; type < DIF_SAMPLE_TYPE_COUNT; type++) {
+            for (j = 0; j < sample->nsubsamples; j++) {
+                dif_subsample_t *ss = sample->subsamples[j];
+                if (ss->type != type) {
+                    continue;
+                }
+                g_string_append_printf(out, "%u %d ", sample->timestamp, ss->type);
+                switch (ss->type) {
+                case DIF_SAMPLE_DEPTH:
+                    g_string_append_printf(out, "%0.2f\n", ss->value.depth);
+                    break;
+                case DIF_SAMPLE_TEMPERATURE:
+                    g_string_append_printf(out, "%0.2f\n", CELSIUS_TO_KELVIN(ss->value.temperature));
+                    break;
+                case DIF_SAMPLE_PRESSURE:
+                    g_string_append_printf(out, "%u %0.2f\n", ss->value.pressure.tank,
+                                           BAR_TO_PASCAL(ss->value.pressure.value));
+                    break;
+                case DIF_SAMPLE_VENDOR:
+                    g_string_append_printf(out, "%u %u %.*s\n", ss->value.vendor.type, ss->value.vendor.size,
+                                           (int) ss->value.vendor.size, (const gchar *) ss->value.vendor.data);
+                    break;
+                case DIF_SAMPLE_ALARM:
+                    g_string_append_printf(out, "%d\n", ss->value.alarm.type);
+                    break;
+                default:
+                    g_string_append(out, "\n");
+                    break;
+                }
+            }
+        }
+    }
+    return g_string_free(out, FALSE);
+}
+
+/**
+ * compacting and expanding a dive must not change a single printed digit,
+ * and values that do not fit the columns have to survive as extras
+ */
+START_TEST (test_dif_dive_append_samples)
+{
+    dif_sample_record_t records[] = {
+        {0, (1u << DIF_SAMPLE_DEPTH) | (1u << DIF_SAMPLE_TEMPERATURE), 0.0, 24.5},
+        {10, (1u << DIF_SAMPLE_DEPTH) | (1u << DIF_SAMPLE_PRESSURE) | (1u << DIF_SAMPLE_RBT),
+         5.25, 0.0, 200.0, 1, 1200},
+        {30, (1u << DIF_SAMPLE_DEPTH) | (1u << DIF_SAMPLE_HEARTBEAT) | (1u << DIF_SAMPLE_BEARING),
+         12.5, 0.0, 0.0, 0, 0, 90, 270},
+        {20, (1u << DIF_SAMPLE_PRESSURE) | (1u << DIF_SAMPLE_EVENT), 0.0, 0.0, 180.5, 2},
+        {40, 0},
+    };
+    dif_dive_t *bulk = dif_dive_alloc();
+    dif_dive_t *single = dif_dive_alloc();
+    dif_dive_summary_t *bulkSummary, *singleSummary;
+    gchar *bulkPrint, *singlePrint;
+    dif_sample_t *sample;
+    guint i, c;
+    dif_sample_type_t channels[] = {DIF_SAMPLE_DEPTH, DIF_SAMPLE_PRESSURE, DIF_SAMPLE_TEMPERATURE,
+                                    DIF_SAMPLE_RBT, DIF_SAMPLE_HEARTBEAT, DIF_SAMPLE_BEARING};
+
+    /* the same waypoints, one subsample at a time */
+    for (i = 0; i < G_N_ELEMENTS(records); i++) {
+        sample = dif_dive_alloc_sample(single);
+        sample->timestamp = records[i].timestamp;
+        single = dif_dive_add_sample(single, sample);
+        for (c = 0; c < G_N_ELEMENTS(channels); c++) {
+            dif_subsample_t *ss;
+            if (!((records[i].present >> channels[c]) & 1)) {
+                continue;
+            }
+            ss = dif_dive_alloc_subsample(single);
+            ss->type = channels[c];
+            switch (channels[c]) {
+            case DIF_SAMPLE_DEPTH: ss->value.depth = records[i].depth; break;
+            case DIF_SAMPLE_PRESSURE:
+                ss->value.pressure.tank = records[i].pressureTank;
+                ss->value.pressure.value = records[i].pressure;
+                break;
+            case DIF_SAMPLE_TEMPERATURE: ss->value.temperature = records[i].temperature; break;
+            case DIF_SAMPLE_RBT: ss->value.rbt = records[i].rbt; break;
+            case DIF_SAMPLE_HEARTBEAT: ss->value.heartbeat = records[i].heartbeat; break;
+            default: ss->value.bearing = records[i].bearing; break;
+            }
+            dif_sample_add_subsample(sample, ss);
+        }
+    }
+
+    /* two batches, so the second one joins an existing dive */
+    fail_unless(dif_dive_find_sample(bulk, 0) == NULL);
+    bulk = dif_dive_append_samples(bulk, records, 2);
+    bulk = dif_dive_append_samples(bulk, records + 2, G_N_ELEMENTS(records) - 2);
+    bulk = dif_dive_append_samples(bulk, NULL, 0);
+    fail_unless(bulk->samples->len == G_N_ELEMENTS(records));
+    fail_unless(!bulk->samplesSorted, "out of order record should be noticed");
+
+    /* the index built before the second batch was kept up to date */
+    sample = dif_dive_find_sample(bulk, 30);
+    fail_unless(sample != NULL && sample->nsubsamples == 3);
+    fail_unless(dif_sample_get_subsample(sample, DIF_SAMPLE_HEARTBEAT)->value.heartbeat == 90);
+    fail_unless(dif_sample_get_subsample(sample, DIF_SAMPLE_BEARING)->value.bearing == 270);
+    sample = dif_dive_find_sample(bulk, 20);
+    fail_unless(sample->nsubsamples == 1 && !DIF_SAMPLE_HAS(sample, DIF_SAMPLE_EVENT),
+                "only record channels should become subsamples");
+    fail_unless(dif_sample_get_subsample(dif_dive_find_sample(bulk, 10), DIF_SAMPLE_RBT)->value.rbt == 1200);
+    fail_unless(dif_dive_find_sample(bulk, 40)->nsubsamples == 0);
+
+    /* later subsamples still fit on a bulk sample */
+    dif_dive_add_alarm(bulk, 10, DIF_ALARM_ERROR, 0.0, FALSE);
+    dif_dive_add_alarm(single, 10, DIF_ALARM_ERROR, 0.0, FALSE);
+
+    bulkSummary = dif_dive_compute_summary(bulk);
+    singleSummary = dif_dive_compute_summary(single);
+    fail_unless(bulkSummary->duration == singleSummary->duration &&
+                bulkSummary->averageDepth == singleSummary->averageDepth &&
+                bulkSummary->lowestTemperature == singleSummary->lowestTemperature &&
+                bulkSummary->initialPressure == singleSummary->initialPressure &&
+                bulkSummary->finalPressure == singleSummary->finalPressure &&
+                bulkSummary->ntanks == singleSummary->ntanks,
+                "bulk and single ingest should give the same statistics");
+    bulk = dif_dive_sort_samples(bulk);
+    single = dif_dive_sort_samples(single);
+    bulkPrint = _dive_fingerprint(bulk);
+    singlePrint = _dive_fingerprint(single);
+    fail_unless(strcmp(bulkPrint, singlePrint) == 0, "bulk and single ingest differ:\n%s\nvs\n%s",
+                bulkPrint, singlePrint);
+    g_free(bulkPrint);
+    g_free(singlePrint);
+    dif_dive_summary_free(bulkSummary);
+    dif_dive_summary_free(singleSummary);
+    dif_dive_free(bulk);
+    dif_dive_free(single);
+}
+END_TEST
+
+/**
+ * a million samples in a single call, as a large fixture would be built
+ */
+START_TEST (test_dif_dive_append_samples_large)
+{
+    const guint n = 1000000;
+    dif_sample_record_t *records = g_new0(dif_sample_record_t, n);
+    dif_dive_t *dive = dif_dive_alloc();
+    dif_dive_summary_t *summary;
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        records[i].timestamp = i;
+        records[i].present = (1u << DIF_SAMPLE_DEPTH) | (1u << DIF_SAMPLE_TEMPERATURE);
+        records[i].depth = (i % 1000) / 10.0;
+        records[i].temperature = 10.0 + (i % 7);
+    }
+    dive = dif_dive_append_samples(dive, records, n);
+    g_free(records);
+
+    fail_unless(dive->samples->len == n && dive->samplesSorted);
+    summary = dif_dive_compute_summary(dive);
+    fail_unless(summary->duration == n - 1);
+    fail_unless(ABS(summary->greatestDepth - 99.9) < 0.001);
+    fail_unless(ABS(summary->lowestTemperature - 10.0) < 0.001);
+    fail_unless(ABS(dif_dive_get_profile(dive)->depth[n - 1] - 99.9) < 0.001);
+    dif_dive_summary_free(summary);
+    dif_dive_free(dive);
+}
+END_TEST
+
+START_TEST (test_dif_dive_samples_in_range)
+{
+    dif_dive_t *dive = dif_dive_alloc();
+    dif_sample_record_t records[11];
+    dif_sample_slice_t slice;
+    dif_sample_cursor_t cursor;
+    guint i, nslices, nsamples;
+    guint counts[4];
+    gdouble greatestDepth, averageDepth, finalPressure;
+
+    /* every 10 seconds, added in reverse so the query has to sort */
+    for (i = 0; i < 11; i++) {
+        guint t = (10 - i) * 10;
+        memset(&records[i], 0, sizeof(dif_sample_record_t));
+        records[i].timestamp = t;
+        records[i].present = (1u << DIF_SAMPLE_DEPTH) | (1u << DIF_SAMPLE_PRESSURE);
+        records[i].depth = t <= 50 ? t / 2.0 : (100 - t) / 2.0;
+        records[i].pressure = 200.0 - t;
+        records[i].pressureTank = 1;
+    }
+    dive = dif_dive_append_samples(dive, records, 11);
+
+    slice = dif_dive_samples_in_range(dive, 20, 50);
+    fail_unless(slice.n == 3 && slice.first == 2, "expected rows 2..4, got %u from %u", slice.n, slice.first);
+    fail_unless(slice.samples[0]->timestamp == 20 && slice.samples[2]->timestamp == 40);
+    fail_unless(slice.samples[0] == g_ptr_array_index(dive->samples, 2), "slice should point into the dive");
+    fail_unless(dif_sample_slice_get_initial_pressure(&slice, -1) == 180.0);
+    fail_unless(dif_sample_slice_get_final_pressure(&slice, 1) == 160.0);
+    fail_unless(dif_sample_slice_get_greatest_depth(&slice) == 20.0);
+    fail_unless(dif_sample_slice_get_average_depth(&slice) == 15.0);
+    fail_unless(dif_sample_slice_get_initial_pressure_tank(&slice) == 1);
+
+    slice = dif_dive_samples_in_range(dive, 25, 25);
+    fail_unless(slice.n == 0);
+    slice = dif_dive_samples_in_range(dive, 50, 20);
+    fail_unless(slice.n == 0);
+    slice = dif_dive_samples_in_range(dive, 95, G_MAXUINT);
+    fail_unless(slice.n == 1 && slice.samples[0]->timestamp == 100);
+    slice = dif_dive_samples_in_range(dive, 200, 300);
+    fail_unless(slice.n == 0 && slice.first == 11);
+    fail_unless(dif_sample_slice_get_average_depth(&slice) == 0.0);
+
+    /* windows of 30 seconds cover every sample exactly once */
+    nslices = nsamples = 0;
+    dif_sample_cursor_init(&cursor, dive, 0, G_MAXUINT, 30);
+    while (dif_sample_cursor_next(&cursor, &slice)) {
+        fail_unless(nslices < 4, "too many windows");
+        fail_unless(slice.from == nslices * 30);
+        fail_unless(slice.first == nsamples, "windows should be contiguous");
+        counts[nslices++] = slice.n;
+        nsamples += slice.n;
+    }
+    fail_unless(nslices == 4 && nsamples == 11);
+    fail_unless(counts[0] == 3 && counts[1] == 3 && counts[2] == 3 && counts[3] == 2);
+    fail_unless(slice.to == 101, "last window should end after the last sample");
+    fail_unless(!dif_sample_cursor_next(&cursor, &slice));
+
+    /* a window of 0 is the whole range, an empty range has no windows */
+    dif_sample_cursor_init(&cursor, dive, 10, 40, 0);
+    fail_unless(dif_sample_cursor_next(&cursor, &slice) && slice.n == 3);
+    fail_unless(!dif_sample_cursor_next(&cursor, &slice));
+    dif_sample_cursor_init(&cursor, dive, 40, 40, 10);
+    fail_unless(!dif_sample_cursor_next(&cursor, &slice));
+
+    /* the getters answer the same from a slice as from the statistics */
+    greatestDepth = dif_dive_get_greatest_depth(dive);
+    averageDepth = dif_dive_get_average_depth(dive);
+    finalPressure = dif_dive_get_final_pressure(dive, -1);
+    dif_dive_invalidate_stats(dive);
+    fail_unless(dif_dive_get_greatest_depth(dive) == greatestDepth);
+    fail_unless(dif_dive_get_average_depth(dive) == averageDepth);
+    fail_unless(dif_dive_get_final_pressure(dive, -1) == finalPressure);
+    fail_unless(dif_dive_get_initial_pressure(dive, 1) == 200.0);
+    fail_unless(dif_dive_get_initial_pressure_tank(dive) == 1);
+    fail_unless(dif_dive_get_lowest_temperature(dive) == 0.0);
+
+    /* a gap leaves empty windows in between */
+    dif_dive_free(dive);
+    dive = dif_dive_alloc();
+    dive = dif_dive_append_samples(dive, records, 1);
+    dive = dif_dive_append_samples(dive, records + 10, 1);
+    nslices = 0;
+    dif_sample_cursor_init(&cursor, dive, 0, G_MAXUINT, 30);
+    while (dif_sample_cursor_next(&cursor, &slice)) {
+        counts[nslices++] = slice.n;
+    }
+    fail_unless(nslices == 4 && counts[0] == 1 && counts[1] == 0 && counts[2] == 0 && counts[3] == 1);
+    dif_dive_free(dive);
+}
+END_TEST
+
+START_TEST (test_dif_dive_compact)
+{
+    dif_dive_t *dive = dif_dive_alloc();
+    guint ctr;
+    for (ctr = 0; ctr < 2000; ctr++) {
+        dif_sample_t *sample = dif_dive_alloc_sample(dive);
+        sample->timestamp = ctr * 2;
+        dive = dif_dive_add_sample(dive, sample);
+        dif_subsample_t *ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_DEPTH;
+        /* values near a rounding boundary, negative depth is an extra */
+        ss->value.depth = ctr == 5 ? -0.5 : ctr * 0.015 + 0.005;
+        dif_sample_add_subsample(sample, ss);
+        ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_TEMPERATURE;
+        ss->value.temperature = 24.0 - ctr * 0.0073;
+        dif_sample_add_subsample(sample, ss);
+        ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_PRESSURE;
+        ss->value.pressure.tank = 0;
+        /* more than the 32-bit column holds, and a second tank */
+        ss->value.pressure.value = ctr == 6 ? 500.0 : 210.0 - ctr * 0.0137;
+        dif_sample_add_subsample(sample, ss);
+        if (ctr == 7) {
+            ss = dif_dive_alloc_subsample(dive);
+            ss->type = DIF_SAMPLE_PRESSURE;
+            ss->value.pressure.tank = 1;
+            ss->value.pressure.value = 180.25;
+            dif_sample_add_subsample(sample, ss);
+        }
+        if (ctr == 8) {
+            ss = dif_dive_alloc_subsample(dive);
+            dif_dive_subsample_set_vendor(dive, ss, 3, 4, "abcd");
+            dif_sample_add_subsample(sample, ss);
+        }
+    }
+    dive = dif_dive_add_alarm(dive, 40, DIF_ALARM_ASCENT, 0.0, FALSE);
+
+    gchar *before = _dive_fingerprint(dive);
+    gsize arenaBytes = dive->arena->bytesAllocated;
+    gdouble greatestDepth = dif_dive_get_greatest_depth(dive);
+
+    dive = dif_dive_compact(dive);
+    fail_unless(dive->compact != NULL && dive->samples->len == 0);
+    fail_unless(dive->compact->nrows == 2000);
+    /* depth, pressure, second tank, vendor and alarm */
+    fail_unless(dive->compact->nextras == 5, "expected 5 extras, got %u", dive->compact->nextras);
+    fail_unless(dive->compact->arena->bytesAllocated * 4 < arenaBytes,
+                "compact samples should be a fraction of the arena (%lu vs %lu)",
+                (unsigned long) dive->compact->arena->bytesAllocated, (unsigned long) arenaBytes);
+
+    dive = dif_dive_expand(dive);
+    fail_unless(dive->compact == NULL && dive->samples->len == 2000);
+    gchar *after = _dive_fingerprint(dive);
+    fail_unless(strcmp(before, after) == 0, "expanded samples should print the same");
+    fail_unless(dive->stats != NULL, "expanding should rebuild the running statistics");
+    fail_unless(dif_dive_get_greatest_depth(dive) == greatestDepth);
+
+    g_free(before);
+    g_free(after);
+    dif_dive_free(dif_dive_compact(dive));
+}
+END_TEST
+
+START_TEST (test_dif_fixed_from_double)
+{
+    gdouble values[] = {0.0, 0.005, 0.015, 0.125, 0.375, 1.005, 2.675, -1.005, 1234.565, 291.3, 99.995};
+    guint ctr;
+    for (ctr = 0; ctr < G_N_ELEMENTS(values); ctr++) {
+        gchar expected[64];
+        gchar actual[64];
+        gint64 fixed;
+        fail_unless(dif_fixed_from_double(values[ctr], 100, &fixed));
+        g_snprintf(expected, sizeof(expected), "%0.2f", values[ctr]);
+        g_snprintf(actual, sizeof(actual), "%s%" G_GINT64_FORMAT ".%02" G_GINT64_FORMAT,
+                   fixed < 0 ? "-" : "",
+                   ABS(fixed) / 100, ABS(fixed) % 100);
+        fail_unless(strcmp(expected, actual) == 0, "%s != %s", expected, actual);
+    }
+    gint64 fixed;
+    fail_if(dif_fixed_from_double(INFINITY, 100, &fixed));
+    fail_if(dif_fixed_from_double(1e300, 100, &fixed));
+}
+END_TEST
+
+/**
+ * a small xorshift generator, so the values do not depend on the platform
+ */
+static guint64 _xorshift(guint64 *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+START_TEST (test_dif_format_fixed)
+{
+    gdouble values[] = {0.0, -0.0, -0.001, 0.005, 0.015, 0.125, 2.675, -1.005, 99.995, 291.3,
+                        1e15, 4.6e15, 1e300, -1e300, INFINITY, -INFINITY, NAN, 0.5, 1.5, 2.5};
+    gchar expected[512];
+    gchar actual[512];
+    guint64 state = 88172645463325252ULL;
+    guint decimals, ctr;
+    gsize len;
+
+    for (decimals = 0; decimals <= 10; decimals++) {
+        for (ctr = 0; ctr < G_N_ELEMENTS(values); ctr++) {
+            g_snprintf(expected, sizeof(expected), "%.*f", decimals, values[ctr]);
+            len = dif_format_fixed(actual, sizeof(actual), values[ctr], decimals);
+            fail_unless(strcmp(expected, actual) == 0 && len == strlen(expected),
+                        "%s != %s", expected, actual);
+        }
+    }
+
+    /* depths, temperatures and pressures the way the serializer sees them,
+     * and values on the halves where rounding is hardest */
+    for (ctr = 0; ctr < 200000; ctr++) {
+        gdouble value;
+        switch (ctr % 4) {
+        case 0: value = (_xorshift(&state) % 20000) / 100.0; break;
+        case 1: value = CELSIUS_TO_KELVIN((gint64) (_xorshift(&state) % 6000) / 100.0 - 20.0); break;
+        case 2: value = BAR_TO_PASCAL((_xorshift(&state) % 300000) / 1000.0); break;
+        default: value = ((gint64) (_xorshift(&state) % 2000000) - 1000000) / 1000.0 + 0.0005; break;
+        }
+        decimals = 1 + ctr % 4;
+        g_snprintf(expected, sizeof(expected), "%.*f", decimals, value);
+        dif_format_fixed(actual, sizeof(actual), value, decimals);
+        fail_unless(strcmp(expected, actual) == 0, "%s != %s", expected, actual);
+    }
+
+    gint64 ints[] = {0, 7, -7, 10, 99, 100, -100, 123456789, G_MAXINT64, G_MININT64};
+    for (ctr = 0; ctr < G_N_ELEMENTS(ints); ctr++) {
+        g_snprintf(expected, sizeof(expected), "%" G_GINT64_FORMAT, ints[ctr]);
+        len = dif_format_int(actual, sizeof(actual), ints[ctr]);
+        fail_unless(strcmp(expected, actual) == 0 && len == strlen(expected),
+                    "%s != %s", expected, actual);
+    }
+
+    /* a buffer too small for the fast path truncates like g_snprintf */
+    len = dif_format_fixed(actual, 4, 1234.5678, 2);
+    fail_unless(strcmp(actual, "123") == 0 && len == 7);
+}
+END_TEST
+
 START_TEST (test_dif_dive_get_average_depth)
 {
     dif_dive_collection_t *dc = _create_simple_dive_collection();
-    dif_dive_t *dive = g_list_first(dc->dives)->data;
+    dif_dive_t *dive = g_ptr_array_index(dc->dives, 0);
     /* trapezoid over depths {0,1,2,2,1,0} at 30s spacing = 180m*s / 150s */
     fail_unless(fabs(dif_dive_get_average_depth(dive) - 1.2) < 0.001,
                 "average depth of dive1 should be 1.2");
@@ -375,7 +1459,7 @@ END_TEST
 START_TEST (test_dif_dive_get_greatest_depth)
 {
     dif_dive_collection_t *dc = _create_simple_dive_collection();
-    dif_dive_t *dive = g_list_first(dc->dives)->data;
+    dif_dive_t *dive = g_ptr_array_index(dc->dives, 0);
     fail_unless(fabs(dif_dive_get_greatest_depth(dive) - 2.0) < 0.001,
                 "greatest depth of dive1 should be 2.0");
     dif_dive_collection_free(dc);
@@ -390,11 +1474,11 @@ END_TEST
 START_TEST (test_dif_dive_get_lowest_temperature)
 {
     dif_dive_collection_t *dc = _create_simple_dive_collection();
-    dif_dive_t *dive1 = g_list_first(dc->dives)->data;
+    dif_dive_t *dive1 = g_ptr_array_index(dc->dives, 0);
     fail_unless(fabs(dif_dive_get_lowest_temperature(dive1) - 20.0) < 0.001,
                 "lowest temperature of dive1 should be 20.0");
     /* dive2 has no temperature subsamples */
-    dif_dive_t *dive2 = g_list_next(g_list_first(dc->dives))->data;
+    dif_dive_t *dive2 = g_ptr_array_index(dc->dives, 1);
     fail_unless(fabs(dif_dive_get_lowest_temperature(dive2)) < 0.001,
                 "lowest temperature without temperature samples should be 0.0");
     dif_dive_collection_free(dc);
@@ -404,7 +1488,7 @@ END_TEST
 START_TEST (test_dif_dive_get_dive_duration)
 {
     dif_dive_collection_t *dc = _create_simple_dive_collection();
-    dif_dive_t *dive = g_list_first(dc->dives)->data;
+    dif_dive_t *dive = g_ptr_array_index(dc->dives, 0);
     fail_unless(dif_dive_get_dive_duration(dive) == 150,
                 "dive duration of dive1 should be 150");
     dif_dive_collection_free(dc);
@@ -496,24 +1580,580 @@ START_TEST(test_dif_save_dive_collection_uddf)
 }
 END_TEST
 
+/**
+ * the memory report counts every sample and subsample once, and the
+ * serializer can measure the document it built
+ */
+START_TEST (test_dif_dive_collection_memory_stats)
+{
+    dif_dive_collection_t *dc = _create_simple_dive_collection();
+    guint nsamples = 0, ndepths = 0;
+    guint i, j;
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_dive_t *dive = g_ptr_array_index(dc->dives, i);
+        nsamples += dive->samples->len;
+        for (j = 0; j < dive->samples->len; j++) {
+            dif_sample_t *sample = g_ptr_array_index(dive->samples, j);
+            ndepths += dif_sample_get_subsample(sample, DIF_SAMPLE_DEPTH) != NULL;
+        }
+    }
+
+    dif_memory_stats_t *stats = dif_dive_collection_memory_stats(dc);
+    fail_unless(stats->dives.count == dc->dives->len);
+    fail_unless(stats->samples.count == nsamples);
+    fail_unless(stats->subsamples[DIF_SAMPLE_DEPTH].count == ndepths);
+    fail_unless(stats->subsamples[DIF_SAMPLE_DEPTH].bytes == ndepths * sizeof(dif_subsample_t));
+    fail_unless(stats->gasmixes.count >= 2, "air and eanx32 should be interned");
+    fail_unless(stats->totalBytes >= stats->heapBytes + stats->arenas.bytes + stats->dives.bytes);
+    fail_unless(strcmp(dif_sample_type_name(DIF_SAMPLE_TEMPERATURE), "temperature") == 0);
+    fail_unless(dif_sample_type_name(DIF_SAMPLE_TYPE_COUNT) == NULL);
+    gsize before = stats->totalBytes;
+    dif_memory_stats_free(stats);
+
+    /* compacting moves the samples out of the per-dive arenas */
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_dive_compact(g_ptr_array_index(dc->dives, i));
+    }
+    stats = dif_dive_collection_memory_stats(dc);
+    fail_unless(stats->samples.count == 0 && stats->compactRows.count == nsamples);
+    fail_unless(stats->totalBytes != before);
+    dif_memory_stats_free(stats);
+
+    xml_options_t *options = dif_xml_options_alloc();
+    options->filename = "test_memory.uddf";
+    options->measureDocument = TRUE;
+    dif_save_dive_collection_uddf_options(dc, options);
+    fail_unless(options->documentNodes > nsamples, "every waypoint is a node");
+    fail_unless(options->documentBytes > options->documentNodes * sizeof(xmlNode));
+    dif_xml_options_free(options);
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * read a UDDF file without the generator timestamp, which is the only
+ * part that differs between two saves of the same collection
+ */
+static gchar *_strip_uddf_timestamp(gchar *contents, const gchar *filename) {
+    gchar *start = strstr(contents, "<datetime>");
+    fail_unless(start != NULL, "%s has no generator timestamp", filename);
+    gchar *end = strchr(start, '\n');
+    memmove(start, end, strlen(end) + 1);
+    return contents;
+}
+
+static gchar *_read_uddf_without_timestamp(const gchar *filename) {
+    gchar *contents = NULL;
+    fail_unless(g_file_get_contents(filename, &contents, NULL, NULL), "could not read %s", filename);
+    return _strip_uddf_timestamp(contents, filename);
+}
+
+/**
+ * read back a compressed file, checking it starts with the magic number
+ * of its codec
+ */
+static gchar *_read_compressed(const gchar *filename, dif_compression_t compression) {
+    static const guchar gzipMagic[] = {0x1f, 0x8b};
+    static const guchar zstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+    GString *plain = g_string_new(NULL);
+    gchar *packed = NULL;
+    gsize length = 0;
+    gchar chunk[4096];
+
+    fail_unless(g_file_get_contents(filename, &packed, &length, NULL), "could not read %s", filename);
+    if (compression == DIF_COMPRESSION_GZIP) {
+        fail_unless(length > 2 && memcmp(packed, gzipMagic, 2) == 0, "%s is not gzip", filename);
+        gzFile gz = gzopen(filename, "rb");
+        int n;
+        while ((n = gzread(gz, chunk, sizeof(chunk))) > 0) {
+            g_string_append_len(plain, chunk, n);
+        }
+        fail_unless(n == 0, "could not decompress %s", filename);
+        gzclose(gz);
+    }
+#ifdef HAVE_ZSTD
+    if (compression == DIF_COMPRESSION_ZSTD) {
+        fail_unless(length > 4 && memcmp(packed, zstdMagic, 4) == 0, "%s is not zstd", filename);
+        ZSTD_DCtx *context = ZSTD_createDCtx();
+        ZSTD_inBuffer in = {packed, length, 0};
+        gsize remaining = 0;
+        while (in.pos < in.size) {
+            ZSTD_outBuffer out = {chunk, sizeof(chunk), 0};
+            remaining = ZSTD_decompressStream(context, &out, &in);
+            fail_unless(!ZSTD_isError(remaining), "could not decompress %s", filename);
+            g_string_append_len(plain, chunk, out.pos);
+        }
+        fail_unless(remaining == 0, "%s ends in the middle of a frame", filename);
+        ZSTD_freeDCtx(context);
+    }
+#else
+    (void) zstdMagic;
+#endif
+    g_free(packed);
+    return g_string_free(plain, FALSE);
+}
+
+/**
+ * a collection with dated and undated dives, a setmarker that needs
+ * escaping and the non-schema elements
+ */
+static dif_dive_collection_t *_create_uddf_writer_collection() {
+    dif_dive_collection_t *dc = _create_simple_dive_collection();
+    dif_dive_t *dive = dif_dive_alloc();
+    dc = dif_dive_collection_add_dive(dc, dive);
+    dif_sample_t *sample = dif_dive_alloc_sample(dive);
+    sample->timestamp = 10;
+    dive = dif_dive_add_sample(dive, sample);
+    dif_subsample_t *ss = dif_dive_alloc_subsample(dive);
+    dif_dive_subsample_set_setmarker(dive, ss, "stop <5m> & \"safety\"");
+    dif_sample_add_subsample(sample, ss);
+    ss = dif_dive_alloc_subsample(dive);
+    ss->type = DIF_SAMPLE_EVENT;
+    ss->value.event.type = DIF_SAMPLE_EVENT_ASCENT;
+    dif_sample_add_subsample(sample, ss);
+    ss = dif_dive_alloc_subsample(dive);
+    dif_dive_subsample_set_vendor(dive, ss, 3, 4, "\x01\x02\xfe\xff");
+    dif_sample_add_subsample(sample, ss);
+    dive = dif_dive_add_alarm(dive, 10, DIF_ALARM_ERROR, 2.0, TRUE);
+    return dc;
+}
+
+/**
+ * save a collection with every writer and check they all write what the
+ * document tree writes
+ */
+static void _check_uddf_writers(dif_dive_collection_t *dc, xml_options_t *options) {
+    options->writer = DIF_XML_WRITER_TREE;
+    options->filename = "test_tree.uddf";
+    dif_save_dive_collection_uddf_options(dc, options);
+    gchar *tree = _read_uddf_without_timestamp("test_tree.uddf");
+
+    options->writer = DIF_XML_WRITER_STREAM;
+    options->filename = "test_stream.uddf";
+    dif_save_dive_collection_uddf_options(dc, options);
+    gchar *stream = _read_uddf_without_timestamp("test_stream.uddf");
+    fail_unless(strcmp(tree, stream) == 0, "streaming output differs from the document tree");
+
+    options->writer = DIF_XML_WRITER_DIRECT;
+    options->filename = "test_direct.uddf";
+    dif_save_dive_collection_uddf_options(dc, options);
+    gchar *direct = _read_uddf_without_timestamp("test_direct.uddf");
+    fail_unless(strcmp(tree, direct) == 0, "direct output differs from the document tree");
+
+    g_free(tree);
+    g_free(stream);
+    g_free(direct);
+}
+
+/**
+ * the streaming and direct writers produce the same file as the document
+ * tree, and streaming only ever holds a single dive of it
+ */
+START_TEST (test_dif_save_dive_collection_uddf_writers)
+{
+    dif_dive_collection_t *dc = _create_uddf_writer_collection();
+    xml_options_t *options = dif_xml_options_alloc();
+    options->useInvalidElements = TRUE;
+    options->measureDocument = TRUE;
+    options->filename = "test_tree.uddf";
+    dif_save_dive_collection_uddf_options(dc, options);
+    gsize treeNodes = options->documentNodes;
+
+    options->filename = "test_stream.uddf";
+    options->writer = DIF_XML_WRITER_STREAM;
+    dif_save_dive_collection_uddf_options(dc, options);
+    fail_unless(options->documentNodes > 0 && options->documentNodes < treeNodes,
+                "streaming should only hold one dive, %u of %u nodes",
+                (guint) options->documentNodes, (guint) treeNodes);
+
+    _check_uddf_writers(dc, options);
+    gchar *direct = _read_uddf_without_timestamp("test_direct.uddf");
+    fail_unless(strstr(direct, "stop &lt;5m&gt; &amp; \"safety\"") != NULL, "setmarker text should be escaped");
+    fail_unless(strstr(direct, "<vendor type=\"3\" size=\"4\">0102FEFF</vendor>") != NULL);
+    g_free(direct);
+
+    /* the schema elements alone, and a compacted collection */
+    options->useInvalidElements = FALSE;
+    _check_uddf_writers(dc, options);
+    guint i;
+    for (i = 0; i < dc->dives->len; i++) {
+        dif_dive_compact(g_ptr_array_index(dc->dives, i));
+    }
+    _check_uddf_writers(dc, options);
+
+    /* an empty collection still has a generator and a profiledata */
+    dif_dive_collection_free(dc);
+    dc = dif_dive_collection_alloc();
+    _check_uddf_writers(dc, options);
+
+    dif_xml_options_free(options);
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * the direct writer renders dives on a pool of workers and still writes
+ * them in order, whatever the number of workers
+ */
+START_TEST (test_dif_save_dive_collection_uddf_threads)
+{
+    dif_dive_collection_t *dc = _create_uddf_writer_collection();
+    xml_options_t *options = dif_xml_options_alloc();
+    guint threads[] = {1, 4, 64};
+    guint d, i;
+
+    /* three dives a day, some of them compacted, and more undated ones */
+    for (d = 0; d < 45; d++) {
+        dif_dive_t *dive = dif_dive_alloc();
+        if (d < 40) {
+            dive = dif_dive_set_datetime_utc(dive, 2013, 3, 1 + d / 3, 9 + (d % 3) * 3, 0, 0);
+        }
+        for (i = 0; i < 20; i++) {
+            dif_sample_t *sample = dif_dive_alloc_sample(dive);
+            sample->timestamp = i * 30;
+            dif_subsample_t *ss = dif_dive_alloc_subsample(dive);
+            ss->type = DIF_SAMPLE_DEPTH;
+            ss->value.depth = (i < 10 ? i : 20 - i) * 1.5 + d * 0.01;
+            dif_sample_add_subsample(sample, ss);
+            ss = dif_dive_alloc_subsample(dive);
+            ss->type = DIF_SAMPLE_TEMPERATURE;
+            ss->value.temperature = 20.0 - i * 0.1;
+            dif_sample_add_subsample(sample, ss);
+            dive = dif_dive_add_sample(dive, sample);
+        }
+        if (d % 3 == 0) {
+            dive = dif_dive_compact(dive);
+        }
+        dc = dif_dive_collection_add_dive(dc, dive);
+    }
+
+    options->filename = "test_tree.uddf";
+    dif_save_dive_collection_uddf_options(dc, options);
+    gchar *tree = _read_uddf_without_timestamp("test_tree.uddf");
+    options->writer = DIF_XML_WRITER_DIRECT;
+    options->filename = "test_direct.uddf";
+    for (i = 0; i < G_N_ELEMENTS(threads); i++) {
+        options->threads = threads[i];
+        dif_save_dive_collection_uddf_options(dc, options);
+        gchar *direct = _read_uddf_without_timestamp("test_direct.uddf");
+        fail_unless(strcmp(tree, direct) == 0, "direct output with %u workers differs from the document tree",
+                    threads[i]);
+        g_free(direct);
+    }
+
+    /* frozen dives are only ever read by the workers */
+    dc = dif_dive_collection_freeze(dc);
+    options->threads = 4;
+    dif_save_dive_collection_uddf_options(dc, options);
+    gchar *direct = _read_uddf_without_timestamp("test_direct.uddf");
+    fail_unless(strcmp(tree, direct) == 0, "direct output of frozen dives differs from the document tree");
+    g_free(direct);
+
+    g_free(tree);
+    dif_xml_options_free(options);
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * a compacted dive writes the same informationafterdive as before, even
+ * where the packed values would round the summary a second time
+ */
+START_TEST (test_dif_save_dive_collection_uddf_compact_summary)
+{
+    dif_dive_collection_t *dc = dif_dive_collection_alloc();
+    xml_options_t *options = dif_xml_options_alloc();
+    dif_dive_t *dive = dif_dive_alloc();
+    gdouble depths[] = {0.0, 4.023, 10.046, 7.512, 0.0};
+    gdouble temperatures[] = {12.349, 12.296, 12.296, 12.311, 12.349};
+    gdouble pressures[] = {200.004, 192.436, 186.447, 181.954, 180.017};
+    guint i;
+
+    dive = dif_dive_set_datetime_utc(dive, 2013, 3, 1, 9, 0, 0);
+    for (i = 0; i < G_N_ELEMENTS(depths); i++) {
+        dif_sample_t *sample = dif_dive_alloc_sample(dive);
+        sample->timestamp = i * 60;
+        dive = dif_dive_add_sample(dive, sample);
+        dif_subsample_t *ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_DEPTH;
+        ss->value.depth = depths[i];
+        dif_sample_add_subsample(sample, ss);
+        ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_TEMPERATURE;
+        ss->value.temperature = temperatures[i];
+        dif_sample_add_subsample(sample, ss);
+        ss = dif_dive_alloc_subsample(dive);
+        ss->type = DIF_SAMPLE_PRESSURE;
+        ss->value.pressure.tank = 0;
+        ss->value.pressure.value = pressures[i];
+        dif_sample_add_subsample(sample, ss);
+    }
+    dc = dif_dive_collection_add_dive(dc, dive);
+
+    /* drop the running statistics so the save has to rebuild them */
+    dif_dive_invalidate_caches(dive);
+    dif_dive_summary_t *before = dif_dive_compute_summary(dive);
+    dif_dive_invalidate_caches(dive);
+    options->filename = "test_tree.uddf";
+    dif_save_dive_collection_uddf_options(dc, options);
+    gchar *plain = _read_uddf_without_timestamp("test_tree.uddf");
+    fail_unless(strstr(plain, "<greatestdepth>10.0</greatestdepth>") != NULL);
+
+    dive = dif_dive_compact(dive);
+    _check_uddf_writers(dc, options);
+    gchar *compact = _read_uddf_without_timestamp("test_tree.uddf");
+    fail_unless(strcmp(plain, compact) == 0, "a compacted dive should write the same file");
+
+    dive = dif_dive_expand(dive);
+    dif_dive_summary_t *after = dif_dive_compute_summary(dive);
+    fail_unless(after->greatestDepth == before->greatestDepth);
+    fail_unless(after->averageDepth == before->averageDepth);
+    fail_unless(after->lowestTemperature == before->lowestTemperature);
+    fail_unless(after->initialPressure == before->initialPressure);
+    fail_unless(after->finalPressure == before->finalPressure);
+
+    dif_dive_summary_free(before);
+    dif_dive_summary_free(after);
+    g_free(plain);
+    g_free(compact);
+    dif_xml_options_free(options);
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * a dive without a usable date is written without a datetime by every
+ * writer, the way an undated dive is
+ */
+START_TEST (test_dif_save_dive_collection_uddf_undated)
+{
+    dif_dive_collection_t *dc = _create_uddf_writer_collection();
+    xml_options_t *options = dif_xml_options_alloc();
+    dif_dive_t *dive = dif_dive_alloc();
+    dive = dif_dive_set_datetime(dive, 0, 0, 0, 0, 0, 0);
+    fail_unless(!dive->hasStartTime);
+    dc = dif_dive_collection_add_dive(dc, dive);
+
+    /* one set directly, outside the years GDateTime holds */
+    dive = dif_dive_alloc();
+    dive->hasStartTime = TRUE;
+    dive->startTime = G_GINT64_CONSTANT(-70000000000);
+    dc = dif_dive_collection_add_dive(dc, dive);
+
+    _check_uddf_writers(dc, options);
+    gchar *tree = _read_uddf_without_timestamp("test_tree.uddf");
+    fail_unless(strstr(tree, "<datetime>-") == NULL && strstr(tree, "<datetime>0000") == NULL);
+    g_free(tree);
+
+    dif_xml_options_free(options);
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * every writer can compress what it writes, and the file holds the same
+ * UDDF as an uncompressed save once it is decompressed
+ */
+START_TEST (test_dif_save_dive_collection_uddf_compressed)
+{
+    dif_dive_collection_t *dc = _create_uddf_writer_collection();
+    xml_options_t *options = dif_xml_options_alloc();
+    dif_xml_writer_t writers[] = {DIF_XML_WRITER_TREE, DIF_XML_WRITER_STREAM, DIF_XML_WRITER_DIRECT};
+    dif_compression_t codecs[] = {DIF_COMPRESSION_GZIP, DIF_COMPRESSION_ZSTD};
+    guint i, j;
+
+    options->filename = "test_tree.uddf";
+    dif_save_dive_collection_uddf_options(dc, options);
+    gchar *plain = _read_uddf_without_timestamp("test_tree.uddf");
+
+    fail_unless(dif_compression_max_level(DIF_COMPRESSION_NONE) == 0);
+    fail_unless(dif_compression_max_level(DIF_COMPRESSION_GZIP) == 9);
+    for (i = 0; i < G_N_ELEMENTS(codecs); i++) {
+        gint maxLevel = dif_compression_max_level(codecs[i]);
+        if (maxLevel == 0) {
+            /* not built in */
+            fail_unless(dif_emitter_open_compressed("test_compressed.uddf", codecs[i], 0) == NULL);
+            continue;
+        }
+        fail_unless(dif_emitter_open_compressed("test_compressed.uddf", codecs[i], maxLevel + 1) == NULL,
+                    "a level past the highest should be refused");
+        options->compression = codecs[i];
+        options->filename = "test_compressed.uddf";
+        for (j = 0; j < G_N_ELEMENTS(writers); j++) {
+            options->writer = writers[j];
+            options->compressionLevel = j == 0 ? 0 : j == 1 ? 1 : maxLevel;
+            dif_save_dive_collection_uddf_options(dc, options);
+            gchar *unpacked = _strip_uddf_timestamp(_read_compressed("test_compressed.uddf", codecs[i]), "test_compressed.uddf");
+            fail_unless(strcmp(plain, unpacked) == 0, "writer %d with codec %d wrote something else",
+                        writers[j], codecs[i]);
+            g_free(unpacked);
+        }
+    }
+
+    /* blocks larger than the buffer of the emitter are compressed too */
+    dif_emitter_t *emitter = dif_emitter_open_compressed("test_emitter.txt.gz", DIF_COMPRESSION_GZIP, 0);
+    fail_unless(emitter != NULL);
+    gchar *block = g_strnfill(3 * 1024 * 1024, 'x');
+    DIF_EMIT_LITERAL(emitter, "<");
+    dif_emitter_write_string(emitter, block);
+    DIF_EMIT_LITERAL(emitter, ">");
+    fail_unless(dif_emitter_close(emitter));
+    gchar *unpacked = _read_compressed("test_emitter.txt.gz", DIF_COMPRESSION_GZIP);
+    fail_unless(strlen(unpacked) == strlen(block) + 2 && strncmp(unpacked + 1, block, strlen(block)) == 0,
+                "a large block should come back whole");
+    g_free(unpacked);
+    g_free(block);
+
+    g_free(plain);
+    dif_xml_options_free(options);
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
+/**
+ * the emitter escapes free text and attributes like libxml2, and a memory
+ * emitter keeps everything however much is written
+ */
+START_TEST (test_dif_emitter)
+{
+    dif_emitter_t *emitter = dif_emitter_new();
+    dif_emitter_write_text(emitter, "a<b>&\"c\"\r");
+    DIF_EMIT_LITERAL(emitter, "|");
+    dif_emitter_write_attribute(emitter, "a<b>&\"c\"\n\t");
+    DIF_EMIT_LITERAL(emitter, "|");
+    dif_emitter_write_int(emitter, G_MININT64);
+    DIF_EMIT_LITERAL(emitter, "|");
+    dif_emitter_write_int(emitter, 0);
+    DIF_EMIT_LITERAL(emitter, "|");
+    dif_emitter_write_double(emitter, 2.675, 2);
+    const gchar *expected = "a&lt;b&gt;&amp;\"c\"&#13;|a&lt;b&gt;&amp;&quot;c&quot;&#10;&#9;"
+                            "|-9223372036854775808|0|2.67";
+    fail_unless(emitter->len == strlen(expected) && memcmp(emitter->buffer, expected, emitter->len) == 0,
+                "unexpected emitter output");
+
+    guint i;
+    for (i = 0; i < 100000; i++) {
+        DIF_EMIT_LITERAL(emitter, "0123456789");
+    }
+    fail_unless(emitter->len == strlen(expected) + 1000000);
+    fail_unless(memcmp(emitter->buffer + emitter->len - 10, "0123456789", 10) == 0);
+    fail_unless(dif_emitter_close(emitter));
+
+    /* a file emitter flushes as its buffer fills up */
+    emitter = dif_emitter_open("test_emitter.txt");
+    fail_unless(emitter != NULL);
+    for (i = 0; i < 300000; i++) {
+        DIF_EMIT_LITERAL(emitter, "0123456789");
+    }
+    fail_unless(emitter->flushed > 0, "a full buffer should have been written");
+    fail_unless(dif_emitter_close(emitter));
+    gchar *contents = NULL;
+    gsize length = 0;
+    fail_unless(g_file_get_contents("test_emitter.txt", &contents, &length, NULL));
+    fail_unless(length == 3000000);
+    g_free(contents);
+    fail_unless(dif_emitter_open("no/such/directory/test.txt") == NULL);
+}
+END_TEST
+
+static dif_subsample_t *_add_subsample(dif_dive_t *dive, dif_sample_t *sample, dif_sample_type_t type) {
+    dif_subsample_t *ss = dif_dive_alloc_subsample(dive);
+    ss->type = type;
+    dif_sample_add_subsample(sample, ss);
+    return ss;
+}
+
+/**
+ * waypoint children come out in schema order whatever order the
+ * subsamples are in, with elements of the same name in subsample order,
+ * also when there are too many to order on the stack
+ */
+START_TEST (test_dif_uddf_waypoint_order)
+{
+    const gchar *expected[] = {"alarm", "alarm", "depth", "depth", "depth", "depth", "divetime",
+                               "heading", "heartrate", "remainingbottomtime", "setmarker",
+                               "tankpressure", "temperature", "temperature"};
+    guint nextra[] = {0, 40};
+    guint round, i;
+    for (round = 0; round < G_N_ELEMENTS(nextra); round++) {
+        dif_dive_collection_t *dc = dif_dive_collection_alloc();
+        dif_dive_t *dive = dif_dive_alloc();
+        dc = dif_dive_collection_add_dive(dc, dive);
+        dif_sample_t *sample = dif_dive_alloc_sample(dive);
+        dif_subsample_t *ss;
+        sample->timestamp = 0;
+        dive = dif_dive_add_sample(dive, sample);
+
+        _add_subsample(dive, sample, DIF_SAMPLE_TEMPERATURE)->value.temperature = 20.0;
+        _add_subsample(dive, sample, DIF_SAMPLE_BEARING)->value.bearing = 90;
+        _add_subsample(dive, sample, DIF_SAMPLE_BEARING)->value.bearing = 65535;
+        ss = _add_subsample(dive, sample, DIF_SAMPLE_PRESSURE);
+        ss->value.pressure.value = 200.0;
+        _add_subsample(dive, sample, DIF_SAMPLE_RBT)->value.rbt = 600;
+        _add_subsample(dive, sample, DIF_SAMPLE_EVENT)->value.event.type = DIF_SAMPLE_EVENT_ASCENT;
+        _add_subsample(dive, sample, DIF_SAMPLE_HEARTBEAT)->value.heartbeat = 80;
+        _add_subsample(dive, sample, DIF_SAMPLE_DEPTH)->value.depth = 1.0;
+        ss = dif_dive_alloc_subsample(dive);
+        dif_dive_subsample_set_setmarker(dive, ss, "first");
+        dif_sample_add_subsample(sample, ss);
+        _add_subsample(dive, sample, DIF_SAMPLE_DEPTH)->value.depth = 2.0;
+        ss = _add_subsample(dive, sample, DIF_SAMPLE_ALARM);
+        ss->value.alarm.type = DIF_ALARM_DECO;
+        _add_subsample(dive, sample, DIF_SAMPLE_TEMPERATURE)->value.temperature = 21.0;
+        /* only one setmarker is allowed, the first one wins */
+        _add_subsample(dive, sample, DIF_SAMPLE_EVENT)->value.event.type = DIF_SAMPLE_EVENT_BOOKMARK;
+        _add_subsample(dive, sample, DIF_SAMPLE_DEPTH)->value.depth = 3.0;
+        _add_subsample(dive, sample, DIF_SAMPLE_DEPTH)->value.depth = 4.0;
+        /* headings without data add subsamples but no children */
+        for (i = 0; i < nextra[round]; i++) {
+            _add_subsample(dive, sample, DIF_SAMPLE_BEARING)->value.bearing = 65535;
+        }
+        dif_save_dive_collection_uddf(dc, "test_order.uddf");
+        dif_dive_collection_free(dc);
+
+        xmlDocPtr doc = xmlReadFile("test_order.uddf", NULL, 0);
+        fail_unless(doc != NULL, "could not parse test_order.uddf");
+        xmlXPathContextPtr ctx = xmlXPathNewContext(doc);
+        xmlXPathObjectPtr obj = xmlXPathEvalExpression(BAD_CAST "//*[local-name()='waypoint']/*", ctx);
+        fail_unless(obj != NULL && obj->nodesetval != NULL);
+        fail_unless(obj->nodesetval->nodeNr == G_N_ELEMENTS(expected),
+                    "expected %u waypoint children, got %d", G_N_ELEMENTS(expected), obj->nodesetval->nodeNr);
+        for (i = 0; i < G_N_ELEMENTS(expected); i++) {
+            fail_unless(xmlStrcmp(obj->nodesetval->nodeTab[i]->name, BAD_CAST expected[i]) == 0,
+                        "child %u should be %s, got %s", i, expected[i], obj->nodesetval->nodeTab[i]->name);
+        }
+        xmlChar *first = xmlNodeGetContent(obj->nodesetval->nodeTab[0]);
+        xmlChar *depth = xmlNodeGetContent(obj->nodesetval->nodeTab[5]);
+        xmlChar *setmarker = xmlNodeGetContent(obj->nodesetval->nodeTab[10]);
+        fail_unless(xmlStrcmp(first, BAD_CAST "ascent") == 0, "alarms should keep their order");
+        fail_unless(xmlStrcmp(depth, BAD_CAST "4.00") == 0, "depths should keep their order");
+        fail_unless(xmlStrcmp(setmarker, BAD_CAST "first") == 0, "the first setmarker should win");
+        xmlFree(first);
+        xmlFree(depth);
+        xmlFree(setmarker);
+        xmlXPathFreeObject(obj);
+        xmlXPathFreeContext(ctx);
+        xmlFreeDoc(doc);
+    }
+}
+END_TEST
+
 START_TEST (test_dif_alg_dc_initial_pressure_fix)
 {
     dif_dive_collection_t *dc = _create_simple_dive_collection();
     dc = dif_alg_dc_initial_pressure_fix(dc);
-    GList *dives = g_list_first(dc->dives);
-    while (dives != NULL) {
-        dif_dive_t *dive = dives->data;
-        GList *samples = g_list_first(dive->samples);
-        while (samples != NULL) {
-            dif_sample_t *sample = samples->data;
+    guint ctr;
+    for (ctr = 0; ctr < dc->dives->len; ctr++) {
+        dif_dive_t *dive = g_ptr_array_index(dc->dives, ctr);
+        guint i;
+        for (i = 0; i < dive->samples->len; i++) {
+            dif_sample_t *sample = g_ptr_array_index(dive->samples, i);
             dif_subsample_t *pressure = dif_sample_get_subsample(sample, DIF_SAMPLE_PRESSURE);
             if (pressure != NULL) {
                 fail_unless(pressure->value.pressure.value > 1.0,
                         "dif_alg_dc_initial_pressure_fix did not reset initial pressures above 1.0bar");
             }
-            samples = g_list_next(samples);
         }
-        dives = g_list_next(dives);
     };
 }
 END_TEST
@@ -522,14 +2162,12 @@ START_TEST (test_dif_alg_dc_truncate_dives)
 {
     dif_dive_collection_t *dc = _create_simple_dive_collection();
     dc = dif_alg_dc_truncate_dives(dc);
-    GList *dives = g_list_first(dc->dives);
-    dif_dive_t *dive = dives->data;
-    fail_unless(g_list_length(dive->samples) == 6,
+    dif_dive_t *dive = g_ptr_array_index(dc->dives, 0);
+    fail_unless(dive->samples->len == 6,
                 "dif_alg_dc_truncate_dives truncated too many dives");
 
-    dives = g_list_next(dives);
-    dive = dives->data;
-    fail_unless(g_list_length(dive->samples) == 8,
+    dive = g_ptr_array_index(dc->dives, 1);
+    fail_unless(dive->samples->len == 8,
                 "dif_alg_dc_trunacte_dives didn't properly truncate dives");
 }
 END_TEST
@@ -564,6 +2202,45 @@ START_TEST (test_dif_gasmix_type)
 }
 END_TEST
 
+/**
+ * mixes within GAS_EPSILON of each other intern to the same id and name,
+ * and the names belong to the gas table
+ */
+START_TEST (test_dif_gas_intern)
+{
+    dif_gasmix_t *gasmix = dif_gasmix_alloc();
+    guint air = dif_gas_intern(gasmix);
+    gasmix->oxygen = 21.05;
+    gasmix->nitrogen = 78.95;
+    fail_unless(dif_gas_intern(gasmix) == air, "a mix within tolerance should be air");
+    fail_unless(strcmp(dif_gas_name(air), "air") == 0);
+    fail_unless(dif_gas_get(air)->type == DIF_GASMIX_AIR);
+
+    /* just outside the tolerance is no longer air */
+    gasmix->oxygen = 21.1;
+    gasmix->nitrogen = 78.9;
+    fail_unless(dif_gasmix_type(gasmix) == DIF_GASMIX_UNKNOWN);
+    fail_unless(dif_gas_intern(gasmix) != air);
+
+    gasmix->oxygen = 36.0;
+    gasmix->nitrogen = 64.0;
+    fail_unless(dif_gasmix_type(gasmix) == DIF_GASMIX_EANX36);
+
+    gasmix->oxygen = 18.0;
+    gasmix->nitrogen = 37.0;
+    gasmix->helium = 45.0;
+    guint trimix = dif_gas_intern(gasmix);
+    const gchar *name = dif_gasmix_name(gasmix);
+    fail_unless(strcmp(name, "mix_18o2_37n245he00ar00h2") == 0, "got %s", name);
+    fail_unless(name == dif_gas_name(trimix), "names should be interned");
+    gasmix->helium = 45.5;
+    fail_unless(dif_gas_intern(gasmix) == trimix, "mixes with the same name should share an id");
+    fail_unless(dif_gas_count() > trimix);
+    fail_unless(dif_gas_get(dif_gas_count()) == NULL);
+    dif_gasmix_free(gasmix);
+}
+END_TEST
+
 /**
  * helper to append one Uwatec Smart framed record to a buffer:
  * [A5 A5 5A 5A][uint32 LE length incl. 8-byte header][payload]
@@ -757,7 +2434,7 @@ START_TEST (test_dif_dive_add_alarm)
 
     /* merging into the existing sample at the same timestamp */
     dive = dif_dive_add_alarm(dive, 60, DIF_ALARM_ERROR, 2.0, TRUE);
-    fail_unless(g_list_length(dive->samples) == 1,
+    fail_unless(dive->samples->len == 1,
                 "alarm at an existing timestamp should not create a sample");
     dif_subsample_t *ss = dif_sample_get_subsample(sample, DIF_SAMPLE_ALARM);
     fail_unless(ss != NULL, "sample at t=60 should have an alarm subsample");
@@ -766,7 +2443,7 @@ START_TEST (test_dif_dive_add_alarm)
 
     /* creating a new sample at an unseen timestamp */
     dive = dif_dive_add_alarm(dive, 90, DIF_ALARM_ASCENT, 0.0, FALSE);
-    fail_unless(g_list_length(dive->samples) == 2,
+    fail_unless(dive->samples->len == 2,
                 "alarm at a new timestamp should create a sample");
     dif_sample_t *created = dif_dive_find_sample(dive, 90);
     fail_unless(created != NULL, "the created sample should be findable");
@@ -780,6 +2457,55 @@ START_TEST (test_dif_dive_add_alarm)
 }
 END_TEST
 
+/**
+ * a sorted batch of alarms merged into dive1: existing timestamps are
+ * shared, new ones get a single sample each, and the dive stays sorted
+ */
+START_TEST (test_dif_dive_add_alarms)
+{
+    dif_dive_collection_t *dc = _create_simple_dive_collection();
+    dif_dive_t *dive = g_ptr_array_index(dc->dives, 0);
+    dif_alarm_t alarms[] = {
+        {30, DIF_ALARM_ERROR, 1.0, TRUE},
+        {45, DIF_ALARM_ERROR, 2.0, TRUE},
+        {45, DIF_ALARM_ASCENT, 0.0, FALSE},
+        {150, DIF_ALARM_DECO, 0.0, FALSE},
+        {200, DIF_ALARM_SURFACE, 0.0, FALSE},
+        {10, DIF_ALARM_RBT, 0.0, FALSE},  /* out of order */
+        {60, DIF_ALARM_RBT, 0.0, FALSE},  /* still behind t=200 */
+        {60, DIF_ALARM_ERROR, 3.0, TRUE}
+    };
+    guint i;
+
+    dive = dif_dive_add_alarms(dive, alarms, G_N_ELEMENTS(alarms));
+    fail_unless(dive->samples->len == 9,
+                "expected 6 samples plus 3 new ones, got %u", dive->samples->len);
+    for (i = 1; i < dive->samples->len; i++) {
+        dif_sample_t *prev = g_ptr_array_index(dive->samples, i - 1);
+        dif_sample_t *sample = g_ptr_array_index(dive->samples, i);
+        fail_unless(prev->timestamp <= sample->timestamp, "samples should be sorted");
+    }
+
+    dif_sample_t *sample = dif_dive_find_sample(dive, 30);
+    fail_unless(DIF_SAMPLE_HAS(sample, DIF_SAMPLE_DEPTH) && DIF_SAMPLE_HAS(sample, DIF_SAMPLE_ALARM),
+                "alarm at t=30 should share the existing waypoint");
+    sample = dif_dive_find_sample(dive, 45);
+    fail_unless(sample != NULL && sample->nsubsamples == 2,
+                "both alarms at t=45 should land on one new sample");
+    fail_unless(dif_dive_find_sample(dive, 10) != NULL, "out of order alarm should be attached");
+    sample = dif_dive_find_sample(dive, 60);
+    fail_unless(sample != NULL && sample->nsubsamples == 5,
+                "repeated out of order alarms should share the existing waypoint");
+    fail_unless(dif_dive_find_sample(dive, 200) != NULL, "alarm past the end should be attached");
+
+    /* the index follows samples removed by truncation */
+    dive = dif_alg_dive_truncate_dive(dive);
+    fail_unless(dif_dive_find_sample(dive, 200) == NULL, "truncated sample should not be found");
+    fail_unless(dif_dive_find_sample(dive, 150) != NULL, "last surface sample should be kept");
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
 START_TEST (test_dif_subsample_vendor_deep_copy)
 {
     guint8 payload[4] = {0xDE, 0xAD, 0xBE, 0xEF};
@@ -803,6 +2529,55 @@ START_TEST (test_dif_subsample_vendor_deep_copy)
 }
 END_TEST
 
+START_TEST (test_dif_dive_vendor_source_view)
+{
+    guint8 record[16] = {0xA5, 0xA5, 0x5A, 0x5A, 16, 0, 0, 0, 0xDE, 0xAD, 0xBE, 0xEF, 1, 2, 3, 4};
+    guint8 outside[4] = {0xCA, 0xFE, 0xBA, 0xBE};
+    GBytes *source = g_bytes_new(record, sizeof(record));
+    const guint8 *data = g_bytes_get_data(source, NULL);
+    dif_dive_collection_t *dc = dif_dive_collection_alloc();
+    dif_dive_t *dive = dif_dive_alloc();
+    dif_sample_t *sample = dif_dive_alloc_sample(dive);
+    dif_subsample_t *view, *copy, *heap;
+    dif_memory_stats_t *stats;
+
+    dc = dif_dive_collection_add_dive(dc, dive);
+    dive = dif_dive_set_source(dive, source);
+    g_bytes_unref(source);
+    dive = dif_dive_add_sample(dive, sample);
+
+    /* payloads inside the source are views, anything else is copied */
+    view = dif_dive_subsample_set_vendor(dive, dif_dive_alloc_subsample(dive), 1, 4, data + 8);
+    copy = dif_dive_subsample_set_vendor(dive, dif_dive_alloc_subsample(dive), 2, 4, outside);
+    dif_sample_add_subsample(sample, view);
+    dif_sample_add_subsample(sample, copy);
+    fail_unless(view->value.vendor.data == data + 8, "payload inside the source should not be copied");
+    fail_unless(copy->value.vendor.data != outside, "payload outside the source should be copied");
+    fail_unless(dif_dive_source_contains(dive, data, sizeof(record)));
+    fail_unless(!dif_dive_source_contains(dive, data + 12, 8), "payload running past the source is not inside it");
+
+    /* heap subsamples are released one by one, so they always copy */
+    heap = dif_dive_subsample_set_vendor(dive, dif_subsample_alloc(), 4, 4, data + 8);
+    fail_unless(heap->value.vendor.data != data + 8, "heap subsample should copy its payload");
+    dif_subsample_free(heap);
+
+    stats = dif_dive_collection_memory_stats(dc);
+    fail_unless(stats->vendorViews.count == 1 && stats->vendorViews.bytes == 4);
+    fail_unless(stats->vendorBlobs.count == 1);
+    fail_unless(stats->sources.count == 1 && stats->sources.bytes == sizeof(record));
+    dif_memory_stats_free(stats);
+
+    /* compaction keeps the view */
+    dive = dif_dive_compact(dive);
+    dive = dif_dive_expand(dive);
+    sample = g_ptr_array_index(dive->samples, 0);
+    view = dif_sample_get_subsample(sample, DIF_SAMPLE_VENDOR);
+    fail_unless(view->value.vendor.type == 1 && view->value.vendor.data == data + 8,
+                "compaction should keep payloads that point into the source");
+    dif_dive_collection_free(dc);
+}
+END_TEST
+
 /**
  * helper: number of nodes matching an xpath expression
  */
@@ -1044,17 +2819,26 @@ dif_suite (void)
     TCase *tc_core = tcase_create("Core");
     tcase_add_test(tc_core, test_dif_dive_collection_alloc);
     tcase_add_test(tc_core, test_dif_dive_alloc);
+    tcase_add_test(tc_core, test_dif_dive_set_datetime);
+    tcase_add_test(tc_core, test_dif_dive_ref_freeze);
     tcase_add_test(tc_core, test_dif_sample_alloc);
     tcase_add_test(tc_core, test_dif_gasmix_alloc);
     tcase_add_test(tc_core, test_dif_subsample_alloc);
     tcase_add_test(tc_core, test_dif_dive_collection_add_dive);
+    tcase_add_test(tc_core, test_dif_dive_collection_sort_dives);
+    tcase_add_test(tc_core, test_dif_dive_collection_sort_dives_runs);
+    tcase_add_test(tc_core, test_dif_dive_collection_days);
     tcase_add_test(tc_core, test_dif_dive_add_sample);
+    tcase_add_test(tc_core, test_dif_dive_add_many_samples);
+    tcase_add_test(tc_core, test_dif_dive_arena_allocations);
     tcase_add_test(tc_core, test_dif_dive_add_gasmix);
     tcase_add_test(tc_core, test_dif_sample_add_subsample);
+    tcase_add_test(tc_core, test_dif_sample_get_subsample);
     suite_add_tcase(s, tc_core);
 
     TCase *tc_methods = tcase_create("Methods");
     tcase_add_test(tc_methods, test_dif_gasmix_type);
+    tcase_add_test(tc_methods, test_dif_gas_intern);
     tcase_add_test(tc_methods, test_dif_dive_set_avgdepth);
     tcase_add_test(tc_methods, test_dif_dive_set_tank_pressures);
     tcase_add_test(tc_methods, test_dif_dive_set_min_temperature);
@@ -1062,25 +2846,46 @@ dif_suite (void)
     tcase_add_test(tc_methods, test_dif_dive_get_final_pressure_no_pressure);
     tcase_add_test(tc_methods, test_dif_dive_get_initial_pressure_tank);
     tcase_add_test(tc_methods, test_dif_dive_pressures_multi_tank);
+    tcase_add_test(tc_methods, test_dif_sample_slice_pressures_shared_sample);
+    tcase_add_test(tc_methods, test_dif_dive_get_profile);
+    tcase_add_test(tc_methods, test_dif_dive_sort_samples);
     tcase_add_test(tc_methods, test_dif_dive_get_average_depth);
     tcase_add_test(tc_methods, test_dif_dive_get_average_depth_edge);
     tcase_add_test(tc_methods, test_dif_dive_get_greatest_depth);
     tcase_add_test(tc_methods, test_dif_dive_get_lowest_temperature);
     tcase_add_test(tc_methods, test_dif_dive_get_dive_duration);
+    tcase_add_test(tc_methods, test_dif_dive_compute_summary);
+    tcase_add_test(tc_methods, test_dif_dive_incremental_stats);
+    tcase_add_test(tc_methods, test_dif_dive_append_samples);
+    tcase_add_test(tc_methods, test_dif_dive_append_samples_large);
+    tcase_add_test(tc_methods, test_dif_dive_samples_in_range);
+    tcase_add_test(tc_methods, test_dif_dive_compact);
+    tcase_add_test(tc_methods, test_dif_fixed_from_double);
+    tcase_add_test(tc_methods, test_dif_format_fixed);
     suite_add_tcase(s, tc_methods);
 
     TCase *tc_uddf = tcase_create("UDDF");
     tcase_add_test(tc_uddf, test_dif_save_simple_dive_collection_uddf);
     tcase_add_test(tc_uddf, test_dif_save_dive_collection_uddf);
+    tcase_add_test(tc_uddf, test_dif_dive_collection_memory_stats);
     tcase_add_test(tc_uddf, test_dif_uddf_informationafterdive_values);
     tcase_add_test(tc_uddf, test_dif_uddf_alarm_emission);
+    tcase_add_test(tc_uddf, test_dif_save_dive_collection_uddf_writers);
+    tcase_add_test(tc_uddf, test_dif_save_dive_collection_uddf_threads);
+    tcase_add_test(tc_uddf, test_dif_save_dive_collection_uddf_compact_summary);
+    tcase_add_test(tc_uddf, test_dif_save_dive_collection_uddf_undated);
+    tcase_add_test(tc_uddf, test_dif_save_dive_collection_uddf_compressed);
+    tcase_add_test(tc_uddf, test_dif_emitter);
+    tcase_add_test(tc_uddf, test_dif_uddf_waypoint_order);
     suite_add_tcase(s, tc_uddf);
 
     TCase *tc_alarms = tcase_create("Alarms");
     tcase_add_test(tc_alarms, test_dif_alarm_type_name);
     tcase_add_test(tc_alarms, test_dif_sample_event_to_alarm);
     tcase_add_test(tc_alarms, test_dif_dive_add_alarm);
+    tcase_add_test(tc_alarms, test_dif_dive_add_alarms);
     tcase_add_test(tc_alarms, test_dif_subsample_vendor_deep_copy);
+    tcase_add_test(tc_alarms, test_dif_dive_vendor_source_view);
     tcase_add_test(tc_alarms, test_uwatec_alarms_decode_warning_and_alarm);
     tcase_add_test(tc_alarms, test_uwatec_alarms_decode_time_sample);
     tcase_add_test(tc_alarms, test_uwatec_alarms_decode_errors);